@@ -26,6 +26,15 @@ void Uncompressed_FreeChunk(Chunk_t *chunk) {
     free(chunk);
 }
 
+Chunk_t *Uncompressed_CloneChunk(Chunk_t *chunk) {
+    Chunk *oldChunk = (Chunk *)chunk;
+    Chunk *newChunk = malloc(sizeof(Chunk));
+    memcpy(newChunk, oldChunk, sizeof(Chunk));
+    newChunk->samples = malloc(newChunk->size);
+    memcpy(newChunk->samples, oldChunk->samples, oldChunk->num_samples * SAMPLE_SIZE);
+    return newChunk;
+}
+
 /**
  * TODO: describe me
  * @param chunk
@@ -277,6 +286,57 @@ void Uncompressed_LoadFromRDB(Chunk_t **chunk, struct RedisModuleIO *io) {
                              (ReadStringBufferFunc)RedisModule_LoadStringBuffer);
 }
 
-void Uncompressed_GearsSerialize(Chunk_t *chunk, Gears_BufferWriter *bw) {}
+void Uncompressed_SaveToBlob(Chunk_t *chunk, ChunkBlob *blob) {
+    Uncompressed_GenericSerialize(chunk,
+                                  blob,
+                                  (SaveUnsignedFunc)ChunkBlob_WriteUnsigned,
+                                  (SaveStringBufferFunc)ChunkBlob_WriteStringBuffer);
+}
+
+void Uncompressed_LoadFromBlob(Chunk_t **chunk, ChunkBlob *blob) {
+    const size_t offset = blob->offset;
+    Uncompressed_SkipInBlob(blob);
+    if (blob->error) {
+        *chunk = NULL;
+        return;
+    }
+    blob->offset = offset;
+    Uncompressed_Deserialize(chunk,
+                             blob,
+                             (ReadUnsignedFunc)ChunkBlob_ReadUnsigned,
+                             (ReadStringBufferFunc)ChunkBlob_ReadStringBuffer);
+}
+
+// The samples have to fit in the data of the chunk
+void Uncompressed_SkipInBlob(ChunkBlob *blob) {
+    ChunkBlob_ReadUnsigned(blob); // base_timestamp
+    const u_int64_t numSamples = ChunkBlob_ReadUnsigned(blob);
+    const u_int64_t size = ChunkBlob_ReadUnsigned(blob);
+    const size_t len = ChunkBlob_SkipStringBuffer(blob);
+    if (len != size || numSamples > size / SAMPLE_SIZE) {
+        blob->error = true;
+    }
+}
+
+// The samples are sent as they are laid out in memory, without the unused capacity of the chunk
+void Uncompressed_GearsSerialize(Chunk_t *chunk, Gears_BufferWriter *bw) {
+    Chunk *uncompchunk = chunk;
+
+    RedisGears_BWWriteLong(bw, uncompchunk->base_timestamp);
+    RedisGears_BWWriteBuffer(
+        bw, (char *)uncompchunk->samples, uncompchunk->num_samples * SAMPLE_SIZE);
+}
+
+void Uncompressed_GearsDeserialize(Chunk_t **chunk, Gears_BufferReader *br) {
+    Chunk *uncompchunk = (Chunk *)malloc(sizeof(*uncompchunk));
 
-void Uncompressed_GearsDeserialize(Chunk_t *chunk, Gears_BufferReader *br) {}
+    uncompchunk->base_timestamp = RedisGears_BRReadLong(br);
+    size_t size = 0;
+    const char *samples = RedisGears_BRReadBuffer(br, &size);
+    uncompchunk->num_samples = size / SAMPLE_SIZE;
+    // a full chunk, the samples of a result aren't appended to
+    uncompchunk->size = uncompchunk->num_samples * SAMPLE_SIZE;
+    uncompchunk->samples = (Sample *)malloc(max(uncompchunk->size, SAMPLE_SIZE));
+    memcpy(uncompchunk->samples, samples, uncompchunk->size);
+    *chunk = (Chunk_t *)uncompchunk;
+}
@@ -30,6 +30,7 @@ typedef struct ChunkIterator
 
 Chunk_t *Uncompressed_NewChunk(size_t sampleCount);
 void Uncompressed_FreeChunk(Chunk_t *chunk);
+Chunk_t *Uncompressed_CloneChunk(Chunk_t *chunk);
 
 /**
  * TODO: describe me
@@ -72,9 +73,12 @@ void Uncompressed_FreeChunkIterator(ChunkIter_t *iter);
 // RDB
 void Uncompressed_SaveToRDB(Chunk_t *chunk, struct RedisModuleIO *io);
 void Uncompressed_LoadFromRDB(Chunk_t **chunk, struct RedisModuleIO *io);
+void Uncompressed_SaveToBlob(Chunk_t *chunk, ChunkBlob *blob);
+void Uncompressed_LoadFromBlob(Chunk_t **chunk, ChunkBlob *blob);
+void Uncompressed_SkipInBlob(ChunkBlob *blob);
 
 // Gears
 void Uncompressed_GearsSerialize(Chunk_t *chunk, Gears_BufferWriter *bw);
-void Uncompressed_GearsDeserialize(Chunk_t *chunk, Gears_BufferReader *br);
+void Uncompressed_GearsDeserialize(Chunk_t **chunk, Gears_BufferReader *br);
 
 #endif
@@ -0,0 +1,744 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "cluster.h"
+
+#include "config.h"
+#include "consts.h"
+#include "generic_chunk.h"
+#include "indexer.h"
+#include "query_language.h"
+#include "reply.h"
+#include "resultset.h"
+#include "tsdb.h"
+
+#include <stdint.h>
+#include <string.h>
+#include "rmutil/alloc.h"
+
+#define CLUSTER_MSG_QUERY 1
+#define CLUSTER_MSG_ANSWER 2
+
+#define ANSWER_OK 0
+#define ANSWER_ERROR 1
+#define ANSWER_TOO_LARGE 2
+
+// An answer is sent as a single cluster bus message, which holds up the gossip and the heartbeats
+// of the link while it's written
+#define ANSWER_MAX_LEN (16 * 1024 * 1024)
+
+/*
+ * A query is the u64 id of the request, its ClusterQueryType and the arguments of the command.
+ * An answer is the id of the request, a status and the matching series of the shard:
+ *   TS.QUERYINDEX - the key name
+ *   TS.MGET       - the key name, the labels, and whether the series has a last sample with its
+ *                   timestamp and value
+ *   TS.MRANGE     - the key name, the labels and the result samples in compressed chunks
+ * The labels are only sent when the reply or GROUPBY needs them. An answer longer than
+ * ANSWER_MAX_LEN only has the id and the ANSWER_TOO_LARGE status.
+ */
+
+typedef struct ShardAnswer
+{
+    char id[REDISMODULE_NODE_ID_LEN];
+    ChunkBlob blob; // NULL data until the shard answered
+} ShardAnswer;
+
+typedef struct FanOutRequest
+{
+    long long id;
+    ClusterQueryType type;
+    RedisModuleBlockedClient *bc;
+    // the arguments are copied, the parsed arguments of the command point into them
+    RedisModuleString **argv;
+    int argc;
+    MRangeArgs mrangeArgs;
+    MGetArgs mgetArgs;
+    ShardAnswer *shards; // the shard the query was called on comes first
+    size_t shardsCount;
+    size_t pending;
+    size_t unreachable; // the failing shards the query wasn't sent to
+} FanOutRequest;
+
+// The requests waiting for answers, by id. Only used from the main thread.
+static RedisModuleDict *requests = NULL;
+static long long nextRequestId = 0;
+static unsigned long long partialReplies = 0;
+static unsigned long long missingShardAnswers = 0;
+
+static void FanOutRequest_Free(FanOutRequest *request) {
+    if (request->type == CLUSTER_MGET) {
+        MGetArgs_Free(&request->mgetArgs);
+    } else if (request->type != CLUSTER_QUERYINDEX) {
+        MRangeArgs_Free(&request->mrangeArgs);
+    }
+    for (int i = 0; i < request->argc; i++) {
+        RedisModule_FreeString(NULL, request->argv[i]);
+    }
+    free(request->argv);
+    for (size_t i = 0; i < request->shardsCount; i++) {
+        free(request->shards[i].blob.data);
+    }
+    free(request->shards);
+    free(request);
+}
+
+static void writeString(ChunkBlob *blob, RedisModuleString *str) {
+    size_t len;
+    const char *buf = RedisModule_StringPtrLen(str, &len);
+    ChunkBlob_WriteStringBuffer(blob, buf, len);
+}
+
+static RedisModuleString *readString(ChunkBlob *blob) {
+    size_t len;
+    char *buf = ChunkBlob_ReadStringBuffer(blob, &len);
+    if (buf == NULL) {
+        return NULL;
+    }
+    RedisModuleString *str = RedisModule_CreateString(NULL, buf, len);
+    free(buf);
+    return str;
+}
+
+static void writeDouble(ChunkBlob *blob, double value) {
+    u_int64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    ChunkBlob_WriteUnsigned(blob, bits);
+}
+
+static double readDouble(ChunkBlob *blob) {
+    const u_int64_t bits = ChunkBlob_ReadUnsigned(blob);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void writeLabels(ChunkBlob *blob, const Series *series, bool withLabels) {
+    if (!withLabels) {
+        ChunkBlob_WriteUnsigned(blob, 0);
+        return;
+    }
+    ChunkBlob_WriteUnsigned(blob, series->labelsCount);
+    for (size_t i = 0; i < series->labelsCount; i++) {
+        writeString(blob, series->labels[i].key);
+        writeString(blob, series->labels[i].value);
+    }
+}
+
+// A temporary series with the key name and the labels of an answer entry, NULL when truncated
+static Series *readSeries(ChunkBlob *blob) {
+    RedisModuleString *keyName = readString(blob);
+    const size_t labelsCount = ChunkBlob_ReadUnsigned(blob);
+    if (blob->error) {
+        if (keyName) {
+            RedisModule_FreeString(NULL, keyName);
+        }
+        return NULL;
+    }
+    Label *labels = calloc(labelsCount, sizeof(Label));
+    for (size_t i = 0; i < labelsCount && !blob->error; i++) {
+        labels[i].key = readString(blob);
+        labels[i].value = readString(blob);
+    }
+    if (blob->error) {
+        for (size_t i = 0; i < labelsCount; i++) {
+            if (labels[i].key) {
+                RedisModule_FreeString(NULL, labels[i].key);
+            }
+            if (labels[i].value) {
+                RedisModule_FreeString(NULL, labels[i].value);
+            }
+        }
+        free(labels);
+        RedisModule_FreeString(NULL, keyName);
+        return NULL;
+    }
+
+    CreateCtx createArgs = { 0 };
+    createArgs.isTemporary = true;
+    createArgs.skipChunkCreation = true;
+    Series *series = NewSeries(keyName, &createArgs);
+    SeriesSetLabels(series, labels, labelsCount);
+    series->funcs = GetChunkClass(CHUNK_COMPRESSED);
+    return series;
+}
+
+// Evaluate a query on the series of this shard into `answer`, of at most `maxLen` bytes
+static void evaluateQuery(RedisModuleCtx *ctx,
+                          ClusterQueryType type,
+                          RedisModuleString **argv,
+                          int argc,
+                          size_t maxLen,
+                          ChunkBlob *answer) {
+    MGetArgs mgetArgs = { 0 };
+    MRangeArgs mrangeArgs = { 0 };
+    QueryPredicateList *queries = NULL;
+    int status = REDISMODULE_OK;
+    if (type == CLUSTER_QUERYINDEX) {
+        int response = 0;
+        queries = parseLabelListFromArgs(ctx, argv, 1, argc - 1, &response);
+        status = response == TSDB_ERROR ? REDISMODULE_ERR : REDISMODULE_OK;
+    } else if (type == CLUSTER_MGET) {
+        status = parseMGetCommand(ctx, argv, argc, &mgetArgs);
+        queries = mgetArgs.queryPredicates;
+    } else {
+        status = parseMRangeCommand(ctx, argv, argc, &mrangeArgs);
+        mrangeArgs.reverse = type == CLUSTER_MREVRANGE;
+        queries = mrangeArgs.queryPredicates;
+    }
+    if (status != REDISMODULE_OK) {
+        if (type == CLUSTER_QUERYINDEX) {
+            QueryPredicateList_Free(queries);
+        }
+        ChunkBlob_WriteUnsigned(answer, ANSWER_ERROR);
+        return;
+    }
+    const size_t statusOffset = answer->len;
+    ChunkBlob_WriteUnsigned(answer, ANSWER_OK);
+
+    const bool withLabels = type == CLUSTER_MGET
+                                ? mgetArgs.withLabels || mgetArgs.numLimitLabels > 0
+                                : mrangeArgs.withLabels || mrangeArgs.numLimitLabels > 0 ||
+                                      mrangeArgs.groupByLabel != NULL;
+    // the number of series is known once they are all opened
+    const size_t countOffset = answer->len;
+    ChunkBlob_WriteUnsigned(answer, 0);
+    u_int64_t count = 0;
+
+    QueryIndexResult *result = QueryIndexStart(ctx, queries->list, queries->count);
+    RedisModuleString *keyName;
+    while (answer->len <= maxLen && (keyName = QueryIndexResult_Next(result)) != NULL) {
+        if (type == CLUSTER_QUERYINDEX) {
+            writeString(answer, keyName);
+            count++;
+            continue;
+        }
+
+        RedisModuleKey *key;
+        Series *series;
+        if (!SilentGetSeries(ctx, keyName, &key, &series, REDISMODULE_READ)) {
+            RedisModule_Log(ctx,
+                            "warning",
+                            "couldn't open key or key is not a Timeseries. key=%s",
+                            RedisModule_StringPtrLen(keyName, NULL));
+            continue;
+        }
+        writeString(answer, keyName);
+        writeLabels(answer, series, withLabels);
+        if (type == CLUSTER_MGET) {
+            const bool hasSample = SeriesGetNumSamples(series) > 0;
+            ChunkBlob_WriteUnsigned(answer, hasSample);
+            ChunkBlob_WriteUnsigned(answer, hasSample ? series->lastTimestamp : 0);
+            writeDouble(answer, hasSample ? series->lastValue : 0);
+        } else {
+            RangeArgs args = mrangeArgs.rangeArgs;
+            Chunk_t **chunks = NULL;
+            size_t chunksCount = 0;
+            // the series of a group are reduced before the retention and COUNT are applied
+            if (!mrangeArgs.groupByLabel) {
+                args.startTimestamp = SeriesClampToRetention(series, args.startTimestamp);
+            }
+            if (args.startTimestamp <= args.endTimestamp) {
+                chunksCount = SeriesQueryChunks(series,
+                                                &args,
+                                                mrangeArgs.reverse,
+                                                mrangeArgs.groupByLabel ? -1 : args.count,
+                                                CHUNK_COMPRESSED,
+                                                &chunks);
+            }
+            ChunkFuncs *funcs = GetChunkClass(CHUNK_COMPRESSED);
+            ChunkBlob_WriteUnsigned(answer, chunksCount);
+            for (size_t i = 0; i < chunksCount; i++) {
+                funcs->SaveToBlob(chunks[i], answer);
+                funcs->FreeChunk(chunks[i]);
+            }
+            free(chunks);
+        }
+        RedisModule_CloseKey(key);
+        count++;
+    }
+    QueryIndexResult_Free(result);
+    if (answer->len > maxLen) {
+        answer->len = statusOffset;
+        ChunkBlob_WriteUnsigned(answer, ANSWER_TOO_LARGE);
+    } else {
+        memcpy(answer->data + countOffset, &count, sizeof(count));
+    }
+
+    if (type == CLUSTER_QUERYINDEX) {
+        QueryPredicateList_Free(queries);
+    } else if (type == CLUSTER_MGET) {
+        MGetArgs_Free(&mgetArgs);
+    } else {
+        MRangeArgs_Free(&mrangeArgs);
+    }
+}
+
+static void onQuery(RedisModuleCtx *ctx,
+                    const char *sender_id,
+                    uint8_t type,
+                    const unsigned char *payload,
+                    uint32_t len) {
+    ChunkBlob query = { 0 };
+    query.data = (char *)payload;
+    query.len = len;
+    const u_int64_t requestId = ChunkBlob_ReadUnsigned(&query);
+    const ClusterQueryType queryType = ChunkBlob_ReadUnsigned(&query);
+    const int argc = ChunkBlob_ReadUnsigned(&query);
+    if (query.error) {
+        RedisModule_Log(ctx, "warning", "TSDB: received a truncated cluster query");
+        return;
+    }
+    RedisModuleString **argv = calloc(argc, sizeof(RedisModuleString *));
+    for (int i = 0; i < argc; i++) {
+        argv[i] = readString(&query);
+    }
+
+    ChunkBlob answer = { 0 };
+    ChunkBlob_WriteUnsigned(&answer, requestId);
+    if (query.error) {
+        RedisModule_Log(ctx, "warning", "TSDB: received a truncated cluster query");
+        ChunkBlob_WriteUnsigned(&answer, ANSWER_ERROR);
+    } else {
+        evaluateQuery(ctx, queryType, argv, argc, ANSWER_MAX_LEN, &answer);
+    }
+
+    char target[REDISMODULE_NODE_ID_LEN];
+    memcpy(target, sender_id, REDISMODULE_NODE_ID_LEN);
+    if (RedisModule_SendClusterMessage(
+            ctx, target, CLUSTER_MSG_ANSWER, (unsigned char *)answer.data, answer.len) !=
+        REDISMODULE_OK) {
+        RedisModule_Log(ctx,
+                        "warning",
+                        "TSDB: couldn't answer the cluster query of node %.*s",
+                        REDISMODULE_NODE_ID_LEN,
+                        sender_id);
+    }
+    free(answer.data);
+    for (int i = 0; i < argc; i++) {
+        if (argv[i]) {
+            RedisModule_FreeString(NULL, argv[i]);
+        }
+    }
+    free(argv);
+}
+
+static void onAnswer(RedisModuleCtx *ctx,
+                     const char *sender_id,
+                     uint8_t type,
+                     const unsigned char *payload,
+                     uint32_t len) {
+    long long id;
+    if (len < sizeof(id)) {
+        return;
+    }
+    memcpy(&id, payload, sizeof(id));
+    // the request is gone when it timed out
+    FanOutRequest *request = RedisModule_DictGetC(requests, &id, sizeof(id), NULL);
+    if (request == NULL) {
+        return;
+    }
+    for (size_t i = 1; i < request->shardsCount; i++) {
+        ShardAnswer *shard = &request->shards[i];
+        if (shard->blob.data != NULL || memcmp(shard->id, sender_id, REDISMODULE_NODE_ID_LEN)) {
+            continue;
+        }
+        shard->blob.len = len - sizeof(id);
+        shard->blob.data = malloc(max(shard->blob.len, 1));
+        memcpy(shard->blob.data, payload + sizeof(id), shard->blob.len);
+        if (--request->pending == 0) {
+            RedisModule_DictDelC(requests, &id, sizeof(id), NULL);
+            RedisModule_UnblockClient(request->bc, request);
+        }
+        return;
+    }
+}
+
+// Counts a reply that misses the answers of some shards, reported in the timeseries_cluster INFO
+// section since the reply itself has the shape of a complete one
+static void countPartialReply(const FanOutRequest *request) {
+    size_t missing = request->unreachable;
+    for (size_t i = 0; i < request->shardsCount; i++) {
+        missing += request->shards[i].blob.data == NULL;
+    }
+    if (missing > 0) {
+        partialReplies++;
+        missingShardAnswers += missing;
+    }
+}
+
+static void clusterInfo(RedisModuleInfoCtx *ctx, int for_crash_report) {
+    RedisModule_InfoAddSection(ctx, "cluster");
+    RedisModule_InfoAddFieldULongLong(ctx, "partial_replies", partialReplies);
+    RedisModule_InfoAddFieldULongLong(ctx, "missing_shard_answers", missingShardAnswers);
+}
+
+static void replyQueryIndex(RedisModuleCtx *ctx, FanOutRequest *request) {
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    long long replylen = 0;
+    for (size_t i = 0; i < request->shardsCount; i++) {
+        ChunkBlob *blob = &request->shards[i].blob;
+        if (blob->data == NULL) {
+            continue;
+        }
+        const u_int64_t count = ChunkBlob_ReadUnsigned(blob);
+        for (u_int64_t j = 0; j < count; j++) {
+            size_t len;
+            char *keyName = ChunkBlob_ReadStringBuffer(blob, &len);
+            if (keyName == NULL) {
+                break;
+            }
+            RedisModule_ReplyWithStringBuffer(ctx, keyName, len);
+            free(keyName);
+            replylen++;
+        }
+    }
+    RedisModule_ReplySetArrayLength(ctx, replylen);
+}
+
+static void replyMGet(RedisModuleCtx *ctx, FanOutRequest *request) {
+    const MGetArgs *args = &request->mgetArgs;
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    long long replylen = 0;
+    for (size_t i = 0; i < request->shardsCount; i++) {
+        ChunkBlob *blob = &request->shards[i].blob;
+        if (blob->data == NULL) {
+            continue;
+        }
+        const u_int64_t count = ChunkBlob_ReadUnsigned(blob);
+        for (u_int64_t j = 0; j < count; j++) {
+            Series *series = readSeries(blob);
+            if (series == NULL) {
+                break;
+            }
+            series->totalSamples = ChunkBlob_ReadUnsigned(blob);
+            series->lastTimestamp = ChunkBlob_ReadUnsigned(blob);
+            series->lastValue = readDouble(blob);
+
+            RedisModule_ReplyWithArray(ctx, 3);
+            RedisModule_ReplyWithString(ctx, series->keyName);
+            if (args->withLabels) {
+                ReplyWithSeriesLabels(ctx, series);
+            } else if (args->numLimitLabels > 0) {
+                ReplyWithSeriesLabelsWithLimit(
+                    ctx, series, (RedisModuleString **)args->limitLabels, args->numLimitLabels);
+            } else {
+                RedisModule_ReplyWithArray(ctx, 0);
+            }
+            ReplyWithSeriesLastDatapoint(ctx, series);
+            replylen++;
+            FreeSeries(series);
+        }
+    }
+    RedisModule_ReplySetArrayLength(ctx, replylen);
+}
+
+static void replyMRange(RedisModuleCtx *ctx, FanOutRequest *request) {
+    MRangeArgs *args = &request->mrangeArgs;
+    // The shards already applied the filters and the aggregation
+    RangeArgs minimizedArgs = args->rangeArgs;
+    minimizedArgs.startTimestamp = 0;
+    minimizedArgs.endTimestamp = UINT64_MAX;
+    minimizedArgs.aggregationArgs.aggregationClass = NULL;
+    minimizedArgs.aggregationArgs.timeDelta = 0;
+    minimizedArgs.filterByTSArgs.hasValue = false;
+    minimizedArgs.filterByValueArgs.hasValue = false;
+
+    TS_ResultSet *resultset = NULL;
+    Series **grouped = NULL;
+    size_t groupedCount = 0;
+    if (args->groupByLabel) {
+        resultset = ResultSet_Create();
+        ResultSet_GroupbyLabel(resultset, args->groupByLabel);
+    } else {
+        RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    }
+
+    long long replylen = 0;
+    ChunkFuncs *funcs = GetChunkClass(CHUNK_COMPRESSED);
+    for (size_t i = 0; i < request->shardsCount; i++) {
+        ChunkBlob *blob = &request->shards[i].blob;
+        if (blob->data == NULL) {
+            continue;
+        }
+        const u_int64_t count = ChunkBlob_ReadUnsigned(blob);
+        for (u_int64_t j = 0; j < count && !blob->error; j++) {
+            Series *series = readSeries(blob);
+            if (series == NULL) {
+                break;
+            }
+            const u_int64_t chunksCount = ChunkBlob_ReadUnsigned(blob);
+            for (u_int64_t c = 0; c < chunksCount && !blob->error; c++) {
+                Chunk_t *chunk = NULL;
+                funcs->LoadFromBlob(&chunk, blob);
+                if (blob->error) {
+                    break;
+                }
+                dictOperator(series->chunks, chunk, funcs->GetFirstTimestamp(chunk), DICT_OP_SET);
+            }
+
+            if (args->groupByLabel) {
+                ResultSet_AddSerie(
+                    resultset, series, RedisModule_StringPtrLen(series->keyName, NULL));
+                grouped = realloc(grouped, (groupedCount + 1) * sizeof(Series *));
+                grouped[groupedCount++] = series;
+                continue;
+            }
+            RangeArgs seriesArgs = minimizedArgs;
+            ReplySeriesArrayPos(ctx,
+                                series,
+                                args->withLabels,
+                                args->limitLabels,
+                                args->numLimitLabels,
+                                &seriesArgs,
+                                args->reverse);
+            replylen++;
+            FreeSeries(series);
+        }
+    }
+
+    if (args->groupByLabel) {
+        // Apply the reducer, max results apply to the final result
+        RangeArgs reducerArgs = minimizedArgs;
+        ResultSet_ApplyReducer(resultset, &reducerArgs, args->gropuByReducerOp);
+        replyResultSet(ctx,
+                       resultset,
+                       args->withLabels,
+                       args->limitLabels,
+                       args->numLimitLabels,
+                       &minimizedArgs,
+                       args->reverse);
+        ResultSet_Free(resultset);
+        for (size_t i = 0; i < groupedCount; i++) {
+            FreeSeries(grouped[i]);
+        }
+        free(grouped);
+    } else {
+        RedisModule_ReplySetArrayLength(ctx, replylen);
+    }
+}
+
+static int replyRequest(RedisModuleCtx *ctx, FanOutRequest *request) {
+    for (size_t i = 0; i < request->shardsCount; i++) {
+        ChunkBlob *blob = &request->shards[i].blob;
+        if (blob->data == NULL) {
+            continue;
+        }
+        const u_int64_t status = ChunkBlob_ReadUnsigned(blob);
+        if (status == ANSWER_TOO_LARGE) {
+            return RTS_ReplyGeneralError(
+                ctx, "TSDB: the answer of a shard exceeds 16MB, narrow the query or set a COUNT");
+        } else if (status != ANSWER_OK) {
+            return RTS_ReplyGeneralError(ctx, "TSDB: a shard failed to evaluate the query");
+        }
+    }
+    countPartialReply(request);
+    if (request->type == CLUSTER_QUERYINDEX) {
+        replyQueryIndex(ctx, request);
+    } else if (request->type == CLUSTER_MGET) {
+        replyMGet(ctx, request);
+    } else {
+        replyMRange(ctx, request);
+    }
+    return REDISMODULE_OK;
+}
+
+static int fanOutReply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    FanOutRequest *request = RedisModule_GetBlockedClientPrivateData(ctx);
+    if (request->unreachable > 0) {
+        RedisModule_Log(ctx,
+                        "warning",
+                        "TSDB: %zu of %zu shards are unreachable, replying with the answers of "
+                        "the other shards",
+                        request->unreachable,
+                        request->shardsCount + request->unreachable);
+    }
+    return replyRequest(ctx, request);
+}
+
+// Removes the request of the blocked client from the waiting requests, NULL when it isn't waiting
+static FanOutRequest *takeRequest(RedisModuleBlockedClient *bc) {
+    FanOutRequest *request = NULL;
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(requests, "^", NULL, 0);
+    FanOutRequest *current;
+    while (RedisModule_DictNextC(iter, NULL, (void **)&current) != NULL) {
+        if (current->bc == bc) {
+            request = current;
+            break;
+        }
+    }
+    RedisModule_DictIteratorStop(iter);
+    if (request != NULL) {
+        RedisModule_DictDelC(requests, &request->id, sizeof(request->id), NULL);
+    }
+    return request;
+}
+
+static int fanOutTimeout(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    FanOutRequest *request = takeRequest(RedisModule_GetBlockedClientHandle(ctx));
+    if (request == NULL) {
+        return RTS_ReplyGeneralError(ctx, "TSDB: the shards didn't answer in time");
+    }
+
+    const size_t missing = request->pending + request->unreachable;
+    const size_t total = request->shardsCount + request->unreachable;
+    int result;
+    if (TSGlobalConfig.partialResults) {
+        RedisModule_Log(ctx,
+                        "warning",
+                        "TSDB: %zu of %zu shards didn't answer a query within SHARD_TIMEOUT, "
+                        "replying with the answers of the other shards",
+                        missing,
+                        total);
+        result = replyRequest(ctx, request);
+    } else {
+        char err[128];
+        snprintf(err,
+                 sizeof(err),
+                 RTS_ERR " TSDB: %zu of %zu shards didn't answer within SHARD_TIMEOUT",
+                 missing,
+                 total);
+        result = RedisModule_ReplyWithError(ctx, err);
+    }
+    FanOutRequest_Free(request);
+    return result;
+}
+
+static void fanOutFree(RedisModuleCtx *ctx, void *privdata) {
+    FanOutRequest_Free(privdata);
+}
+
+// The timeout doesn't fire once the client is gone, so the request stops waiting for the shards here
+static void fanOutDisconnect(RedisModuleCtx *ctx, RedisModuleBlockedClient *bc) {
+    FanOutRequest *request = takeRequest(bc);
+    if (request != NULL) {
+        RedisModule_UnblockClient(bc, request);
+    }
+}
+
+// The primaries of the other shards, the unreachable ones are only counted
+static void collectShards(RedisModuleCtx *ctx, FanOutRequest *request) {
+    const char *myId = RedisModule_GetMyClusterID();
+    // on a replica, the shard of the query is the shard of its primary
+    char myPrimary[REDISMODULE_NODE_ID_LEN];
+    int flags = 0;
+    memcpy(myPrimary, myId, REDISMODULE_NODE_ID_LEN);
+    if (RedisModule_GetClusterNodeInfo(ctx, myId, NULL, myPrimary, NULL, &flags) ==
+            REDISMODULE_OK &&
+        (flags & REDISMODULE_NODE_MASTER)) {
+        memcpy(myPrimary, myId, REDISMODULE_NODE_ID_LEN);
+    }
+
+    size_t nodesCount = 0;
+    char **nodes = RedisModule_GetClusterNodesList(ctx, &nodesCount);
+    request->shards = calloc(nodesCount + 1, sizeof(ShardAnswer));
+    memcpy(request->shards[0].id, myId, REDISMODULE_NODE_ID_LEN);
+    request->shardsCount = 1;
+    for (size_t i = 0; i < nodesCount; i++) {
+        if (!memcmp(nodes[i], myId, REDISMODULE_NODE_ID_LEN) ||
+            !memcmp(nodes[i], myPrimary, REDISMODULE_NODE_ID_LEN) ||
+            RedisModule_GetClusterNodeInfo(ctx, nodes[i], NULL, NULL, NULL, &flags) !=
+                REDISMODULE_OK ||
+            !(flags & REDISMODULE_NODE_MASTER)) {
+            continue;
+        }
+        if (flags & (REDISMODULE_NODE_PFAIL | REDISMODULE_NODE_FAIL)) {
+            request->unreachable++;
+            continue;
+        }
+        memcpy(request->shards[request->shardsCount++].id, nodes[i], REDISMODULE_NODE_ID_LEN);
+    }
+    if (nodes) {
+        RedisModule_FreeClusterNodesList(nodes);
+    }
+}
+
+int Cluster_Init(RedisModuleCtx *ctx) {
+    requests = RedisModule_CreateDict(NULL);
+    RedisModule_RegisterClusterMessageReceiver(ctx, CLUSTER_MSG_QUERY, onQuery);
+    RedisModule_RegisterClusterMessageReceiver(ctx, CLUSTER_MSG_ANSWER, onAnswer);
+    // the INFO sections of modules came with Redis 6.0, the API isn't set on older servers
+    if (RedisModule_RegisterInfoFunc != NULL) {
+        RedisModule_RegisterInfoFunc(ctx, clusterInfo);
+    }
+    return REDISMODULE_OK;
+}
+
+bool Cluster_CanFanOut(RedisModuleCtx *ctx) {
+    const int flags = RedisModule_GetContextFlags(ctx);
+    // a client can't be blocked inside MULTI or a script, those queries stay on the local shard
+    return (flags & REDISMODULE_CTX_FLAGS_CLUSTER) &&
+           !(flags & (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA)) &&
+           RedisModule_GetClusterSize() > 1;
+}
+
+int Cluster_FanOut(RedisModuleCtx *ctx, ClusterQueryType type, RedisModuleString **argv, int argc) {
+    FanOutRequest *request = calloc(1, sizeof(FanOutRequest));
+    request->type = type;
+    request->argc = argc;
+    request->argv = calloc(argc, sizeof(RedisModuleString *));
+    for (int i = 0; i < argc; i++) {
+        request->argv[i] = RedisModule_CreateStringFromString(NULL, argv[i]);
+    }
+    // the coordinator parses the arguments it replies with, the errors are replied to here
+    int status = REDISMODULE_OK;
+    if (type == CLUSTER_MGET) {
+        status = parseMGetCommand(ctx, request->argv, argc, &request->mgetArgs);
+    } else if (type != CLUSTER_QUERYINDEX) {
+        status = parseMRangeCommand(ctx, request->argv, argc, &request->mrangeArgs);
+        request->mrangeArgs.reverse = type == CLUSTER_MREVRANGE;
+    }
+    if (status != REDISMODULE_OK) {
+        // nothing was parsed
+        request->type = CLUSTER_QUERYINDEX;
+        FanOutRequest_Free(request);
+        return REDISMODULE_OK;
+    }
+
+    collectShards(ctx, request);
+    request->id = nextRequestId++;
+    ChunkBlob query = { 0 };
+    ChunkBlob_WriteUnsigned(&query, request->id);
+    ChunkBlob_WriteUnsigned(&query, type);
+    ChunkBlob_WriteUnsigned(&query, argc);
+    for (int i = 0; i < argc; i++) {
+        writeString(&query, argv[i]);
+    }
+    for (size_t i = 1; i < request->shardsCount; i++) {
+        if (RedisModule_SendClusterMessage(ctx,
+                                           request->shards[i].id,
+                                           CLUSTER_MSG_QUERY,
+                                           (unsigned char *)query.data,
+                                           query.len) == REDISMODULE_OK) {
+            request->pending++;
+        } else {
+            request->unreachable++;
+        }
+    }
+    free(query.data);
+    if (request->unreachable > 0 && !TSGlobalConfig.partialResults) {
+        char err[128];
+        snprintf(err,
+                 sizeof(err),
+                 RTS_ERR " TSDB: %zu of %zu shards are unreachable",
+                 request->unreachable,
+                 request->shardsCount + request->unreachable);
+        FanOutRequest_Free(request);
+        return RedisModule_ReplyWithError(ctx, err);
+    }
+
+    // the other shards evaluate the query meanwhile
+    evaluateQuery(ctx, type, argv, argc, SIZE_MAX, &request->shards[0].blob);
+
+    request->bc = RedisModule_BlockClient(
+        ctx, fanOutReply, fanOutTimeout, fanOutFree, TSGlobalConfig.shardTimeout);
+    RedisModule_SetDisconnectCallback(request->bc, fanOutDisconnect);
+    if (request->pending == 0) {
+        RedisModule_UnblockClient(request->bc, request);
+    } else {
+        RedisModule_DictSetC(requests, &request->id, sizeof(request->id), request);
+    }
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "redismodule.h"
+
+#include <stdbool.h>
+
+/*
+ * Cross-shard TS.MGET, TS.MRANGE, TS.MREVRANGE and TS.QUERYINDEX when RedisGears isn't loaded.
+ *
+ * The shard a query is called on sends the command over the cluster bus to the primary of every
+ * other shard, which evaluates it on its own series and sends back the matching series, with the
+ * samples of a range query already filtered and aggregated, in compressed chunks. The answers of
+ * the shards are merged into the reply once every shard answered, or when SHARD_TIMEOUT expires.
+ */
+
+typedef enum
+{
+    CLUSTER_QUERYINDEX = 0,
+    CLUSTER_MGET,
+    CLUSTER_MRANGE,
+    CLUSTER_MREVRANGE,
+} ClusterQueryType;
+
+int Cluster_Init(RedisModuleCtx *ctx);
+
+// Whether the queries of the command span the shards of a cluster
+bool Cluster_CanFanOut(RedisModuleCtx *ctx);
+
+// Parses the command, fans it out to the shards and blocks the client until they answer
+int Cluster_FanOut(RedisModuleCtx *ctx, ClusterQueryType type, RedisModuleString **argv, int argc);
+
+#endif // CLUSTER_H
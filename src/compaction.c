@@ -5,6 +5,8 @@
  */
 #include "compaction.h"
 
+#include "ddsketch.h"
+
 #include <ctype.h>
 #include <math.h> // sqrt
 #include <string.h>
@@ -36,6 +38,18 @@ typedef struct StdContext
     u_int64_t cnt;
 } StdContext;
 
+// Samples may be appended in either time order (reversed ranges), every pair of consecutive
+// samples is accumulated ordered by time
+typedef struct TimeWeightedContext
+{
+    double prevValue;
+    u_int64_t prevTimestamp;
+    u_int64_t firstTimestamp;
+    double area;     // integral of the linearly interpolated values
+    double increase; // sum of the counter increases, a decrease is a counter reset
+    u_int64_t cnt;
+} TimeWeightedContext;
+
 void *SingleValueCreateContext() {
     SingleValueContext *context = (SingleValueContext *)malloc(sizeof(SingleValueContext));
     context->value = 0;
@@ -75,7 +89,7 @@ void *AvgCreateContext() {
     return context;
 }
 
-void AvgAddValue(void *contextPtr, double value) {
+void AvgAddValue(void *contextPtr, double value, u_int64_t timestamp) {
     AvgContext *context = (AvgContext *)contextPtr;
     context->val += value;
     context->cnt++;
@@ -115,14 +129,14 @@ void *StdCreateContext() {
     return context;
 }
 
-void StdAddValue(void *contextPtr, double value) {
+void StdAddValue(void *contextPtr, double value, u_int64_t timestamp) {
     StdContext *context = (StdContext *)contextPtr;
     ++context->cnt;
     context->sum += value;
     context->sum_2 += value * value;
 }
 
-static inline double variance(double sum, double sum_2, double count) {
+double CalcVariance(double sum, double sum_2, double count) {
     if (count == 0) {
         return 0;
     }
@@ -138,7 +152,7 @@ int VarPopulationFinalize(void *contextPtr, double *value) {
     if (count == 0) {
         return TSDB_ERROR;
     }
-    *value = variance(context->sum, context->sum_2, count);
+    *value = CalcVariance(context->sum, context->sum_2, count);
     return TSDB_OK;
 }
 
@@ -150,7 +164,7 @@ int VarSamplesFinalize(void *contextPtr, double *value) {
     } else if (count == 1) {
         *value = 0;
     } else {
-        *value = variance(context->sum, context->sum_2, count) * count / (count - 1);
+        *value = CalcVariance(context->sum, context->sum_2, count) * count / (count - 1);
     }
     return TSDB_OK;
 }
@@ -196,10 +210,153 @@ void StdReadContext(void *contextPtr, RedisModuleIO *io) {
     context->cnt = RedisModule_LoadUnsigned(io);
 }
 
+void *TimeWeightedCreateContext() {
+    TimeWeightedContext *context = (TimeWeightedContext *)calloc(1, sizeof(TimeWeightedContext));
+    return context;
+}
+
+void TimeWeightedAppendValue(void *contextPtr, double value, u_int64_t timestamp) {
+    TimeWeightedContext *context = (TimeWeightedContext *)contextPtr;
+    if (context->cnt == 0) {
+        context->firstTimestamp = timestamp;
+    } else {
+        bool forward = timestamp > context->prevTimestamp;
+        double earlier = forward ? context->prevValue : value;
+        double later = forward ? value : context->prevValue;
+        u_int64_t duration =
+            forward ? timestamp - context->prevTimestamp : context->prevTimestamp - timestamp;
+        context->area += (earlier + later) / 2 * duration;
+        context->increase += (later >= earlier) ? later - earlier : later;
+    }
+    context->prevValue = value;
+    context->prevTimestamp = timestamp;
+    context->cnt++;
+}
+
+static inline u_int64_t timeWeightedSpan(const TimeWeightedContext *context) {
+    return context->prevTimestamp > context->firstTimestamp
+               ? context->prevTimestamp - context->firstTimestamp
+               : context->firstTimestamp - context->prevTimestamp;
+}
+
+int TwaFinalize(void *contextPtr, double *value) {
+    TimeWeightedContext *context = (TimeWeightedContext *)contextPtr;
+    if (context->cnt == 0) {
+        return TSDB_ERROR;
+    }
+    u_int64_t span = timeWeightedSpan(context);
+    *value = (span == 0) ? context->prevValue : context->area / span;
+    return TSDB_OK;
+}
+
+int IncreaseFinalize(void *contextPtr, double *value) {
+    TimeWeightedContext *context = (TimeWeightedContext *)contextPtr;
+    if (context->cnt == 0) {
+        return TSDB_ERROR;
+    }
+    *value = context->increase;
+    return TSDB_OK;
+}
+
+// per second increase, timestamps are in milliseconds
+int RateFinalize(void *contextPtr, double *value) {
+    TimeWeightedContext *context = (TimeWeightedContext *)contextPtr;
+    if (context->cnt < 2) {
+        return TSDB_ERROR;
+    }
+    *value = context->increase * 1000 / timeWeightedSpan(context);
+    return TSDB_OK;
+}
+
+void TimeWeightedReset(void *contextPtr) {
+    TimeWeightedContext *context = (TimeWeightedContext *)contextPtr;
+    memset(context, 0, sizeof(TimeWeightedContext));
+}
+
+void TimeWeightedWriteContext(void *contextPtr, RedisModuleIO *io) {
+    TimeWeightedContext *context = (TimeWeightedContext *)contextPtr;
+    RedisModule_SaveDouble(io, context->prevValue);
+    RedisModule_SaveUnsigned(io, context->prevTimestamp);
+    RedisModule_SaveUnsigned(io, context->firstTimestamp);
+    RedisModule_SaveDouble(io, context->area);
+    RedisModule_SaveDouble(io, context->increase);
+    RedisModule_SaveUnsigned(io, context->cnt);
+}
+
+void TimeWeightedReadContext(void *contextPtr, RedisModuleIO *io) {
+    TimeWeightedContext *context = (TimeWeightedContext *)contextPtr;
+    context->prevValue = RedisModule_LoadDouble(io);
+    context->prevTimestamp = RedisModule_LoadUnsigned(io);
+    context->firstTimestamp = RedisModule_LoadUnsigned(io);
+    context->area = RedisModule_LoadDouble(io);
+    context->increase = RedisModule_LoadDouble(io);
+    context->cnt = RedisModule_LoadUnsigned(io);
+}
+
 void rm_free(void *ptr) {
     free(ptr);
 }
 
+void *QuantileCreateContext() {
+    return DDSketch_New();
+}
+
+void QuantileFreeContext(void *contextPtr) {
+    DDSketch_Free(contextPtr);
+}
+
+void QuantileAppendValue(void *contextPtr, double value, u_int64_t timestamp) {
+    DDSketch_Add(contextPtr, value);
+}
+
+int P50Finalize(void *contextPtr, double *value) {
+    return DDSketch_Quantile(contextPtr, 0.5, value);
+}
+
+int P90Finalize(void *contextPtr, double *value) {
+    return DDSketch_Quantile(contextPtr, 0.9, value);
+}
+
+int P99Finalize(void *contextPtr, double *value) {
+    return DDSketch_Quantile(contextPtr, 0.99, value);
+}
+
+void QuantileReset(void *contextPtr) {
+    DDSketch_Reset(contextPtr);
+}
+
+void QuantileWriteContext(void *contextPtr, RedisModuleIO *io) {
+    DDSketch_RdbSave(contextPtr, io);
+}
+
+void QuantileReadContext(void *contextPtr, RedisModuleIO *io) {
+    DDSketch_RdbLoad(contextPtr, io);
+}
+
+static AggregationClass aggP50 = { .createContext = QuantileCreateContext,
+                                   .appendValue = QuantileAppendValue,
+                                   .freeContext = QuantileFreeContext,
+                                   .finalize = P50Finalize,
+                                   .writeContext = QuantileWriteContext,
+                                   .readContext = QuantileReadContext,
+                                   .resetContext = QuantileReset };
+
+static AggregationClass aggP90 = { .createContext = QuantileCreateContext,
+                                   .appendValue = QuantileAppendValue,
+                                   .freeContext = QuantileFreeContext,
+                                   .finalize = P90Finalize,
+                                   .writeContext = QuantileWriteContext,
+                                   .readContext = QuantileReadContext,
+                                   .resetContext = QuantileReset };
+
+static AggregationClass aggP99 = { .createContext = QuantileCreateContext,
+                                   .appendValue = QuantileAppendValue,
+                                   .freeContext = QuantileFreeContext,
+                                   .finalize = P99Finalize,
+                                   .writeContext = QuantileWriteContext,
+                                   .readContext = QuantileReadContext,
+                                   .resetContext = QuantileReset };
+
 static AggregationClass aggAvg = { .createContext = AvgCreateContext,
                                    .appendValue = AvgAddValue,
                                    .freeContext = rm_free,
@@ -240,6 +397,30 @@ static AggregationClass aggVarS = { .createContext = StdCreateContext,
                                     .readContext = StdReadContext,
                                     .resetContext = StdReset };
 
+static AggregationClass aggTwa = { .createContext = TimeWeightedCreateContext,
+                                   .appendValue = TimeWeightedAppendValue,
+                                   .freeContext = rm_free,
+                                   .finalize = TwaFinalize,
+                                   .writeContext = TimeWeightedWriteContext,
+                                   .readContext = TimeWeightedReadContext,
+                                   .resetContext = TimeWeightedReset };
+
+static AggregationClass aggRate = { .createContext = TimeWeightedCreateContext,
+                                    .appendValue = TimeWeightedAppendValue,
+                                    .freeContext = rm_free,
+                                    .finalize = RateFinalize,
+                                    .writeContext = TimeWeightedWriteContext,
+                                    .readContext = TimeWeightedReadContext,
+                                    .resetContext = TimeWeightedReset };
+
+static AggregationClass aggIncrease = { .createContext = TimeWeightedCreateContext,
+                                        .appendValue = TimeWeightedAppendValue,
+                                        .freeContext = rm_free,
+                                        .finalize = IncreaseFinalize,
+                                        .writeContext = TimeWeightedWriteContext,
+                                        .readContext = TimeWeightedReadContext,
+                                        .resetContext = TimeWeightedReset };
+
 void *MaxMinCreateContext() {
     MaxMinContext *context = (MaxMinContext *)malloc(sizeof(MaxMinContext));
     context->minValue = 0;
@@ -248,7 +429,7 @@ void *MaxMinCreateContext() {
     return context;
 }
 
-void MaxMinAppendValue(void *contextPtr, double value) {
+void MaxMinAppendValue(void *contextPtr, double value, u_int64_t timestamp) {
     MaxMinContext *context = (MaxMinContext *)contextPtr;
     if (context->isResetted) {
         context->isResetted = FALSE;
@@ -315,13 +496,13 @@ void MaxMinReadContext(void *contextPtr, RedisModuleIO *io) {
     free(sb);
 }
 
-void SumAppendValue(void *contextPtr, double value) {
+void SumAppendValue(void *contextPtr, double value, u_int64_t timestamp) {
     SingleValueContext *context = (SingleValueContext *)contextPtr;
     context->value += value;
     context->isResetted = FALSE;
 }
 
-void CountAppendValue(void *contextPtr, double value) {
+void CountAppendValue(void *contextPtr, double value, u_int64_t timestamp) {
     SingleValueContext *context = (SingleValueContext *)contextPtr;
     context->value++;
     context->isResetted = FALSE;
@@ -333,7 +514,7 @@ int CountFinalize(void *contextPtr, double *val) {
     return TSDB_OK;
 }
 
-void FirstAppendValue(void *contextPtr, double value) {
+void FirstAppendValue(void *contextPtr, double value, u_int64_t timestamp) {
     SingleValueContext *context = (SingleValueContext *)contextPtr;
     if (context->isResetted) {
         context->isResetted = FALSE;
@@ -341,7 +522,7 @@ void FirstAppendValue(void *contextPtr, double value) {
     }
 }
 
-void LastAppendValue(void *contextPtr, double value) {
+void LastAppendValue(void *contextPtr, double value, u_int64_t timestamp) {
     SingleValueContext *context = (SingleValueContext *)contextPtr;
     context->value = value;
     context->isResetted = FALSE;
@@ -428,10 +609,20 @@ int StringLenAggTypeToEnum(const char *agg_type, size_t len) {
             result = TS_AGG_SUM;
         } else if (strncmp(agg_type_lower, "avg", len) == 0) {
             result = TS_AGG_AVG;
+        } else if (strncmp(agg_type_lower, "twa", len) == 0) {
+            result = TS_AGG_TWA;
+        } else if (strncmp(agg_type_lower, "p50", len) == 0) {
+            result = TS_AGG_P50;
+        } else if (strncmp(agg_type_lower, "p90", len) == 0) {
+            result = TS_AGG_P90;
+        } else if (strncmp(agg_type_lower, "p99", len) == 0) {
+            result = TS_AGG_P99;
         }
     } else if (len == 4) {
         if (strncmp(agg_type_lower, "last", len) == 0) {
             result = TS_AGG_LAST;
+        } else if (strncmp(agg_type_lower, "rate", len) == 0) {
+            result = TS_AGG_RATE;
         }
     } else if (len == 5) {
         if (strncmp(agg_type_lower, "count", len) == 0) {
@@ -449,6 +640,10 @@ int StringLenAggTypeToEnum(const char *agg_type, size_t len) {
         } else if (strncmp(agg_type_lower, "var.s", len) == 0) {
             result = TS_AGG_VAR_S;
         }
+    } else if (len == 8) {
+        if (strncmp(agg_type_lower, "increase", len) == 0) {
+            result = TS_AGG_INCREASE;
+        }
     }
     return result;
 }
@@ -479,6 +674,18 @@ const char *AggTypeEnumToString(TS_AGG_TYPES_T aggType) {
             return "LAST";
         case TS_AGG_RANGE:
             return "RANGE";
+        case TS_AGG_TWA:
+            return "TWA";
+        case TS_AGG_RATE:
+            return "RATE";
+        case TS_AGG_INCREASE:
+            return "INCREASE";
+        case TS_AGG_P50:
+            return "P50";
+        case TS_AGG_P90:
+            return "P90";
+        case TS_AGG_P99:
+            return "P99";
         case TS_AGG_NONE:
         case TS_AGG_INVALID:
         case TS_AGG_TYPES_MAX:
@@ -513,6 +720,18 @@ AggregationClass *GetAggClass(TS_AGG_TYPES_T aggType) {
             return &aggLast;
         case TS_AGG_RANGE:
             return &aggRange;
+        case TS_AGG_TWA:
+            return &aggTwa;
+        case TS_AGG_RATE:
+            return &aggRate;
+        case TS_AGG_INCREASE:
+            return &aggIncrease;
+        case TS_AGG_P50:
+            return &aggP50;
+        case TS_AGG_P90:
+            return &aggP90;
+        case TS_AGG_P99:
+            return &aggP99;
         case TS_AGG_NONE:
         case TS_AGG_INVALID:
         case TS_AGG_TYPES_MAX:
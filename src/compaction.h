@@ -15,7 +15,7 @@ typedef struct AggregationClass
 {
     void *(*createContext)();
     void (*freeContext)(void *context);
-    void (*appendValue)(void *context, double value);
+    void (*appendValue)(void *context, double value, u_int64_t timestamp);
     void (*resetContext)(void *context);
     void (*writeContext)(void *context, RedisModuleIO *io);
     void (*readContext)(void *context, RedisModuleIO *io);
@@ -28,4 +28,7 @@ int RMStringLenAggTypeToEnum(RedisModuleString *aggTypeStr);
 int StringLenAggTypeToEnum(const char *agg_type, size_t len);
 const char *AggTypeEnumToString(TS_AGG_TYPES_T aggType);
 
+// population variance of `count` values, given their sum and the sum of their squares
+double CalcVariance(double sum, double sum_2, double count);
+
 #endif
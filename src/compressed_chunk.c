@@ -334,6 +334,46 @@ void Compressed_LoadFromRDB(Chunk_t **chunk, struct RedisModuleIO *io) {
                            (ReadStringBufferFunc)RedisModule_LoadStringBuffer);
 }
 
+void Compressed_SaveToBlob(Chunk_t *chunk, ChunkBlob *blob) {
+    Compressed_Serialize(chunk,
+                         blob,
+                         (SaveUnsignedFunc)ChunkBlob_WriteUnsigned,
+                         (SaveStringBufferFunc)ChunkBlob_WriteStringBuffer);
+}
+
+void Compressed_LoadFromBlob(Chunk_t **chunk, ChunkBlob *blob) {
+    const size_t offset = blob->offset;
+    Compressed_SkipInBlob(blob);
+    if (blob->error) {
+        *chunk = NULL;
+        return;
+    }
+    blob->offset = offset;
+    Compressed_Deserialize(chunk,
+                           blob,
+                           (ReadUnsignedFunc)ChunkBlob_ReadUnsigned,
+                           (ReadStringBufferFunc)ChunkBlob_ReadStringBuffer);
+}
+
+// The written bits have to fit in the data of the chunk, every sample but the first one takes at
+// least 2 of them, and the block of the previous value has to fit in a double
+void Compressed_SkipInBlob(ChunkBlob *blob) {
+    const u_int64_t size = ChunkBlob_ReadUnsigned(blob);
+    const u_int64_t count = ChunkBlob_ReadUnsigned(blob);
+    const u_int64_t idx = ChunkBlob_ReadUnsigned(blob);
+    // baseValue, baseTimestamp, prevTimestamp, prevTimestampDelta and prevValue
+    for (int i = 0; i < 5; i++) {
+        ChunkBlob_ReadUnsigned(blob);
+    }
+    const u_int64_t prevLeading = ChunkBlob_ReadUnsigned(blob);
+    const u_int64_t prevTrailing = ChunkBlob_ReadUnsigned(blob);
+    const size_t len = ChunkBlob_SkipStringBuffer(blob);
+    if (len != size || idx > size * BIT || count > idx / 2 + 1 || prevLeading > 64 ||
+        prevTrailing > 64 - prevLeading) {
+        blob->error = true;
+    }
+}
+
 void Compressed_GearsSerialize(Chunk_t *chunk, Gears_BufferWriter *bw) {
     Compressed_Serialize(chunk,
                          bw,
@@ -40,6 +40,9 @@ timestamp_t Compressed_GetLastTimestamp(Chunk_t *chunk);
 // RDB
 void Compressed_SaveToRDB(Chunk_t *chunk, struct RedisModuleIO *io);
 void Compressed_LoadFromRDB(Chunk_t **chunk, struct RedisModuleIO *io);
+void Compressed_SaveToBlob(Chunk_t *chunk, ChunkBlob *blob);
+void Compressed_LoadFromBlob(Chunk_t **chunk, ChunkBlob *blob);
+void Compressed_SkipInBlob(ChunkBlob *blob);
 
 // Gears
 void Compressed_GearsSerialize(Chunk_t *chunk, Gears_BufferWriter *bw);
@@ -11,6 +11,7 @@
 
 #include <assert.h>
 #include <string.h>
+#include <strings.h>
 #include "rmutil/strings.h"
 #include "rmutil/util.h"
 
@@ -108,6 +109,82 @@ int ReadConfig(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
         RedisModule_Log(ctx, "verbose", "loaded default chunk type: %s \n", chunk_type_cstr);
     }
+
+    TSGlobalConfig.queryCacheMaxMemory = QUERY_CACHE_SIZE_DEFAULT;
+    if (argc > 1 && RMUtil_ArgIndex("QUERY_CACHE_SIZE", argv, argc) >= 0) {
+        if (RMUtil_ParseArgsAfter(
+                "QUERY_CACHE_SIZE", argv, argc, "l", &TSGlobalConfig.queryCacheMaxMemory) !=
+                REDISMODULE_OK ||
+            TSGlobalConfig.queryCacheMaxMemory < 0) {
+            return TSDB_ERROR;
+        }
+    }
+    RedisModule_Log(ctx,
+                    "verbose",
+                    "loaded default QUERY_CACHE_SIZE: %lld \n",
+                    TSGlobalConfig.queryCacheMaxMemory);
+
+    TSGlobalConfig.workerThreads = WORKER_THREADS_DEFAULT;
+    if (argc > 1 && RMUtil_ArgIndex("WORKER_THREADS", argv, argc) >= 0) {
+        if (RMUtil_ParseArgsAfter(
+                "WORKER_THREADS", argv, argc, "l", &TSGlobalConfig.workerThreads) !=
+                REDISMODULE_OK ||
+            TSGlobalConfig.workerThreads < 0) {
+            return TSDB_ERROR;
+        }
+    }
+    RedisModule_Log(ctx,
+                    "verbose",
+                    "loaded default WORKER_THREADS: %lld \n",
+                    TSGlobalConfig.workerThreads);
+
+    TSGlobalConfig.replicateChunks = false;
+    if (argc > 1 && RMUtil_ArgIndex("REPLICATION_MODE", argv, argc) >= 0) {
+        const char *mode;
+        if (RMUtil_ParseArgsAfter("REPLICATION_MODE", argv, argc, "c", &mode) != REDISMODULE_OK) {
+            return TSDB_ERROR;
+        }
+        if (strcasecmp(mode, "CHUNKS") == 0) {
+            TSGlobalConfig.replicateChunks = true;
+        } else if (strcasecmp(mode, "COMMANDS") != 0) {
+            return TSDB_ERROR;
+        }
+    }
+    RedisModule_Log(ctx,
+                    "verbose",
+                    "loaded default REPLICATION_MODE: %s \n",
+                    TSGlobalConfig.replicateChunks ? "CHUNKS" : "COMMANDS");
+
+    TSGlobalConfig.shardTimeout = SHARD_TIMEOUT_DEFAULT;
+    if (argc > 1 && RMUtil_ArgIndex("SHARD_TIMEOUT", argv, argc) >= 0) {
+        if (RMUtil_ParseArgsAfter("SHARD_TIMEOUT", argv, argc, "l", &TSGlobalConfig.shardTimeout) !=
+                REDISMODULE_OK ||
+            TSGlobalConfig.shardTimeout <= 0) {
+            return TSDB_ERROR;
+        }
+    }
+    RedisModule_Log(ctx,
+                    "verbose",
+                    "loaded default SHARD_TIMEOUT: %lld \n",
+                    TSGlobalConfig.shardTimeout);
+
+    TSGlobalConfig.partialResults = false;
+    if (argc > 1 && RMUtil_ArgIndex("SHARD_TIMEOUT_POLICY", argv, argc) >= 0) {
+        const char *policy;
+        if (RMUtil_ParseArgsAfter("SHARD_TIMEOUT_POLICY", argv, argc, "c", &policy) !=
+            REDISMODULE_OK) {
+            return TSDB_ERROR;
+        }
+        if (strcasecmp(policy, "PARTIAL") == 0) {
+            TSGlobalConfig.partialResults = true;
+        } else if (strcasecmp(policy, "FAIL") != 0) {
+            return TSDB_ERROR;
+        }
+    }
+    RedisModule_Log(ctx,
+                    "verbose",
+                    "loaded default SHARD_TIMEOUT_POLICY: %s \n",
+                    TSGlobalConfig.partialResults ? "PARTIAL" : "FAIL");
     return TSDB_OK;
 }
 
@@ -20,6 +20,11 @@ typedef struct
     short options;
     int hasGlobalConfig;
     DuplicatePolicy duplicatePolicy;
+    long long queryCacheMaxMemory;
+    long long workerThreads;
+    bool replicateChunks; // replicate the effects of TS.ADD and TS.MADD instead of the commands
+    long long shardTimeout; // milliseconds a cluster query waits for the other shards
+    bool partialResults;    // reply with the shards that answered in time instead of an error
 } TSConfig;
 
 extern TSConfig TSGlobalConfig;
@@ -37,6 +37,11 @@
 #define SPLIT_FACTOR                    1.2
 #define DEFAULT_DUPLICATE_POLICY        DP_BLOCK
 
+/* Module Defaults */
+#define QUERY_CACHE_SIZE_DEFAULT        0LL      // disabled
+#define WORKER_THREADS_DEFAULT          0LL      // disabled
+#define SHARD_TIMEOUT_DEFAULT           5000LL   // milliseconds
+
 /* TS.Range Aggregation types */
 typedef enum {
     TS_AGG_INVALID = -1,
@@ -53,7 +58,13 @@ typedef enum {
     TS_AGG_STD_S,
     TS_AGG_VAR_P,
     TS_AGG_VAR_S,
-    TS_AGG_TYPES_MAX // 13
+    TS_AGG_TWA,
+    TS_AGG_RATE,
+    TS_AGG_INCREASE,
+    TS_AGG_P50,
+    TS_AGG_P90,
+    TS_AGG_P99,
+    TS_AGG_TYPES_MAX // 19
 } TS_AGG_TYPES_T;
 
 
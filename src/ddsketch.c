@@ -0,0 +1,207 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "ddsketch.h"
+
+#include "consts.h"
+
+#include <math.h>
+#include <string.h>
+#include "rmutil/alloc.h"
+
+// smaller magnitudes are counted as zeros
+#define DDSKETCH_MIN_INDEXABLE 1e-9
+
+static inline double sketchGamma() {
+    return (1 + DDSKETCH_RELATIVE_ACCURACY) / (1 - DDSKETCH_RELATIVE_ACCURACY);
+}
+
+static inline int32_t sketchKey(double value) {
+    return (int32_t)ceil(log(value) / log(sketchGamma()));
+}
+
+// the estimate of a key is within the relative accuracy of every value counted under it
+static inline double sketchValue(int32_t key) {
+    const double gamma = sketchGamma();
+    return 2 * pow(gamma, key) / (gamma + 1);
+}
+
+static void storeFree(DDSketchStore *store) {
+    free(store->bins);
+    memset(store, 0, sizeof(DDSketchStore));
+}
+
+// Map the store to the keys [newMin, newMax], the bins below newMin are collapsed into newMin
+static void storeRemap(DDSketchStore *store, int32_t newMin, int32_t newMax) {
+    const u_int32_t newLength = newMax - newMin + 1;
+    const int32_t oldMin = store->offset;
+    const int32_t oldMax = oldMin + (int32_t)store->length - 1;
+
+    u_int64_t collapsed = 0;
+    const int32_t keepFrom = newMin > oldMin ? newMin : oldMin;
+    for (int32_t key = oldMin; key < newMin && key <= oldMax; key++) {
+        collapsed += store->bins[key - oldMin];
+    }
+
+    if (newLength > store->capacity) {
+        store->capacity = min(max(newLength, store->capacity * 2), DDSKETCH_MAX_BINS);
+        store->bins = realloc(store->bins, store->capacity * sizeof(u_int64_t));
+    }
+
+    if (keepFrom <= oldMax) {
+        memmove(store->bins + (keepFrom - newMin),
+                store->bins + (keepFrom - oldMin),
+                (oldMax - keepFrom + 1) * sizeof(u_int64_t));
+        memset(store->bins, 0, (keepFrom - newMin) * sizeof(u_int64_t));
+        memset(store->bins + (oldMax - newMin + 1),
+               0,
+               (newMax - oldMax) * sizeof(u_int64_t));
+    } else {
+        memset(store->bins, 0, newLength * sizeof(u_int64_t));
+    }
+    store->bins[0] += collapsed;
+    store->offset = newMin;
+    store->length = newLength;
+}
+
+static void storeAdd(DDSketchStore *store, int32_t key, u_int64_t count) {
+    if (store->length == 0) {
+        if (store->capacity == 0) {
+            store->capacity = 1;
+            store->bins = malloc(sizeof(u_int64_t));
+        }
+        store->offset = key;
+        store->length = 1;
+        store->bins[0] = 0;
+    }
+
+    const int32_t maxKey = store->offset + (int32_t)store->length - 1;
+    if (key < store->offset || key > maxKey) {
+        int32_t newMin = key < store->offset ? key : store->offset;
+        int32_t newMax = key > maxKey ? key : maxKey;
+        if (newMax - newMin + 1 > DDSKETCH_MAX_BINS) {
+            newMin = newMax - DDSKETCH_MAX_BINS + 1;
+        }
+        storeRemap(store, newMin, newMax);
+    }
+    if (key < store->offset) {
+        key = store->offset;
+    }
+    store->bins[key - store->offset] += count;
+}
+
+DDSketch *DDSketch_New() {
+    return calloc(1, sizeof(DDSketch));
+}
+
+void DDSketch_Free(DDSketch *sketch) {
+    storeFree(&sketch->positive);
+    storeFree(&sketch->negative);
+    free(sketch);
+}
+
+void DDSketch_Reset(DDSketch *sketch) {
+    // keep the bins allocated for the next bucket
+    sketch->positive.length = 0;
+    sketch->negative.length = 0;
+    sketch->zeroCount = 0;
+    sketch->count = 0;
+}
+
+void DDSketch_Add(DDSketch *sketch, double value) {
+    if (isnan(value)) {
+        return;
+    }
+    if (value > DDSKETCH_MIN_INDEXABLE) {
+        storeAdd(&sketch->positive, sketchKey(value), 1);
+    } else if (value < -DDSKETCH_MIN_INDEXABLE) {
+        storeAdd(&sketch->negative, sketchKey(-value), 1);
+    } else {
+        sketch->zeroCount++;
+    }
+    sketch->count++;
+}
+
+static void storeMerge(DDSketchStore *dest, const DDSketchStore *src) {
+    for (u_int32_t i = 0; i < src->length; i++) {
+        if (src->bins[i] > 0) {
+            storeAdd(dest, src->offset + (int32_t)i, src->bins[i]);
+        }
+    }
+}
+
+void DDSketch_Merge(DDSketch *dest, const DDSketch *src) {
+    storeMerge(&dest->positive, &src->positive);
+    storeMerge(&dest->negative, &src->negative);
+    dest->zeroCount += src->zeroCount;
+    dest->count += src->count;
+}
+
+int DDSketch_Quantile(const DDSketch *sketch, double quantile, double *value) {
+    if (sketch->count == 0) {
+        return TSDB_ERROR;
+    }
+    const double rank = quantile * (sketch->count - 1);
+    u_int64_t seen = 0;
+
+    // ascending values: negatives by descending magnitude, zeros, then positives
+    const DDSketchStore *negative = &sketch->negative;
+    for (u_int32_t i = negative->length; i > 0; i--) {
+        seen += negative->bins[i - 1];
+        if (seen > rank) {
+            *value = -sketchValue(negative->offset + (int32_t)i - 1);
+            return TSDB_OK;
+        }
+    }
+    seen += sketch->zeroCount;
+    if (seen > rank) {
+        *value = 0;
+        return TSDB_OK;
+    }
+    const DDSketchStore *positive = &sketch->positive;
+    for (u_int32_t i = 0; i < positive->length; i++) {
+        seen += positive->bins[i];
+        if (seen > rank) {
+            *value = sketchValue(positive->offset + (int32_t)i);
+            return TSDB_OK;
+        }
+    }
+    *value = sketchValue(positive->offset + (int32_t)positive->length - 1);
+    return TSDB_OK;
+}
+
+static void storeRdbSave(const DDSketchStore *store, RedisModuleIO *io) {
+    RedisModule_SaveSigned(io, store->offset);
+    RedisModule_SaveUnsigned(io, store->length);
+    for (u_int32_t i = 0; i < store->length; i++) {
+        RedisModule_SaveUnsigned(io, store->bins[i]);
+    }
+}
+
+static void storeRdbLoad(DDSketchStore *store, RedisModuleIO *io) {
+    store->offset = RedisModule_LoadSigned(io);
+    store->length = RedisModule_LoadUnsigned(io);
+    if (store->length > store->capacity) {
+        store->capacity = store->length;
+        store->bins = realloc(store->bins, store->capacity * sizeof(u_int64_t));
+    }
+    for (u_int32_t i = 0; i < store->length; i++) {
+        store->bins[i] = RedisModule_LoadUnsigned(io);
+    }
+}
+
+void DDSketch_RdbSave(const DDSketch *sketch, RedisModuleIO *io) {
+    RedisModule_SaveUnsigned(io, sketch->count);
+    RedisModule_SaveUnsigned(io, sketch->zeroCount);
+    storeRdbSave(&sketch->positive, io);
+    storeRdbSave(&sketch->negative, io);
+}
+
+void DDSketch_RdbLoad(DDSketch *sketch, RedisModuleIO *io) {
+    sketch->count = RedisModule_LoadUnsigned(io);
+    sketch->zeroCount = RedisModule_LoadUnsigned(io);
+    storeRdbLoad(&sketch->positive, io);
+    storeRdbLoad(&sketch->negative, io);
+}
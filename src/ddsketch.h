@@ -0,0 +1,54 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+
+#ifndef DDSKETCH_H
+#define DDSKETCH_H
+
+#include "redismodule.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * DDSketch quantile sketch (Masson, Rim, Lee - VLDB 2019).
+ *
+ * Values are counted in logarithmic bins, so any quantile is estimated within a relative error of
+ * DDSKETCH_RELATIVE_ACCURACY. Sketches are mergeable by adding their bins. Each store keeps at
+ * most DDSKETCH_MAX_BINS bins, the bins of the smallest magnitudes are collapsed beyond that.
+ */
+#define DDSKETCH_RELATIVE_ACCURACY 0.01
+#define DDSKETCH_MAX_BINS 2048
+
+typedef struct DDSketchStore
+{
+    int32_t offset; // key of bins[0]
+    u_int32_t length;
+    u_int32_t capacity;
+    u_int64_t *bins;
+} DDSketchStore;
+
+typedef struct DDSketch
+{
+    DDSketchStore positive;
+    DDSketchStore negative; // keyed by the absolute value
+    u_int64_t zeroCount;
+    u_int64_t count;
+} DDSketch;
+
+DDSketch *DDSketch_New();
+void DDSketch_Free(DDSketch *sketch);
+void DDSketch_Reset(DDSketch *sketch);
+
+void DDSketch_Add(DDSketch *sketch, double value);
+void DDSketch_Merge(DDSketch *dest, const DDSketch *src);
+
+// quantile in [0, 1], fails on an empty sketch
+int DDSketch_Quantile(const DDSketch *sketch, double quantile, double *value);
+
+void DDSketch_RdbSave(const DDSketch *sketch, RedisModuleIO *io);
+void DDSketch_RdbLoad(DDSketch *sketch, RedisModuleIO *io);
+
+#endif // DDSKETCH_H
@@ -8,6 +8,8 @@
 #include "abstract_iterator.h"
 #include "series_iterator.h"
 
+#include <math.h>
+
 static bool check_sample_value(Sample sample, FilterByValueArgs byValueArgs) {
     if (!byValueArgs.hasValue) {
         return true;
@@ -71,15 +73,15 @@ void SeriesFilterIterator_Close(struct AbstractIterator *iterator) {
 }
 
 AggregationIterator *AggregationIterator_New(struct AbstractIterator *input,
-                                             AggregationClass *aggregation,
-                                             int64_t aggregationTimeDelta,
+                                             AggregationArgs *args,
                                              bool reverse) {
     AggregationIterator *iter = malloc(sizeof(AggregationIterator));
     iter->base.GetNext = AggregationIterator_GetNext;
     iter->base.Close = AggregationIterator_Close;
     iter->base.input = input;
-    iter->aggregation = aggregation;
-    iter->aggregationTimeDelta = aggregationTimeDelta;
+    iter->aggregation = args->aggregationClass;
+    iter->aggregationTimeDelta = args->timeDelta;
+    iter->timestampAlignment = args->alignment % args->timeDelta;
     iter->aggregationContext = iter->aggregation->createContext();
     iter->aggregationLastTimestamp = 0;
 
@@ -88,9 +90,24 @@ AggregationIterator *AggregationIterator_New(struct AbstractIterator *input,
     iter->reverse = reverse;
     iter->initilized = false;
 
+    iter->emptyFill = args->emptyFill;
+    iter->hasLastBucket = false;
+    iter->hasNextBucket = false;
+    iter->emptyBucketTimestamp = 0;
+
     return iter;
 }
 
+// Start of the bucket of `timestamp`, a first partial bucket starts at 0
+static inline timestamp_t bucketStart(timestamp_t timestamp,
+                                      u_int64_t timeDelta,
+                                      timestamp_t alignment) {
+    if (timestamp < alignment) {
+        return 0;
+    }
+    return timestamp - ((timestamp - alignment) % timeDelta);
+}
+
 static bool finalizeBucket(Sample *currentSample, const AggregationIterator *self) {
     bool hasSample = false;
     double value;
@@ -103,8 +120,9 @@ static bool finalizeBucket(Sample *currentSample, const AggregationIterator *sel
     return hasSample;
 }
 
-ChunkResult AggregationIterator_GetNext(struct AbstractIterator *iter, Sample *currentSample) {
-    AggregationIterator *self = (AggregationIterator *)iter;
+// Returns the next non-empty bucket
+static ChunkResult aggregateNextBucket(AggregationIterator *self, Sample *currentSample) {
+    AbstractIterator *iter = &self->base;
 
     Sample internalSample = { 0 };
     AbstractIterator *input = iter->input;
@@ -114,16 +132,18 @@ ChunkResult AggregationIterator_GetNext(struct AbstractIterator *iter, Sample *c
     u_int64_t aggregationTimeDelta = self->aggregationTimeDelta;
     bool is_reserved = self->reverse;
     if (result == CR_OK && !self->initilized) {
-        timestamp_t init_ts = internalSample.timestamp;
-        self->aggregationLastTimestamp = init_ts - (init_ts % aggregationTimeDelta);
+        self->aggregationLastTimestamp = bucketStart(
+            internalSample.timestamp, aggregationTimeDelta, self->timestampAlignment);
         self->initilized = true;
     }
 
     bool hasSample = FALSE;
     AggregationClass *aggregation = self->aggregation;
-    void (*appendValue)(void *, double) = aggregation->appendValue;
+    void (*appendValue)(void *, double, u_int64_t) = aggregation->appendValue;
     void *aggregationContext = self->aggregationContext;
-    u_int64_t contextScope = self->aggregationLastTimestamp + aggregationTimeDelta;
+    u_int64_t contextScope = bucketStart(self->aggregationLastTimestamp + aggregationTimeDelta,
+                                         aggregationTimeDelta,
+                                         self->timestampAlignment);
     while (result == CR_OK) {
         if ((is_reserved == FALSE && internalSample.timestamp >= contextScope) ||
             (is_reserved == TRUE && internalSample.timestamp < self->aggregationLastTimestamp)) {
@@ -131,13 +151,15 @@ ChunkResult AggregationIterator_GetNext(struct AbstractIterator *iter, Sample *c
             if (self->aggregationIsFirstSample == FALSE) {
                 hasSample = finalizeBucket(currentSample, self);
             }
-            self->aggregationLastTimestamp =
-                internalSample.timestamp - (internalSample.timestamp % aggregationTimeDelta);
-            contextScope = self->aggregationLastTimestamp + aggregationTimeDelta;
+            self->aggregationLastTimestamp = bucketStart(
+                internalSample.timestamp, aggregationTimeDelta, self->timestampAlignment);
+            contextScope = bucketStart(self->aggregationLastTimestamp + aggregationTimeDelta,
+                                       aggregationTimeDelta,
+                                       self->timestampAlignment);
         }
         self->aggregationIsFirstSample = FALSE;
 
-        appendValue(aggregationContext, internalSample.value);
+        appendValue(aggregationContext, internalSample.value, internalSample.timestamp);
         if (hasSample) {
             return CR_OK;
         }
@@ -161,9 +183,165 @@ ChunkResult AggregationIterator_GetNext(struct AbstractIterator *iter, Sample *c
     }
 }
 
+static double emptyBucketValue(const AggregationIterator *self, timestamp_t timestamp) {
+    // order the surrounding buckets by time
+    const Sample *before = self->reverse ? &self->nextBucket : &self->lastBucket;
+    const Sample *after = self->reverse ? &self->lastBucket : &self->nextBucket;
+    switch (self->emptyFill) {
+        case EmptyBucketFill_Zero:
+            return 0;
+        case EmptyBucketFill_Prev:
+            return before->value;
+        case EmptyBucketFill_Next:
+            return after->value;
+        case EmptyBucketFill_Linear:
+            return before->value + (after->value - before->value) *
+                                       (double)(timestamp - before->timestamp) /
+                                       (double)(after->timestamp - before->timestamp);
+        default:
+            return NAN;
+    }
+}
+
+// Start of the bucket following `bucket` in the iteration order
+static inline timestamp_t followingBucket(const AggregationIterator *self, timestamp_t bucket) {
+    if (self->reverse) {
+        return bucketStart(bucket - 1, self->aggregationTimeDelta, self->timestampAlignment);
+    }
+    return bucketStart(
+        bucket + self->aggregationTimeDelta, self->aggregationTimeDelta, self->timestampAlignment);
+}
+
+ChunkResult AggregationIterator_GetNext(struct AbstractIterator *iter, Sample *currentSample) {
+    AggregationIterator *self = (AggregationIterator *)iter;
+    if (self->emptyFill == EmptyBucketFill_None) {
+        return aggregateNextBucket(self, currentSample);
+    }
+
+    if (!self->hasNextBucket) {
+        ChunkResult result = aggregateNextBucket(self, &self->nextBucket);
+        if (result != CR_OK) {
+            return result;
+        }
+        self->hasNextBucket = true;
+        self->emptyBucketTimestamp = self->hasLastBucket
+                                         ? followingBucket(self, self->lastBucket.timestamp)
+                                         : self->nextBucket.timestamp;
+    }
+
+    if (self->emptyBucketTimestamp != self->nextBucket.timestamp) {
+        currentSample->timestamp = self->emptyBucketTimestamp;
+        currentSample->value = emptyBucketValue(self, self->emptyBucketTimestamp);
+        self->emptyBucketTimestamp = followingBucket(self, self->emptyBucketTimestamp);
+        return CR_OK;
+    }
+
+    *currentSample = self->nextBucket;
+    self->lastBucket = self->nextBucket;
+    self->hasLastBucket = true;
+    self->hasNextBucket = false;
+    return CR_OK;
+}
+
 void AggregationIterator_Close(struct AbstractIterator *iterator) {
     AggregationIterator *self = (AggregationIterator *)iterator;
     iterator->input->Close(iterator->input);
     self->aggregation->freeContext(self->aggregationContext);
     free(iterator);
 }
+
+// whether the head of input `a` comes before the head of input `b`
+static inline bool headBefore(const MultiSeriesReduceIterator *self, size_t a, size_t b) {
+    const timestamp_t ta = self->heads[a].timestamp, tb = self->heads[b].timestamp;
+    if (ta != tb) {
+        return self->reverse ? ta > tb : ta < tb;
+    }
+    return a < b;
+}
+
+static void heapSiftDown(MultiSeriesReduceIterator *self, size_t pos) {
+    size_t *heap = self->heap;
+    while (true) {
+        size_t first = pos;
+        const size_t left = 2 * pos + 1, right = 2 * pos + 2;
+        if (left < self->heapSize && headBefore(self, heap[left], heap[first])) {
+            first = left;
+        }
+        if (right < self->heapSize && headBefore(self, heap[right], heap[first])) {
+            first = right;
+        }
+        if (first == pos) {
+            return;
+        }
+        const size_t tmp = heap[pos];
+        heap[pos] = heap[first];
+        heap[first] = tmp;
+        pos = first;
+    }
+}
+
+MultiSeriesReduceIterator *MultiSeriesReduceIterator_New(AbstractIterator **inputs,
+                                                         size_t count,
+                                                         AggregationClass *reducer,
+                                                         bool reverse) {
+    MultiSeriesReduceIterator *iter = malloc(sizeof(MultiSeriesReduceIterator));
+    iter->base.GetNext = MultiSeriesReduceIterator_GetNext;
+    iter->base.Close = MultiSeriesReduceIterator_Close;
+    iter->base.input = NULL;
+    iter->inputs = inputs;
+    iter->count = count;
+    iter->heads = malloc(count * sizeof(Sample));
+    iter->heap = malloc(count * sizeof(size_t));
+    iter->heapSize = 0;
+    iter->reducer = reducer;
+    iter->reducerContext = reducer->createContext();
+    iter->reverse = reverse;
+
+    for (size_t i = 0; i < count; i++) {
+        if (inputs[i]->GetNext(inputs[i], &iter->heads[i]) == CR_OK) {
+            iter->heap[iter->heapSize++] = i;
+        }
+    }
+    for (size_t i = iter->heapSize / 2; i > 0; i--) {
+        heapSiftDown(iter, i - 1);
+    }
+    return iter;
+}
+
+ChunkResult MultiSeriesReduceIterator_GetNext(struct AbstractIterator *base, Sample *currentSample) {
+    MultiSeriesReduceIterator *self = (MultiSeriesReduceIterator *)base;
+    while (self->heapSize > 0) {
+        const timestamp_t timestamp = self->heads[self->heap[0]].timestamp;
+        // pop the inputs positioned at the timestamp, and push them back with their next sample
+        while (self->heapSize > 0 && self->heads[self->heap[0]].timestamp == timestamp) {
+            const size_t input = self->heap[0];
+            self->reducer->appendValue(self->reducerContext, self->heads[input].value, timestamp);
+            if (self->inputs[input]->GetNext(self->inputs[input], &self->heads[input]) != CR_OK) {
+                self->heap[0] = self->heap[--self->heapSize];
+            }
+            heapSiftDown(self, 0);
+        }
+
+        double value;
+        const int rv = self->reducer->finalize(self->reducerContext, &value);
+        self->reducer->resetContext(self->reducerContext);
+        if (rv == TSDB_OK) {
+            currentSample->timestamp = timestamp;
+            currentSample->value = value;
+            return CR_OK;
+        }
+    }
+    return CR_END;
+}
+
+void MultiSeriesReduceIterator_Close(struct AbstractIterator *iterator) {
+    MultiSeriesReduceIterator *self = (MultiSeriesReduceIterator *)iterator;
+    for (size_t i = 0; i < self->count; i++) {
+        self->inputs[i]->Close(self->inputs[i]);
+    }
+    self->reducer->freeContext(self->reducerContext);
+    free(self->inputs);
+    free(self->heads);
+    free(self->heap);
+    free(self);
+}
@@ -30,19 +30,52 @@ typedef struct AggregationIterator
     AbstractIterator base;
     AggregationClass *aggregation;
     int64_t aggregationTimeDelta;
+    timestamp_t timestampAlignment;
     void *aggregationContext;
     timestamp_t aggregationLastTimestamp;
     bool aggregationIsFirstSample;
     bool aggregationIsFinalized;
     bool reverse;
     bool initilized;
+    // empty buckets are filled between the last reported bucket and the next non-empty one
+    EmptyBucketFill emptyFill;
+    bool hasLastBucket;
+    bool hasNextBucket;
+    Sample lastBucket;
+    Sample nextBucket;
+    timestamp_t emptyBucketTimestamp;
 } AggregationIterator;
 
 AggregationIterator *AggregationIterator_New(struct AbstractIterator *input,
-                                             AggregationClass *aggregation,
-                                             int64_t aggregationTimeDelta,
+                                             AggregationArgs *args,
                                              bool reverse);
 ChunkResult AggregationIterator_GetNext(struct AbstractIterator *iter, Sample *currentSample);
 void AggregationIterator_Close(struct AbstractIterator *iterator);
 
+/*
+ * Merge the samples of several iterators by timestamp, in ascending (or descending when
+ * `reverse`) order. The inputs are kept in a heap keyed by the timestamp of their next sample, and
+ * the samples sharing a timestamp are reduced into a single sample with the `reducer` aggregation.
+ * The iterator owns its inputs.
+ */
+typedef struct MultiSeriesReduceIterator
+{
+    AbstractIterator base;
+    AbstractIterator **inputs;
+    size_t count;
+    Sample *heads;   // next sample of every input
+    size_t *heap;    // inputs with a next sample
+    size_t heapSize;
+    AggregationClass *reducer;
+    void *reducerContext;
+    bool reverse;
+} MultiSeriesReduceIterator;
+
+MultiSeriesReduceIterator *MultiSeriesReduceIterator_New(AbstractIterator **inputs,
+                                                         size_t count,
+                                                         AggregationClass *reducer,
+                                                         bool reverse);
+ChunkResult MultiSeriesReduceIterator_GetNext(struct AbstractIterator *iter, Sample *currentSample);
+void MultiSeriesReduceIterator_Close(struct AbstractIterator *iterator);
+
 #endif // FILTER_ITERATOR_H
@@ -8,8 +8,18 @@
 #include "reply.h"
 #include "resultset.h"
 
+#include <pthread.h>
 #include "rmutil/alloc.h"
 
+static TS_AGG_TYPES_T aggClassToEnum(const AggregationClass *aggClass) {
+    for (int aggType = TS_AGG_NONE + 1; aggType < TS_AGG_TYPES_MAX; aggType++) {
+        if (aggClass != NULL && GetAggClass(aggType) == aggClass) {
+            return aggType;
+        }
+    }
+    return TS_AGG_NONE;
+}
+
 static void mget_done(ExecutionPlan *gearsCtx, void *privateData) {
     RedisModuleBlockedClient *bc = privateData;
     RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(bc);
@@ -26,72 +36,154 @@ static void mget_done(ExecutionPlan *gearsCtx, void *privateData) {
     RedisModule_FreeThreadSafeContext(rctx);
 }
 
-static void mrange_done(ExecutionPlan *gearsCtx, void *privateData) {
-    MRangeData *data = privateData;
-    RedisModuleBlockedClient *bc = data->bc;
-    RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(bc);
+// The TS.MRANGE replies streamed by the MRangeReplyFilter, by id
+static RedisModuleDict *mrangeStreams = NULL;
+static long long mrangeStreamsNextId = 0;
+static pthread_mutex_t mrangeStreamsLock = PTHREAD_MUTEX_INITIALIZER;
 
-    long long len = RedisGears_GetRecordsLen(gearsCtx);
+static MRangeData *mrangeStreamGet(long long id) {
+    pthread_mutex_lock(&mrangeStreamsLock);
+    MRangeData *data = RedisModule_DictGetC(mrangeStreams, &id, sizeof(id), NULL);
+    pthread_mutex_unlock(&mrangeStreamsLock);
+    return data;
+}
 
-    TS_ResultSet *resultset = NULL;
+static void mrangeStreamTrackSeries(MRangeData *data, Series *series) {
+    if (data->seriesCount == data->seriesCapacity) {
+        data->seriesCapacity = data->seriesCapacity ? data->seriesCapacity * 2 : 16;
+        data->series = realloc(data->series, data->seriesCapacity * sizeof(Series *));
+    }
+    data->series[data->seriesCount++] = series;
+}
 
+// Returns 1 to keep the record with the collected records, 0 to have it freed
+static int mrangeConsumeGroupRecord(MRangeData *data, GroupRecord *record) {
+    size_t labelValueLen;
+    const char *labelValue = RedisModule_StringPtrLen(record->labelValue, &labelValueLen);
+    GroupRecord *group =
+        RedisModule_DictGetC(data->groups, (void *)labelValue, labelValueLen, NULL);
+    if (group == NULL) {
+        // the first partials of the group, the ones of the next shards are merged into them
+        RedisModule_DictSetC(data->groups, (void *)labelValue, labelValueLen, record);
+        return 1;
+    }
+    GroupRecord_Merge(group, record, data->args.gropuByReducerOp);
+    return 0;
+}
+
+static int mrangeConsumeSeriesRecord(MRangeData *data, SeriesRecord *record) {
+    // the chunks of the record are iterated as they arrived, without copying their samples
+    Series *s = SeriesRecord_IntoSeries(record);
     if (data->args.groupByLabel) {
-        resultset = ResultSet_Create();
-        ResultSet_GroupbyLabel(resultset, data->args.groupByLabel);
-    } else {
-        RedisModule_ReplyWithArray(rctx, len);
+        ResultSet_AddSerie(data->resultset, s, RedisModule_StringPtrLen(s->keyName, NULL));
+        mrangeStreamTrackSeries(data, s);
+        return 0;
     }
 
-    Series **tempSeries = calloc(len, sizeof(Series *));
-    for (int i = 0; i < len; i++) {
-        Record *raw_record = RedisGears_GetRecord(gearsCtx, i);
-        if (raw_record->type != GetSeriesRecordType()) {
-            continue;
-        }
-        Series *s = SeriesRecord_IntoSeries((SeriesRecord *)raw_record);
-        tempSeries[i] = s;
-
-        if (data->args.groupByLabel) {
-            ResultSet_AddSerie(resultset, s, RedisModule_StringPtrLen(s->keyName, NULL));
-        } else {
-            ReplySeriesArrayPos(rctx,
-                                s,
-                                data->args.withLabels,
-                                data->args.limitLabels,
-                                data->args.numLimitLabels,
-                                &data->args.rangeArgs,
-                                data->args.reverse);
-        }
+    RangeArgs seriesArgs = data->replyArgs;
+    ReplySeriesArrayPos(data->rctx,
+                        s,
+                        data->args.withLabels,
+                        data->args.limitLabels,
+                        data->args.numLimitLabels,
+                        &seriesArgs,
+                        data->args.reverse);
+    data->replied++;
+    FreeSeries(s);
+    return 0;
+}
+
+int MRangeReplyFilter(ExecutionCtx *ctx, Record *record, void *arg) {
+    MRangeData *data = mrangeStreamGet(((MRangeStream_Arg *)arg)->id);
+    if (data == NULL) {
+        return 0;
+    }
+    if (record->type == GetGroupRecordType()) {
+        return mrangeConsumeGroupRecord(data, (GroupRecord *)record);
+    }
+    if (record->type == GetSeriesRecordType()) {
+        return mrangeConsumeSeriesRecord(data, (SeriesRecord *)record);
     }
+    return 0;
+}
 
-    if (data->args.groupByLabel) {
-        // Apply the reducer
-        RangeArgs args = data->args.rangeArgs;
-        ResultSet_ApplyReducer(resultset, &args, data->args.gropuByReducerOp, data->args.reverse);
-
-        // Do not apply the aggregation on the resultset, do apply max results on the final result
-        RangeArgs minimizedArgs = data->args.rangeArgs;
-        minimizedArgs.aggregationArgs.aggregationClass = NULL;
-        minimizedArgs.aggregationArgs.timeDelta = 0;
-        minimizedArgs.filterByValueArgs.hasValue = false;
-
-        replyResultSet(rctx,
-                       resultset,
-                       data->args.withLabels,
-                       data->args.limitLabels,
-                       data->args.numLimitLabels,
-                       &minimizedArgs,
-                       data->args.reverse);
-
-        ResultSet_Free(resultset);
+// The shards reduced their series into partials of every group, which were merged by group
+static void replyGroupRecords(MRangeData *data) {
+    RedisModule_ReplyWithArray(data->rctx, RedisModule_DictSize(data->groups));
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(data->groups, "^", NULL, 0);
+    GroupRecord *group;
+    while (RedisModule_DictNextC(iter, NULL, (void **)&group) != NULL) {
+        Series *reduced = NewReducedSeries(data->args.groupByLabel,
+                                           RedisModule_StringPtrLen(group->labelValue, NULL),
+                                           data->args.gropuByReducerOp,
+                                           group->sources,
+                                           group->sourcesCount);
+        AbstractIterator *samples = ReducerPartialsIterator_New(group->partials,
+                                                                group->partialsCount,
+                                                                data->args.gropuByReducerOp,
+                                                                data->args.reverse);
+        ReplySeriesIteratorArrayPos(data->rctx,
+                                    reduced,
+                                    data->args.withLabels,
+                                    data->args.limitLabels,
+                                    data->args.numLimitLabels,
+                                    samples,
+                                    &data->replyArgs);
+        samples->Close(samples);
+        FreeSeries(reduced);
     }
-    RedisModule_UnblockClient(bc, NULL);
-    for (int i = 0; i < len; i++) {
-        FreeSeries(tempSeries[i]);
+    RedisModule_DictIteratorStop(iter);
+}
+
+// The shards sent the samples of the series of the groups
+static void replyResultSetGroups(MRangeData *data) {
+    // Apply the reducer, max results apply to the final result
+    RangeArgs reducerArgs = data->replyArgs;
+    ResultSet_ApplyReducer(data->resultset, &reducerArgs, data->args.gropuByReducerOp);
+
+    replyResultSet(data->rctx,
+                   data->resultset,
+                   data->args.withLabels,
+                   data->args.limitLabels,
+                   data->args.numLimitLabels,
+                   &data->replyArgs,
+                   data->args.reverse);
+}
+
+static void MRangeData_Free(MRangeData *data) {
+    if (data->groups) {
+        // the group records are freed with the execution
+        RedisModule_FreeDict(NULL, data->groups);
     }
-    free(tempSeries);
+    if (data->resultset) {
+        ResultSet_Free(data->resultset);
+    }
+    for (size_t i = 0; i < data->seriesCount; i++) {
+        FreeSeries(data->series[i]);
+    }
+    free(data->series);
     MRangeArgs_Free(&data->args);
     free(data);
+}
+
+static void mrange_done(ExecutionPlan *gearsCtx, void *privateData) {
+    MRangeData *data = privateData;
+    RedisModuleCtx *rctx = data->rctx;
+
+    pthread_mutex_lock(&mrangeStreamsLock);
+    RedisModule_DictDelC(mrangeStreams, &data->id, sizeof(data->id), NULL);
+    pthread_mutex_unlock(&mrangeStreamsLock);
+
+    if (data->groups) {
+        replyGroupRecords(data);
+    } else if (data->resultset) {
+        replyResultSetGroups(data);
+    } else {
+        RedisModule_ReplySetArrayLength(rctx, data->replied);
+    }
+
+    RedisModule_UnblockClient(data->bc, NULL);
+    MRangeData_Free(data);
     RedisGears_DropExecution(gearsCtx);
     RedisModule_FreeThreadSafeContext(rctx);
 }
@@ -107,7 +199,7 @@ int TSDB_mget_RG(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (err) {
         RedisModule_ReplyWithError(ctx, err);
     }
-    QueryPredicates_Arg *queryArg = malloc(sizeof(QueryPredicates_Arg));
+    QueryPredicates_Arg *queryArg = calloc(1, sizeof(QueryPredicates_Arg));
     queryArg->count = args.queryPredicates->count;
     queryArg->startTimestamp = 0;
     queryArg->endTimestamp = 0;
@@ -147,10 +239,20 @@ int TSDB_mrange_RG(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, bool
     if (err) {
         RedisModule_ReplyWithError(ctx, err);
     }
-    QueryPredicates_Arg *queryArg = malloc(sizeof(QueryPredicates_Arg));
+    QueryPredicates_Arg *queryArg = calloc(1, sizeof(QueryPredicates_Arg));
     queryArg->count = args.queryPredicates->count;
     queryArg->startTimestamp = args.rangeArgs.startTimestamp;
     queryArg->endTimestamp = args.rangeArgs.endTimestamp;
+    queryArg->aggType = aggClassToEnum(args.rangeArgs.aggregationArgs.aggregationClass);
+    queryArg->rangeArgs = args.rangeArgs;
+    queryArg->reverse = reverse;
+    queryArg->grouped = args.groupByLabel != NULL;
+    const bool partialGroups =
+        args.groupByLabel != NULL && ReducerPartial_IsMergeable(args.gropuByReducerOp);
+    if (partialGroups) {
+        queryArg->groupByLabel = strdup(args.groupByLabel);
+        queryArg->reducerOp = args.gropuByReducerOp;
+    }
     args.queryPredicates->ref++;
     queryArg->predicates = args.queryPredicates;
     queryArg->withLabels = args.withLabels;
@@ -158,20 +260,53 @@ int TSDB_mrange_RG(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, bool
     queryArg->limitLabels = calloc(args.numLimitLabels, sizeof(RedisModuleString *));
     memcpy(
         queryArg->limitLabels, args.limitLabels, sizeof(RedisModuleString *) * args.numLimitLabels);
-    RedisGears_FlatMap(rg_ctx, "ShardSeriesMapper", queryArg);
+    RedisGears_FlatMap(rg_ctx, partialGroups ? "ShardGroupMapper" : "ShardSeriesMapper", queryArg);
     RGM_Collect(rg_ctx);
 
+    // the collected records are replied to, or merged, and freed as they arrive
+    MRangeStream_Arg *streamArg = malloc(sizeof(MRangeStream_Arg));
+    pthread_mutex_lock(&mrangeStreamsLock);
+    if (mrangeStreams == NULL) {
+        mrangeStreams = RedisModule_CreateDict(NULL);
+    }
+    streamArg->id = mrangeStreamsNextId++;
+    const long long id = streamArg->id;
+    RedisGears_Filter(rg_ctx, "MRangeReplyFilter", streamArg);
+
+    // the filter waits for the stream to be registered before consuming the first record
     ExecutionPlan *ep = RGM_Run(rg_ctx, ExecutionModeAsync, NULL, NULL, NULL, &err);
     if (!ep) {
+        pthread_mutex_unlock(&mrangeStreamsLock);
         RedisGears_FreeFlatExecution(rg_ctx);
         RedisModule_ReplyWithError(ctx, err);
+        MRangeArgs_Free(&args);
         return REDISMODULE_OK;
     }
 
-    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
-    MRangeData *data = malloc(sizeof(struct MRangeData));
-    data->bc = bc;
+    MRangeData *data = calloc(1, sizeof(struct MRangeData));
+    data->id = id;
+    data->bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+    data->rctx = RedisModule_GetThreadSafeContext(data->bc);
     data->args = args;
+    // The shards already applied the filters and the aggregation
+    data->replyArgs = args.rangeArgs;
+    data->replyArgs.startTimestamp = 0;
+    data->replyArgs.endTimestamp = UINT64_MAX;
+    data->replyArgs.aggregationArgs.aggregationClass = NULL;
+    data->replyArgs.aggregationArgs.timeDelta = 0;
+    data->replyArgs.filterByTSArgs.hasValue = false;
+    data->replyArgs.filterByValueArgs.hasValue = false;
+    if (partialGroups) {
+        data->groups = RedisModule_CreateDict(NULL);
+    } else if (args.groupByLabel) {
+        data->resultset = ResultSet_Create();
+        ResultSet_GroupbyLabel(data->resultset, args.groupByLabel);
+    } else {
+        RedisModule_ReplyWithArray(data->rctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    }
+    RedisModule_DictSetC(mrangeStreams, &data->id, sizeof(data->id), data);
+    pthread_mutex_unlock(&mrangeStreamsLock);
+
     RedisGears_AddOnDoneCallback(ep, mrange_done, data);
     RedisGears_FreeFlatExecution(rg_ctx);
     return REDISMODULE_OK;
@@ -183,7 +318,7 @@ int TSDB_queryindex_RG(RedisModuleCtx *ctx, QueryPredicateList *queries) {
     if (err) {
         RedisModule_ReplyWithError(ctx, err);
     }
-    QueryPredicates_Arg *queryArg = malloc(sizeof(QueryPredicates_Arg));
+    QueryPredicates_Arg *queryArg = calloc(1, sizeof(QueryPredicates_Arg));
     queryArg->count = queries->count;
     queryArg->startTimestamp = 0;
     queryArg->endTimestamp = 0;
@@ -1,18 +1,35 @@
 
 #include "RedisModulesSDK/redismodule.h"
 #include "query_language.h"
+#include "redisgears.h"
+#include "resultset.h"
 
 #ifndef REDIS_TIMESERIES_CLEAN_GEARS_COMMANDS_H
 #define REDIS_TIMESERIES_CLEAN_GEARS_COMMANDS_H
 
 typedef struct MRangeData
 {
+    long long id;
     RedisModuleBlockedClient *bc;
+    RedisModuleCtx *rctx;
     MRangeArgs args;
+    // the shards already applied the filters and the aggregation
+    RangeArgs replyArgs;
+    // the series replied to as their records arrived
+    size_t replied;
+    // label value -> the GroupRecord the partials of the group are merged into
+    RedisModuleDict *groups;
+    // the series of the groups whose reducer can't be merged, freed with the reply
+    TS_ResultSet *resultset;
+    Series **series;
+    size_t seriesCount;
+    size_t seriesCapacity;
 } MRangeData;
 
 int TSDB_mget_RG(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 int TSDB_queryindex_RG(RedisModuleCtx *ctx, QueryPredicateList *queries);
+// Consumes the records collected by TS.MRANGE as they arrive from the shards
+int MRangeReplyFilter(ExecutionCtx *ctx, Record *record, void *arg);
 int TSDB_mrange_RG(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, bool reverse);
 
 #endif // REDIS_TIMESERIES_CLEAN_GEARS_COMMANDS_H
@@ -3,6 +3,7 @@
 
 #include "RedisModulesSDK/redismodule.h"
 #include "consts.h"
+#include "gears_commands.h"
 #include "generic_chunk.h"
 #include "indexer.h"
 #include "query_language.h"
@@ -12,21 +13,29 @@
 #include <assert.h>
 #include "rmutil/alloc.h"
 
-#define QueryPredicatesVersion 1
+#define QueryPredicatesVersion 3
+#define MRangeStreamVersion 1
 #define SeriesRecordName "SeriesRecord"
+#define GroupRecordName "GroupRecord"
 
 static RecordType *SeriesRecordType = NULL;
+static RecordType *GroupRecordType = NULL;
 static bool GearsLoaded = false;
 
 RecordType *GetSeriesRecordType() {
     return SeriesRecordType;
 }
 
+RecordType *GetGroupRecordType() {
+    return GroupRecordType;
+}
+
 static void QueryPredicates_ObjectFree(void *arg) {
     QueryPredicates_Arg *predicate_list = arg;
 
     QueryPredicateList_Free(predicate_list->predicates);
     free(predicate_list->limitLabels);
+    free(predicate_list->groupByLabel);
     free(predicate_list);
 }
 
@@ -52,6 +61,19 @@ static char *QueryPredicates_ToString(void *arg) {
 
 static void BWWriteRedisString(Gears_BufferWriter *bw, const RedisModuleString *arg);
 
+static void BWWriteDouble(Gears_BufferWriter *bw, double value) {
+    long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    RedisGears_BWWriteLong(bw, bits);
+}
+
+static double BRReadDouble(Gears_BufferReader *br) {
+    long bits = RedisGears_BRReadLong(br);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
 static int QueryPredicates_ArgSerialize(FlatExecutionPlan *fep,
                                         void *arg,
                                         Gears_BufferWriter *bw,
@@ -79,6 +101,28 @@ static int QueryPredicates_ArgSerialize(FlatExecutionPlan *fep,
             BWWriteRedisString(bw, predicate->valuesList[value_index]);
         }
     }
+
+    const RangeArgs *rangeArgs = &predicate_list->rangeArgs;
+    RedisGears_BWWriteLong(bw, predicate_list->aggType);
+    RedisGears_BWWriteLong(bw, rangeArgs->aggregationArgs.timeDelta);
+    RedisGears_BWWriteLong(bw, rangeArgs->aggregationArgs.alignment);
+    RedisGears_BWWriteLong(bw, rangeArgs->aggregationArgs.emptyFill);
+    RedisGears_BWWriteLong(bw, rangeArgs->filterByValueArgs.hasValue);
+    BWWriteDouble(bw, rangeArgs->filterByValueArgs.min);
+    BWWriteDouble(bw, rangeArgs->filterByValueArgs.max);
+    RedisGears_BWWriteLong(bw, rangeArgs->filterByTSArgs.hasValue);
+    RedisGears_BWWriteLong(bw, rangeArgs->filterByTSArgs.count);
+    for (size_t i = 0; i < rangeArgs->filterByTSArgs.count; i++) {
+        RedisGears_BWWriteLong(bw, rangeArgs->filterByTSArgs.values[i]);
+    }
+    RedisGears_BWWriteLong(bw, rangeArgs->count);
+    RedisGears_BWWriteLong(bw, predicate_list->reverse);
+    RedisGears_BWWriteLong(bw, predicate_list->grouped);
+    RedisGears_BWWriteLong(bw, predicate_list->groupByLabel != NULL);
+    if (predicate_list->groupByLabel != NULL) {
+        RedisGears_BWWriteString(bw, predicate_list->groupByLabel);
+        RedisGears_BWWriteLong(bw, predicate_list->reducerOp);
+    }
     return REDISMODULE_OK;
 }
 
@@ -98,7 +142,7 @@ static void *QueryPredicates_ArgDeserialize(FlatExecutionPlan *fep,
                                             Gears_BufferReader *br,
                                             int version,
                                             char **err) {
-    QueryPredicates_Arg *predicates = malloc(sizeof(*predicates));
+    QueryPredicates_Arg *predicates = calloc(1, sizeof(*predicates));
     predicates->predicates = malloc(sizeof(QueryPredicateList));
     predicates->predicates->count = RedisGears_BRReadLong(br);
     predicates->predicates->ref = 1;
@@ -129,9 +173,72 @@ static void *QueryPredicates_ArgDeserialize(FlatExecutionPlan *fep,
             predicate->valuesList[value_index] = BRReadRedisString(br);
         }
     }
+
+    RangeArgs *rangeArgs = &predicates->rangeArgs;
+    rangeArgs->startTimestamp = predicates->startTimestamp;
+    rangeArgs->endTimestamp = predicates->endTimestamp;
+    rangeArgs->count = -1;
+    if (version < 2) {
+        // sent by a coordinator aggregating the samples itself
+        predicates->aggType = TS_AGG_NONE;
+        return predicates;
+    }
+    predicates->aggType = RedisGears_BRReadLong(br);
+    rangeArgs->aggregationArgs.aggregationClass = GetAggClass(predicates->aggType);
+    rangeArgs->aggregationArgs.timeDelta = RedisGears_BRReadLong(br);
+    rangeArgs->aggregationArgs.alignment = RedisGears_BRReadLong(br);
+    rangeArgs->aggregationArgs.emptyFill = RedisGears_BRReadLong(br);
+    rangeArgs->filterByValueArgs.hasValue = RedisGears_BRReadLong(br);
+    rangeArgs->filterByValueArgs.min = BRReadDouble(br);
+    rangeArgs->filterByValueArgs.max = BRReadDouble(br);
+    rangeArgs->filterByTSArgs.hasValue = RedisGears_BRReadLong(br);
+    rangeArgs->filterByTSArgs.count = min(RedisGears_BRReadLong(br), MAX_TS_VALUES_FILTER);
+    for (size_t i = 0; i < rangeArgs->filterByTSArgs.count; i++) {
+        rangeArgs->filterByTSArgs.values[i] = RedisGears_BRReadLong(br);
+    }
+    rangeArgs->count = RedisGears_BRReadLong(br);
+    predicates->reverse = RedisGears_BRReadLong(br);
+    predicates->grouped = RedisGears_BRReadLong(br);
+    if (version >= 3 && RedisGears_BRReadLong(br)) {
+        predicates->groupByLabel = strdup(RedisGears_BRReadString(br));
+        predicates->reducerOp = RedisGears_BRReadLong(br);
+    }
     return predicates;
 }
 
+static void MRangeStream_ObjectFree(void *arg) {
+    free(arg);
+}
+
+static void *MRangeStream_Duplicate(void *arg) {
+    MRangeStream_Arg *dup = malloc(sizeof(MRangeStream_Arg));
+    *dup = *(MRangeStream_Arg *)arg;
+    return dup;
+}
+
+static char *MRangeStream_ToString(void *arg) {
+    char out[64];
+    snprintf(out, sizeof(out), "MRangeStream: %lld", ((MRangeStream_Arg *)arg)->id);
+    return strdup(out);
+}
+
+static int MRangeStream_ArgSerialize(FlatExecutionPlan *fep,
+                                     void *arg,
+                                     Gears_BufferWriter *bw,
+                                     char **err) {
+    RedisGears_BWWriteLong(bw, ((MRangeStream_Arg *)arg)->id);
+    return REDISMODULE_OK;
+}
+
+static void *MRangeStream_ArgDeserialize(FlatExecutionPlan *fep,
+                                         Gears_BufferReader *br,
+                                         int version,
+                                         char **err) {
+    MRangeStream_Arg *stream = malloc(sizeof(MRangeStream_Arg));
+    stream->id = RedisGears_BRReadLong(br);
+    return stream;
+}
+
 Record *RedisGears_RedisStringRecordCreate(RedisModuleString *str) {
     size_t len = 0;
     const char *cstr = RedisModule_StringPtrLen(str, &len);
@@ -152,33 +259,24 @@ Record *ListSeriesLabels(const Series *series) {
 }
 
 Record *ListSeriesLabelsWithLimit(const Series *series,
-                                  char **limitLabels,
-                                  RedisModuleString **rLimitLabels,
+                                  RedisModuleString **limitLabels,
                                   ushort limitLabelsSize) {
-    long count = 0;
     Record *r = RedisGears_ListRecordCreate(series->labelsCount);
     for (int i = 0; i < limitLabelsSize; i++) {
-        bool found = false;
-        for (int j = 0; j < series->labelsCount; ++j) {
-            const char *key = RedisModule_StringPtrLen(series->labels[j].key, NULL);
-            if (strcasecmp(key, limitLabels[i]) == 0) {
-                Record *internal_list = RedisGears_ListRecordCreate(series->labelsCount);
-                RedisGears_ListRecordAdd(internal_list,
-                                         RedisGears_RedisStringRecordCreate(series->labels[j].key));
-                RedisGears_ListRecordAdd(
-                    internal_list, RedisGears_RedisStringRecordCreate(series->labels[j].value));
-                RedisGears_ListRecordAdd(r, internal_list);
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            Record *internal_list = RedisGears_ListRecordCreate(series->labelsCount);
+        size_t len;
+        const char *labelKey = RedisModule_StringPtrLen(limitLabels[i], &len);
+        const Label *label = SeriesGetLabel(series, labelKey, len, false);
+        Record *internal_list = RedisGears_ListRecordCreate(series->labelsCount);
+        if (label != NULL) {
+            RedisGears_ListRecordAdd(internal_list, RedisGears_RedisStringRecordCreate(label->key));
             RedisGears_ListRecordAdd(internal_list,
-                                     RedisGears_RedisStringRecordCreate(rLimitLabels[i]));
+                                     RedisGears_RedisStringRecordCreate(label->value));
+        } else {
+            RedisGears_ListRecordAdd(internal_list,
+                                     RedisGears_RedisStringRecordCreate(limitLabels[i]));
             RedisGears_ListRecordAdd(internal_list, RedisGears_GetNullRecord());
-            RedisGears_ListRecordAdd(r, internal_list);
         }
+        RedisGears_ListRecordAdd(r, internal_list);
     }
     return r;
 }
@@ -228,9 +326,7 @@ Record *ShardSeriesMapper(ExecutionCtx *rctx, Record *data, void *arg) {
                             currentKey);
             continue;
         }
-        RedisGears_ListRecordAdd(
-            series_list,
-            SeriesRecord_New(series, predicates->startTimestamp, predicates->endTimestamp));
+        RedisGears_ListRecordAdd(series_list, SeriesRecord_New(series, predicates));
         RedisModule_CloseKey(key);
     }
     RedisModule_DictIteratorStop(iter);
@@ -240,14 +336,118 @@ Record *ShardSeriesMapper(ExecutionCtx *rctx, Record *data, void *arg) {
     return series_list;
 }
 
-Record *ShardMgetMapper(ExecutionCtx *rctx, Record *data, void *arg) {
+// The range of the query on `series`, false when it's empty
+static bool shardRangeArgs(Series *series, const QueryPredicates_Arg *query, RangeArgs *args) {
+    *args = query->rangeArgs;
+    args->startTimestamp = query->grouped
+                               ? query->startTimestamp
+                               : SeriesClampToRetention(series, query->startTimestamp);
+    args->endTimestamp = query->endTimestamp;
+    return args->startTimestamp <= args->endTimestamp;
+}
+
+static GroupRecord *GroupRecord_New(const char *labelValue, size_t labelValueLen) {
+    GroupRecord *out = (GroupRecord *)RedisGears_RecordCreate(GroupRecordType);
+    out->labelValue = RedisModule_CreateString(NULL, labelValue, labelValueLen);
+    out->sources = NULL;
+    out->sourcesCount = 0;
+    out->partials = NULL;
+    out->partialsCount = 0;
+    return out;
+}
+
+static void GroupRecord_AddSeries(GroupRecord *group,
+                                  Series *series,
+                                  const QueryPredicates_Arg *query) {
+    group->sources =
+        realloc(group->sources, (group->sourcesCount + 1) * sizeof(RedisModuleString *));
+    group->sources[group->sourcesCount++] =
+        RedisModule_CreateStringFromString(NULL, series->keyName);
+
+    RangeArgs args;
+    if (!shardRangeArgs(series, query, &args)) {
+        return;
+    }
+    ReducerPartial *partials = NULL;
+    size_t count = 0, capacity = 0;
+    Sample sample;
+    AbstractIterator *iter = SeriesQuery(series, &args, false);
+    while (iter->GetNext(iter, &sample) == CR_OK) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            partials = realloc(partials, capacity * sizeof(ReducerPartial));
+        }
+        ReducerPartial_Init(&partials[count++], &sample, query->reducerOp);
+    }
+    iter->Close(iter);
+    ReducerPartials_Merge(
+        &group->partials, &group->partialsCount, partials, count, query->reducerOp);
+    free(partials);
+}
+
+// Reduce the matched series of the shard into partials of their GROUPBY groups
+Record *ShardGroupMapper(ExecutionCtx *rctx, Record *data, void *arg) {
     RedisModuleCtx *ctx = RedisGears_GetRedisModuleCtx(rctx);
     QueryPredicates_Arg *predicates = arg;
+    const size_t labelKeyLen = strlen(predicates->groupByLabel);
 
-    const char **limitLabelsStr = calloc(predicates->limitLabelsSize, sizeof(char *));
-    for (int i = 0; i < predicates->limitLabelsSize; i++) {
-        limitLabelsStr[i] = RedisModule_StringPtrLen(predicates->limitLabels[i], NULL);
+    RedisModuleDict *result =
+        QueryIndex(ctx, predicates->predicates->list, predicates->predicates->count);
+
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(result, "^", NULL, 0);
+    char *currentKey;
+    size_t currentKeyLen;
+
+    Series *series;
+    RedisModuleDict *groups = RedisModule_CreateDict(ctx);
+    while ((currentKey = RedisModule_DictNextC(iter, &currentKeyLen, NULL)) != NULL) {
+        RedisModuleKey *key;
+        RedisModuleString *keyName = RedisModule_CreateString(ctx, currentKey, currentKeyLen);
+        const int status = SilentGetSeries(ctx, keyName, &key, &series, REDISMODULE_READ);
+        RedisModule_FreeString(ctx, keyName);
+
+        if (!status) {
+            RedisModule_Log(ctx,
+                            "warning",
+                            "couldn't open key or key is not a Timeseries. key=%.*s",
+                            currentKeyLen,
+                            currentKey);
+            continue;
+        }
+        const Label *label =
+            SeriesGetLabel(series, predicates->groupByLabel, labelKeyLen, true);
+        if (label != NULL) {
+            size_t labelValueLen;
+            const char *labelValue = RedisModule_StringPtrLen(label->value, &labelValueLen);
+            GroupRecord *group =
+                RedisModule_DictGetC(groups, (void *)labelValue, labelValueLen, NULL);
+            if (group == NULL) {
+                group = GroupRecord_New(labelValue, labelValueLen);
+                RedisModule_DictSetC(groups, (void *)labelValue, labelValueLen, group);
+            }
+            GroupRecord_AddSeries(group, series, predicates);
+        }
+        RedisModule_CloseKey(key);
     }
+    RedisModule_DictIteratorStop(iter);
+    RedisModule_FreeDict(ctx, result);
+
+    Record *group_list = RedisGears_ListRecordCreate(RedisModule_DictSize(groups));
+    iter = RedisModule_DictIteratorStartC(groups, "^", NULL, 0);
+    GroupRecord *group;
+    while (RedisModule_DictNextC(iter, NULL, (void **)&group) != NULL) {
+        RedisGears_ListRecordAdd(group_list, &group->base);
+    }
+    RedisModule_DictIteratorStop(iter);
+    RedisModule_FreeDict(ctx, groups);
+    RedisGears_FreeRecord(data);
+
+    return group_list;
+}
+
+Record *ShardMgetMapper(ExecutionCtx *rctx, Record *data, void *arg) {
+    RedisModuleCtx *ctx = RedisGears_GetRedisModuleCtx(rctx);
+    QueryPredicates_Arg *predicates = arg;
 
     RedisModuleDict *result =
         QueryIndex(ctx, predicates->predicates->list, predicates->predicates->count);
@@ -283,7 +483,7 @@ Record *ShardMgetMapper(ExecutionCtx *rctx, Record *data, void *arg) {
             RedisGears_ListRecordAdd(
                 key_record,
                 ListSeriesLabelsWithLimit(
-                    series, limitLabelsStr, predicates->limitLabels, predicates->limitLabelsSize));
+                    series, predicates->limitLabels, predicates->limitLabelsSize));
         } else {
             RedisGears_ListRecordAdd(key_record, RedisGears_ListRecordCreate(0));
         }
@@ -295,7 +495,6 @@ Record *ShardMgetMapper(ExecutionCtx *rctx, Record *data, void *arg) {
     RedisModule_DictIteratorStop(iter);
     RedisModule_FreeDict(ctx, result);
     RedisGears_FreeRecord(data);
-    free(limitLabelsStr);
 
     return series_list;
 }
@@ -339,6 +538,14 @@ int register_rg(RedisModuleCtx *ctx) {
                                                          QueryPredicates_ArgDeserialize,
                                                          QueryPredicates_ToString);
 
+    ArgType *MRangeStreamType = RedisGears_CreateType("MRangeStreamType",
+                                                      MRangeStreamVersion,
+                                                      MRangeStream_ObjectFree,
+                                                      MRangeStream_Duplicate,
+                                                      MRangeStream_ArgSerialize,
+                                                      MRangeStream_ArgDeserialize,
+                                                      MRangeStream_ToString);
+
     SeriesRecordType = RedisGears_RecordTypeCreate(SeriesRecordName,
                                                    sizeof(SeriesRecord),
                                                    SeriesRecord_SendReply,
@@ -350,6 +557,22 @@ int register_rg(RedisModuleCtx *ctx) {
         return REDISMODULE_ERR;
     }
 
+    GroupRecordType = RedisGears_RecordTypeCreate(GroupRecordName,
+                                                  sizeof(GroupRecord),
+                                                  GroupRecord_SendReply,
+                                                  (RecordSerialize)GroupRecord_Serialize,
+                                                  (RecordDeserialize)GroupRecord_Deserialize,
+                                                  (RecordFree)GroupRecord_ObjectFree);
+    if (RedisGears_RegisterMap("ShardGroupMapper", ShardGroupMapper, QueryPredicatesType) ==
+        REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisGears_RegisterFilter("MRangeReplyFilter", MRangeReplyFilter, MRangeStreamType) ==
+        REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     if (RedisGears_RegisterMap("ShardMgetMapper", ShardMgetMapper, QueryPredicatesType) ==
         REDISMODULE_ERR) {
         return REDISMODULE_ERR;
@@ -369,39 +592,34 @@ bool IsGearsLoaded() {
     return GearsLoaded;
 }
 
-Record *SeriesRecord_New(Series *series, timestamp_t startTimestamp, timestamp_t endTimestamp) {
+// The record holds the samples of the range query on `series`, after the filters, the aggregation
+// and COUNT, so the coordinator is only left with the cross-series reduction
+Record *SeriesRecord_New(Series *series, const QueryPredicates_Arg *query) {
     SeriesRecord *out = (SeriesRecord *)RedisGears_RecordCreate(SeriesRecordType);
     out->keyName = RedisModule_CreateStringFromString(NULL, series->keyName);
-    if (series->options & SERIES_OPT_UNCOMPRESSED) {
-        out->chunkType = CHUNK_REGULAR;
-    } else {
-        out->chunkType = CHUNK_COMPRESSED;
-    }
-    out->funcs = series->funcs;
+    // the results of an uncompressed series are sent as arrays of samples, copied instead of encoded
+    out->chunkType =
+        (series->options & SERIES_OPT_UNCOMPRESSED) ? CHUNK_REGULAR : CHUNK_COMPRESSED;
+    out->funcs = GetChunkClass(out->chunkType);
     out->labelsCount = series->labelsCount;
     out->labels = calloc(series->labelsCount, sizeof(Label));
     for (int i = 0; i < series->labelsCount; i++) {
         out->labels[i].key = RedisModule_CreateStringFromString(NULL, series->labels[i].key);
         out->labels[i].value = RedisModule_CreateStringFromString(NULL, series->labels[i].value);
     }
-
-    // clone chunks
-    out->chunks = calloc(RedisModule_DictSize(series->chunks), sizeof(Chunk_t *));
-    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(series->chunks, "^", NULL, 0);
-    Chunk_t *chunk = NULL;
-    int index = 0;
-    while (RedisModule_DictNextC(iter, NULL, &chunk)) {
-        if (series->funcs->GetLastTimestamp(chunk) > startTimestamp) {
-            if (series->funcs->GetFirstTimestamp(chunk) > endTimestamp) {
-                break;
-            }
-
-            out->chunks[index] = out->funcs->CloneChunk(chunk);
-            index++;
-        }
+    out->chunks = NULL;
+    out->chunkCount = 0;
+
+    RangeArgs args;
+    if (shardRangeArgs(series, query, &args)) {
+        // COUNT applies to the reduced series of the groups
+        out->chunkCount = SeriesQueryChunks(series,
+                                            &args,
+                                            query->reverse,
+                                            query->grouped ? -1 : args.count,
+                                            out->chunkType,
+                                            &out->chunks);
     }
-    out->chunkCount = index;
-    RedisModule_DictIteratorStop(iter);
     return &out->base;
 }
 
@@ -472,19 +690,87 @@ Series *SeriesRecord_IntoSeries(SeriesRecord *record) {
     createArgs.isTemporary = true;
     createArgs.skipChunkCreation = true;
     Series *s = NewSeries(RedisModule_CreateStringFromString(NULL, record->keyName), &createArgs);
-    s->labelsCount = record->labelsCount;
-    s->labels = calloc(s->labelsCount, sizeof(Label));
-    for (int i = 0; i < s->labelsCount; i++) {
-        s->labels[i].key = RedisModule_CreateStringFromString(NULL, record->labels[i].key);
-        s->labels[i].value = RedisModule_CreateStringFromString(NULL, record->labels[i].value);
-    }
+    SeriesSetLabels(s, record->labels, record->labelsCount);
+    record->labels = NULL;
+    record->labelsCount = 0;
     s->funcs = record->funcs;
 
     for (int chunk_index = 0; chunk_index < record->chunkCount; chunk_index++) {
         dictOperator(s->chunks,
-                     s->funcs->CloneChunk(record->chunks[chunk_index]),
+                     record->chunks[chunk_index],
                      record->funcs->GetFirstTimestamp(record->chunks[chunk_index]),
                      DICT_OP_SET);
     }
+    record->chunkCount = 0;
     return s;
 }
+
+void GroupRecord_ObjectFree(void *record) {
+    GroupRecord *group = record;
+    RedisModule_FreeString(NULL, group->labelValue);
+    for (size_t i = 0; i < group->sourcesCount; i++) {
+        RedisModule_FreeString(NULL, group->sources[i]);
+    }
+    free(group->sources);
+    free(group->partials);
+}
+
+int GroupRecord_Serialize(ExecutionCtx *ctx, Gears_BufferWriter *bw, Record *base) {
+    GroupRecord *group = (GroupRecord *)base;
+    BWWriteRedisString(bw, group->labelValue);
+    RedisGears_BWWriteLong(bw, group->sourcesCount);
+    for (size_t i = 0; i < group->sourcesCount; i++) {
+        BWWriteRedisString(bw, group->sources[i]);
+    }
+    RedisGears_BWWriteLong(bw, group->partialsCount);
+    for (size_t i = 0; i < group->partialsCount; i++) {
+        const ReducerPartial *partial = &group->partials[i];
+        RedisGears_BWWriteLong(bw, partial->timestamp);
+        RedisGears_BWWriteLong(bw, partial->count);
+        BWWriteDouble(bw, partial->value);
+        BWWriteDouble(bw, partial->aux);
+    }
+    return REDISMODULE_OK;
+}
+
+Record *GroupRecord_Deserialize(ExecutionCtx *ctx, Gears_BufferReader *br) {
+    GroupRecord *group = (GroupRecord *)RedisGears_RecordCreate(GroupRecordType);
+    group->labelValue = BRReadRedisString(br);
+    group->sourcesCount = RedisGears_BRReadLong(br);
+    group->sources = calloc(group->sourcesCount, sizeof(RedisModuleString *));
+    for (size_t i = 0; i < group->sourcesCount; i++) {
+        group->sources[i] = BRReadRedisString(br);
+    }
+    group->partialsCount = RedisGears_BRReadLong(br);
+    group->partials = calloc(group->partialsCount, sizeof(ReducerPartial));
+    for (size_t i = 0; i < group->partialsCount; i++) {
+        ReducerPartial *partial = &group->partials[i];
+        partial->timestamp = RedisGears_BRReadLong(br);
+        partial->count = RedisGears_BRReadLong(br);
+        partial->value = BRReadDouble(br);
+        partial->aux = BRReadDouble(br);
+    }
+    return &group->base;
+}
+
+int GroupRecord_SendReply(Record *record, RedisModuleCtx *rctx) {
+    GroupRecord *group = (GroupRecord *)record;
+    RedisModule_ReplyWithArray(rctx, 3);
+    RedisModule_ReplyWithString(rctx, group->labelValue);
+    RedisModule_ReplyWithLongLong(rctx, group->sourcesCount);
+    RedisModule_ReplyWithLongLong(rctx, group->partialsCount);
+    return REDISMODULE_OK;
+}
+
+void GroupRecord_Merge(GroupRecord *dest, GroupRecord *src, MultiSeriesReduceOp reducerOp) {
+    ReducerPartials_Merge(
+        &dest->partials, &dest->partialsCount, src->partials, src->partialsCount, reducerOp);
+    dest->sources = realloc(dest->sources,
+                            (dest->sourcesCount + src->sourcesCount) * sizeof(RedisModuleString *));
+    memcpy(dest->sources + dest->sourcesCount,
+           src->sources,
+           src->sourcesCount * sizeof(RedisModuleString *));
+    dest->sourcesCount += src->sourcesCount;
+    // the sources were moved to `dest`
+    src->sourcesCount = 0;
+}
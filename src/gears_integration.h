@@ -2,7 +2,9 @@
 #include "RedisModulesSDK/redismodule.h"
 #include "generic_chunk.h"
 #include "indexer.h"
+#include "query_language.h"
 #include "redisgears.h"
+#include "resultset.h"
 #include "tsdb.h"
 
 #ifndef REDIS_TIMESERIES_CLEAN_GEARS_INTEGRATION_H
@@ -17,6 +19,14 @@ typedef struct QueryPredicates_Arg
     bool withLabels;
     unsigned short limitLabelsSize;
     RedisModuleString **limitLabels;
+    // TS.MRANGE arguments applied by the shards, which only return the resulting samples
+    TS_AGG_TYPES_T aggType;
+    RangeArgs rangeArgs;
+    bool reverse;
+    bool grouped; // COUNT applies to the reduced series, and the retention doesn't limit the range
+    // set when the shards reduce their series into partials of the GROUPBY groups
+    char *groupByLabel;
+    MultiSeriesReduceOp reducerOp;
 } QueryPredicates_Arg;
 
 typedef struct SeriesRecord
@@ -31,14 +41,40 @@ typedef struct SeriesRecord
     size_t chunkCount;
 } SeriesRecord;
 
+// Identifies the TS.MRANGE reply the records are streamed to, on the shard that runs the query
+typedef struct MRangeStream_Arg
+{
+    long long id;
+} MRangeStream_Arg;
+
+// The partials reduced by a shard from its series of a GROUPBY group
+typedef struct GroupRecord
+{
+    Record base;
+    RedisModuleString *labelValue;
+    RedisModuleString **sources;
+    size_t sourcesCount;
+    ReducerPartial *partials;
+    size_t partialsCount;
+} GroupRecord;
+
 RecordType *GetSeriesRecordType();
-Record *SeriesRecord_New(Series *series, timestamp_t startTimestamp, timestamp_t endTimestamp);
+RecordType *GetGroupRecordType();
+Record *SeriesRecord_New(Series *series, const QueryPredicates_Arg *query);
 void SeriesRecord_ObjectFree(void *series);
 int SeriesRecord_Serialize(ExecutionCtx *ctx, Gears_BufferWriter *bw, Record *base);
 Record *SeriesRecord_Deserialize(ExecutionCtx *ctx, Gears_BufferReader *br);
 int SeriesRecord_SendReply(Record *record, RedisModuleCtx *rctx);
+// The chunks and the labels of the record are moved to the series
 Series *SeriesRecord_IntoSeries(SeriesRecord *record);
 
+void GroupRecord_ObjectFree(void *record);
+int GroupRecord_Serialize(ExecutionCtx *ctx, Gears_BufferWriter *bw, Record *base);
+Record *GroupRecord_Deserialize(ExecutionCtx *ctx, Gears_BufferReader *br);
+int GroupRecord_SendReply(Record *record, RedisModuleCtx *rctx);
+// Merge the partials and the sources of `src`, a record of the same group from another shard
+void GroupRecord_Merge(GroupRecord *dest, GroupRecord *src, MultiSeriesReduceOp reducerOp);
+
 int register_rg(RedisModuleCtx *ctx);
 bool IsGearsLoaded();
 
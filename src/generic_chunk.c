@@ -9,6 +9,7 @@
 static ChunkFuncs regChunk = {
     .NewChunk = Uncompressed_NewChunk,
     .FreeChunk = Uncompressed_FreeChunk,
+    .CloneChunk = Uncompressed_CloneChunk,
     .SplitChunk = Uncompressed_SplitChunk,
 
     .AddSample = Uncompressed_AddSample,
@@ -24,6 +25,9 @@ static ChunkFuncs regChunk = {
 
     .SaveToRDB = Uncompressed_SaveToRDB,
     .LoadFromRDB = Uncompressed_LoadFromRDB,
+    .SaveToBlob = Uncompressed_SaveToBlob,
+    .LoadFromBlob = Uncompressed_LoadFromBlob,
+    .SkipInBlob = Uncompressed_SkipInBlob,
     .GearsSerialize = Uncompressed_GearsSerialize,
     .GearsDeserialize = Uncompressed_GearsDeserialize,
 };
@@ -54,6 +58,9 @@ static ChunkFuncs comprChunk = {
 
     .SaveToRDB = Compressed_SaveToRDB,
     .LoadFromRDB = Compressed_LoadFromRDB,
+    .SaveToBlob = Compressed_SaveToBlob,
+    .LoadFromBlob = Compressed_LoadFromBlob,
+    .SkipInBlob = Compressed_SkipInBlob,
     .GearsSerialize = Compressed_GearsSerialize,
     .GearsDeserialize = Compressed_GearsDeserialize,
 };
@@ -66,6 +73,61 @@ static ChunkIterFuncs compressedChunkIteratorClass = {
     .Reset = Compressed_ResetChunkIterator,
 };
 
+static void blobReserve(ChunkBlob *blob, size_t len) {
+    if (blob->len + len > blob->capacity) {
+        blob->capacity = max(blob->len + len, blob->capacity * 2);
+        blob->data = realloc(blob->data, blob->capacity);
+    }
+}
+
+void ChunkBlob_WriteUnsigned(ChunkBlob *blob, u_int64_t value) {
+    blobReserve(blob, sizeof(value));
+    memcpy(blob->data + blob->len, &value, sizeof(value));
+    blob->len += sizeof(value);
+}
+
+void ChunkBlob_WriteStringBuffer(ChunkBlob *blob, const char *str, size_t len) {
+    ChunkBlob_WriteUnsigned(blob, len);
+    blobReserve(blob, len);
+    memcpy(blob->data + blob->len, str, len);
+    blob->len += len;
+}
+
+u_int64_t ChunkBlob_ReadUnsigned(ChunkBlob *blob) {
+    u_int64_t value = 0;
+    if (blob->error || blob->len - blob->offset < sizeof(value)) {
+        blob->error = true;
+        return 0;
+    }
+    memcpy(&value, blob->data + blob->offset, sizeof(value));
+    blob->offset += sizeof(value);
+    return value;
+}
+
+char *ChunkBlob_ReadStringBuffer(ChunkBlob *blob, size_t *len) {
+    const u_int64_t size = ChunkBlob_ReadUnsigned(blob);
+    if (blob->error || blob->len - blob->offset < size) {
+        blob->error = true;
+        *len = 0;
+        return NULL;
+    }
+    char *str = malloc(size);
+    memcpy(str, blob->data + blob->offset, size);
+    blob->offset += size;
+    *len = size;
+    return str;
+}
+
+size_t ChunkBlob_SkipStringBuffer(ChunkBlob *blob) {
+    const u_int64_t size = ChunkBlob_ReadUnsigned(blob);
+    if (blob->error || blob->len - blob->offset < size) {
+        blob->error = true;
+        return 0;
+    }
+    blob->offset += size;
+    return size;
+}
+
 // This function will decide according to the policy how to handle duplicate sample, the `newSample`
 // will contain the data that will be kept in the database.
 ChunkResult handleDuplicateSample(DuplicatePolicy policy, Sample oldSample, Sample *newSample) {
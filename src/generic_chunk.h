@@ -46,6 +46,31 @@ typedef struct UpsertCtx
     Chunk_t *inChunk; // original chunk
 } UpsertCtx;
 
+/*
+ * Chunks serialized back to back into one buffer, so that all the chunks of a series are saved to
+ * the RDB as a single string. Integers are written in 8 bytes of host order, like the samples in
+ * the chunks data, and a buffer is prefixed by its length.
+ */
+typedef struct ChunkBlob
+{
+    char *data;
+    size_t len; // written bytes, or the size of the data being read
+    size_t capacity;
+    size_t offset; // read position
+    bool error;    // set by a read past the end of the data
+} ChunkBlob;
+
+// upper bound of the serialized fields of a chunk, besides its data
+#define CHUNK_BLOB_HEADER_SIZE 128
+
+void ChunkBlob_WriteUnsigned(ChunkBlob *blob, u_int64_t value);
+void ChunkBlob_WriteStringBuffer(ChunkBlob *blob, const char *str, size_t len);
+u_int64_t ChunkBlob_ReadUnsigned(ChunkBlob *blob);
+// the returned buffer is owned by the caller
+char *ChunkBlob_ReadStringBuffer(ChunkBlob *blob, size_t *len);
+// reads past a buffer and returns its length
+size_t ChunkBlob_SkipStringBuffer(ChunkBlob *blob);
+
 typedef struct ChunkIterFuncs
 {
     void (*Free)(ChunkIter_t *iter);
@@ -76,6 +101,12 @@ typedef struct ChunkFuncs
 
     void (*SaveToRDB)(Chunk_t *chunk, struct RedisModuleIO *io);
     void (*LoadFromRDB)(Chunk_t **chunk, struct RedisModuleIO *io);
+    void (*SaveToBlob)(Chunk_t *chunk, ChunkBlob *blob);
+    // *chunk is NULL when the fields of the chunk don't match its data
+    void (*LoadFromBlob)(Chunk_t **chunk, ChunkBlob *blob);
+    // Reads past a chunk of the blob without decoding it, sets the error of the blob when the
+    // fields of the chunk don't match its data
+    void (*SkipInBlob)(ChunkBlob *blob);
     void (*GearsSerialize)(Chunk_t *chunk, Gears_BufferWriter *bw);
     void (*GearsDeserialize)(Chunk_t **chunk, Gears_BufferReader *br);
 } ChunkFuncs;
@@ -6,13 +6,17 @@
 #include "indexer.h"
 
 #include "consts.h"
+#include "posting_list.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <limits.h>
+#include <regex.h>
+#include <stdint.h>
 #include <string.h>
 #include <rmutil/alloc.h>
 
-RedisModuleDict *labelsIndex;
+RedisModuleDict *labelsIndex; // index key -> PostingList of the ids of the matching series
 
 #define KV_PREFIX "__index_%s=%s"
 #define K_PREFIX "__key_index_%s"
@@ -23,8 +27,30 @@ typedef enum
     Indexer_Remove
 } INDEXER_OPERATION_T;
 
+// Index entry of a series id, the ids of deleted series are reused
+typedef struct IndexedSeries
+{
+    RedisModuleString *keyName; // NULL when the id is free
+    u_int32_t postings;         // number of posting lists holding the id
+    u_int32_t nextFree;
+} IndexedSeries;
+
+static RedisModuleDict *seriesIds; // key name -> series id
+static IndexedSeries *seriesTable;
+static u_int32_t seriesTableSize = 0;
+static u_int32_t seriesTableCapacity = 0;
+static u_int32_t freeSeriesId = UINT32_MAX; // head of the free ids list
+
+// Index statistics, maintained by the index updates
+static RedisModuleDict *labelValuesCount; // label -> number of indexed values of the label
+static u_int64_t labelValuePairs = 0;
+static u_int64_t indexedSeries = 0;
+static size_t indexMemory = 0; // posting lists, index keys and key names
+
 void IndexInit() {
     labelsIndex = RedisModule_CreateDict(NULL);
+    seriesIds = RedisModule_CreateDict(NULL);
+    labelValuesCount = RedisModule_CreateDict(NULL);
 }
 
 void FreeLabels(void *value, size_t labelsCount) {
@@ -116,6 +142,42 @@ int parsePredicate(RedisModuleCtx *ctx,
     return TSDB_OK;
 }
 
+// Compile a regex that has to match the whole label value
+static int compileFullMatchRegex(regex_t *regex, const char *pattern) {
+    size_t len = strlen(pattern);
+    char *anchored = malloc(len + 5);
+    sprintf(anchored, "^(%s)$", pattern);
+    int rc = regcomp(regex, anchored, REG_EXTENDED | REG_NOSUB);
+    free(anchored);
+    return rc == 0 ? TSDB_OK : TSDB_ERROR;
+}
+
+int parseRegexPredicate(const char *label_value_pair,
+                        size_t label_value_pair_size,
+                        size_t operator_pos,
+                        QueryPredicate *retQuery) {
+    // l=~regex or l!~regex, the operator is 2 chars long, the regex is the rest of the filter
+    if (operator_pos == 0 || operator_pos + 2 > label_value_pair_size) {
+        return TSDB_ERROR;
+    }
+    const char *pattern = label_value_pair + operator_pos + 2;
+    size_t pattern_len = label_value_pair_size - operator_pos - 2;
+    RedisModuleString *value = RedisModule_CreateString(NULL, pattern, pattern_len);
+
+    regex_t regex;
+    if (compileFullMatchRegex(&regex, RedisModule_StringPtrLen(value, NULL)) != TSDB_OK) {
+        RedisModule_FreeString(NULL, value);
+        return TSDB_ERROR;
+    }
+    regfree(&regex);
+
+    retQuery->key = RedisModule_CreateString(NULL, label_value_pair, operator_pos);
+    retQuery->valueListCount = 1;
+    retQuery->valuesList = malloc(sizeof(RedisModuleString *));
+    retQuery->valuesList[0] = value;
+    return TSDB_OK;
+}
+
 int CountPredicateType(QueryPredicateList *queries, PredicateType type) {
     int count = 0;
     for (int i = 0; i < queries->count; i++) {
@@ -126,19 +188,275 @@ int CountPredicateType(QueryPredicateList *queries, PredicateType type) {
     return count;
 }
 
-void indexUnderKey(INDEXER_OPERATION_T op, RedisModuleString *key, RedisModuleString *ts_key) {
+static bool lookupSeriesId(RedisModuleString *ts_key, u_int32_t *id) {
     int nokey = 0;
-    RedisModuleDict *leaf = RedisModule_DictGet(labelsIndex, key, &nokey);
+    void *value = RedisModule_DictGet(seriesIds, ts_key, &nokey);
     if (nokey) {
-        leaf = RedisModule_CreateDict(NULL);
-        RedisModule_DictSet(labelsIndex, key, leaf);
+        return false;
+    }
+    *id = (u_int32_t)(uintptr_t)value;
+    return true;
+}
+
+static u_int32_t acquireSeriesId(RedisModuleString *ts_key) {
+    u_int32_t id;
+    if (lookupSeriesId(ts_key, &id)) {
+        return id;
+    }
+
+    if (freeSeriesId != UINT32_MAX) {
+        id = freeSeriesId;
+        freeSeriesId = seriesTable[id].nextFree;
+    } else {
+        if (seriesTableSize == seriesTableCapacity) {
+            seriesTableCapacity = seriesTableCapacity ? seriesTableCapacity * 2 : 1024;
+            seriesTable = realloc(seriesTable, seriesTableCapacity * sizeof(IndexedSeries));
+        }
+        id = seriesTableSize++;
+    }
+    seriesTable[id].keyName = RedisModule_CreateStringFromString(NULL, ts_key);
+    seriesTable[id].postings = 0;
+    RedisModule_DictSet(seriesIds, ts_key, (void *)(uintptr_t)id);
+
+    size_t keyLen;
+    RedisModule_StringPtrLen(ts_key, &keyLen);
+    indexMemory += 2 * keyLen; // the key name and its seriesIds key
+    indexedSeries++;
+    return id;
+}
+
+static void releaseSeriesId(u_int32_t id) {
+    IndexedSeries *entry = &seriesTable[id];
+    size_t keyLen;
+    RedisModule_StringPtrLen(entry->keyName, &keyLen);
+    indexMemory -= 2 * keyLen;
+    indexedSeries--;
+    RedisModule_DictDel(seriesIds, entry->keyName, NULL);
+    RedisModule_FreeString(NULL, entry->keyName);
+    entry->keyName = NULL;
+    entry->nextFree = freeSeriesId;
+    freeSeriesId = id;
+}
+
+/*
+ * Format the index key of a label value (KV_PREFIX), or of the label itself (K_PREFIX) when `value`
+ * is NULL, into a buffer shared by the index updates. Unlike building a RedisModuleString, this
+ * doesn't allocate once the buffer is large enough.
+ */
+static const char *formatIndexKey(const char *label, const char *value, size_t *len) {
+    static char *buffer = NULL;
+    static size_t capacity = 0;
+
+    const size_t labelLen = strlen(label);
+    const size_t valueLen = value ? strlen(value) : 0;
+    const size_t prefixLen = value ? strlen("__index_") : strlen("__key_index_");
+    *len = prefixLen + labelLen + (value ? 1 + valueLen : 0);
+    if (*len + 1 > capacity) {
+        capacity = *len + 1 > capacity * 2 ? *len + 1 : capacity * 2;
+        buffer = realloc(buffer, capacity);
     }
 
+    char *p = buffer;
+    memcpy(p, value ? "__index_" : "__key_index_", prefixLen);
+    p += prefixLen;
+    memcpy(p, label, labelLen);
+    p += labelLen;
+    if (value) {
+        *p++ = '=';
+        memcpy(p, value, valueLen);
+        p += valueLen;
+    }
+    *p = '\0';
+    return buffer;
+}
+
+// Return 1 when the posting list of the key was created, -1 when it was deleted and 0 otherwise
+static int indexUnderKey(INDEXER_OPERATION_T op, const char *key, size_t keyLen, u_int32_t id) {
+    int leaves = 0;
+    int nokey = 0;
+    PostingList *leaf = RedisModule_DictGetC(labelsIndex, (void *)key, keyLen, &nokey);
+    if (nokey) {
+        if (op == Indexer_Remove) {
+            return 0;
+        }
+        leaf = PostingList_New();
+        RedisModule_DictSetC(labelsIndex, (void *)key, keyLen, leaf);
+        indexMemory += keyLen + PostingList_MemUsage(leaf);
+        leaves = 1;
+    }
+
+    indexMemory -= PostingList_MemUsage(leaf);
     if (op == Indexer_Add) {
-        RedisModule_DictSet(leaf, ts_key, NULL);
+        if (PostingList_Add(leaf, id)) {
+            seriesTable[id].postings++;
+        }
     } else if (op == Indexer_Remove) {
-        RedisModule_DictDel(leaf, ts_key, NULL);
+        if (PostingList_Remove(leaf, id)) {
+            seriesTable[id].postings--;
+        }
+        if (PostingList_Cardinality(leaf) == 0) {
+            RedisModule_DictDelC(labelsIndex, (void *)key, keyLen, NULL);
+            PostingList_Free(leaf);
+            indexMemory -= keyLen;
+            return -1;
+        }
+    }
+    indexMemory += PostingList_MemUsage(leaf);
+    return leaves;
+}
+
+// Count the values of a label as their posting lists are created (delta 1) and deleted (delta -1)
+static void updateLabelValues(const char *label, size_t labelLen, int delta) {
+    int nokey = 0;
+    uintptr_t count =
+        (uintptr_t)RedisModule_DictGetC(labelValuesCount, (void *)label, labelLen, &nokey);
+    count += delta;
+    if (count == 0) {
+        RedisModule_DictDelC(labelValuesCount, (void *)label, labelLen, NULL);
+    } else {
+        RedisModule_DictReplaceC(labelValuesCount, (void *)label, labelLen, (void *)count);
     }
+    labelValuePairs += delta;
+}
+
+// Index (or unindex) the series under the label value, and under the label when `withLabel`
+static void indexLabel(INDEXER_OPERATION_T op, const Label *label, u_int32_t id, bool withLabel) {
+    size_t labelLen;
+    const char *key_string = RedisModule_StringPtrLen(label->key, &labelLen);
+    const char *value_string = RedisModule_StringPtrLen(label->value, NULL);
+    size_t len;
+    const char *indexed_key_value = formatIndexKey(key_string, value_string, &len);
+    const int created = indexUnderKey(op, indexed_key_value, len, id);
+    if (created != 0) {
+        updateLabelValues(key_string, labelLen, created);
+    }
+    if (withLabel) {
+        const char *indexed_key = formatIndexKey(key_string, NULL, &len);
+        indexUnderKey(op, indexed_key, len, id);
+    }
+}
+
+typedef struct IndexBulkEntry
+{
+    const char *label;
+    const char *value;
+    u_int32_t id;
+} IndexBulkEntry;
+
+struct IndexBulk
+{
+    IndexBulkEntry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+IndexBulk *IndexBulk_New() {
+    return calloc(1, sizeof(IndexBulk));
+}
+
+void IndexBulk_Add(IndexBulk *bulk, RedisModuleString *ts_key, Label *labels, size_t labels_count) {
+    if (labels_count == 0) {
+        return;
+    }
+    const u_int32_t id = acquireSeriesId(ts_key);
+    if (bulk->count + labels_count > bulk->capacity) {
+        bulk->capacity = max(bulk->count + labels_count, bulk->capacity * 2);
+        bulk->entries = realloc(bulk->entries, bulk->capacity * sizeof(IndexBulkEntry));
+    }
+    for (size_t i = 0; i < labels_count; i++) {
+        IndexBulkEntry *entry = &bulk->entries[bulk->count++];
+        entry->label = RedisModule_StringPtrLen(labels[i].key, NULL);
+        entry->value = RedisModule_StringPtrLen(labels[i].value, NULL);
+        entry->id = id;
+    }
+}
+
+static int compareBulkEntries(const void *a, const void *b) {
+    const IndexBulkEntry *left = a, *right = b;
+    int cmp = strcmp(left->label, right->label);
+    if (cmp == 0) {
+        cmp = strcmp(left->value, right->value);
+    }
+    if (cmp == 0) {
+        cmp = (left->id > right->id) - (left->id < right->id);
+    }
+    return cmp;
+}
+
+static int compareIds(const void *a, const void *b) {
+    const u_int32_t left = *(const u_int32_t *)a, right = *(const u_int32_t *)b;
+    return (left > right) - (left < right);
+}
+
+// Add the ascending `ids` to the posting list of the key, return whether the list was created
+static bool indexIdsUnderKey(const char *key, size_t keyLen, const u_int32_t *ids, size_t count) {
+    int nokey = 0;
+    PostingList *leaf = RedisModule_DictGetC(labelsIndex, (void *)key, keyLen, &nokey);
+    if (nokey) {
+        leaf = PostingList_New();
+        RedisModule_DictSetC(labelsIndex, (void *)key, keyLen, leaf);
+        indexMemory += keyLen + PostingList_MemUsage(leaf);
+    }
+    indexMemory -= PostingList_MemUsage(leaf);
+    for (size_t i = 0; i < count; i++) {
+        if (PostingList_Add(leaf, ids[i])) {
+            seriesTable[ids[i]].postings++;
+        }
+    }
+    indexMemory += PostingList_MemUsage(leaf);
+    return nokey;
+}
+
+void IndexBulk_Build(IndexBulk *bulk) {
+    qsort(bulk->entries, bulk->count, sizeof(IndexBulkEntry), compareBulkEntries);
+
+    u_int32_t *ids = malloc(bulk->count * sizeof(u_int32_t));
+    u_int32_t *labelIds = malloc(bulk->count * sizeof(u_int32_t));
+    size_t labelStart = 0;
+    size_t start = 0;
+    while (start < bulk->count) {
+        const IndexBulkEntry *first = &bulk->entries[start];
+        size_t end = start;
+        size_t idsCount = 0;
+        // a series may repeat a label value
+        for (; end < bulk->count && strcmp(bulk->entries[end].label, first->label) == 0 &&
+               strcmp(bulk->entries[end].value, first->value) == 0;
+             end++) {
+            if (idsCount == 0 || ids[idsCount - 1] != bulk->entries[end].id) {
+                ids[idsCount++] = bulk->entries[end].id;
+            }
+        }
+
+        size_t len;
+        const char *key = formatIndexKey(first->label, first->value, &len);
+        if (indexIdsUnderKey(key, len, ids, idsCount)) {
+            updateLabelValues(first->label, strlen(first->label), 1);
+        }
+
+        // the label is indexed once all its values were
+        if (end == bulk->count || strcmp(bulk->entries[end].label, first->label) != 0) {
+            size_t labelIdsCount = 0;
+            for (size_t i = labelStart; i < end; i++) {
+                labelIds[labelIdsCount++] = bulk->entries[i].id;
+            }
+            qsort(labelIds, labelIdsCount, sizeof(u_int32_t), compareIds);
+            size_t unique = 0;
+            for (size_t i = 0; i < labelIdsCount; i++) {
+                if (unique == 0 || labelIds[unique - 1] != labelIds[i]) {
+                    labelIds[unique++] = labelIds[i];
+                }
+            }
+            key = formatIndexKey(first->label, NULL, &len);
+            indexIdsUnderKey(key, len, labelIds, unique);
+            labelStart = end;
+        }
+        start = end;
+    }
+
+    free(ids);
+    free(labelIds);
+    free(bulk->entries);
+    free(bulk);
 }
 
 void IndexOperation(RedisModuleCtx *ctx,
@@ -146,20 +464,69 @@ void IndexOperation(RedisModuleCtx *ctx,
                     RedisModuleString *ts_key,
                     Label *labels,
                     size_t labels_count) {
-    const char *key_string, *value_string;
+    if (labels_count == 0) {
+        return;
+    }
+    u_int32_t id;
+    if (op == Indexer_Add) {
+        id = acquireSeriesId(ts_key);
+    } else if (!lookupSeriesId(ts_key, &id)) {
+        return;
+    }
+
     for (int i = 0; i < labels_count; i++) {
-        size_t _s;
-        key_string = RedisModule_StringPtrLen(labels[i].key, &_s);
-        value_string = RedisModule_StringPtrLen(labels[i].value, &_s);
-        RedisModuleString *indexed_key_value =
-            RedisModule_CreateStringPrintf(ctx, KV_PREFIX, key_string, value_string);
-        RedisModuleString *indexed_key = RedisModule_CreateStringPrintf(ctx, K_PREFIX, key_string);
+        indexLabel(op, &labels[i], id, true);
+    }
 
-        indexUnderKey(op, indexed_key_value, ts_key);
-        indexUnderKey(op, indexed_key, ts_key);
+    if (seriesTable[id].postings == 0) {
+        releaseSeriesId(id);
+    }
+}
 
-        RedisModule_FreeString(ctx, indexed_key_value);
-        RedisModule_FreeString(ctx, indexed_key);
+// Whether `labels` has the label of `label`, and whether it also has its value
+static void findLabel(const Label *label,
+                      const Label *labels,
+                      size_t labels_count,
+                      bool *hasKey,
+                      bool *hasValue) {
+    *hasKey = *hasValue = false;
+    for (size_t i = 0; i < labels_count && !*hasValue; i++) {
+        if (RedisModule_StringCompare(label->key, labels[i].key) == 0) {
+            *hasKey = true;
+            *hasValue = RedisModule_StringCompare(label->value, labels[i].value) == 0;
+        }
+    }
+}
+
+void ReindexMetric(RedisModuleCtx *ctx,
+                   RedisModuleString *ts_key,
+                   Label *old_labels,
+                   size_t old_labels_count,
+                   Label *new_labels,
+                   size_t new_labels_count) {
+    u_int32_t id;
+    if (!lookupSeriesId(ts_key, &id)) {
+        IndexOperation(ctx, Indexer_Add, ts_key, new_labels, new_labels_count);
+        return;
+    }
+
+    // Only the label values (and labels) that were removed or added are updated
+    bool hasKey, hasValue;
+    for (size_t i = 0; i < old_labels_count; i++) {
+        findLabel(&old_labels[i], new_labels, new_labels_count, &hasKey, &hasValue);
+        if (!hasValue) {
+            indexLabel(Indexer_Remove, &old_labels[i], id, !hasKey);
+        }
+    }
+    for (size_t i = 0; i < new_labels_count; i++) {
+        findLabel(&new_labels[i], old_labels, old_labels_count, &hasKey, &hasValue);
+        if (!hasValue) {
+            indexLabel(Indexer_Add, &new_labels[i], id, !hasKey);
+        }
+    }
+
+    if (seriesTable[id].postings == 0) {
+        releaseSeriesId(id);
     }
 }
 
@@ -177,230 +544,530 @@ void RemoveIndexedMetric(RedisModuleCtx *ctx,
     IndexOperation(ctx, Indexer_Remove, ts_key, labels, labels_count);
 }
 
-void _union(RedisModuleCtx *ctx, RedisModuleDict *dest, RedisModuleDict *src) {
-    /*
-     * Copy all elements from src to dest
-     */
-    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(src, "^", NULL, 0);
-    RedisModuleString *currentKey;
-    while ((currentKey = RedisModule_DictNext(ctx, iter, NULL)) != NULL) {
-        RedisModule_DictSet(dest, currentKey, (void *)1);
-        RedisModule_FreeString(ctx, currentKey);
+/*
+ * Query planning
+ *
+ * The posting lists of every predicate are looked up once, and the sum of their cardinalities is
+ * used as the estimate of the predicate size: it's exact for a single value and an upper bound for
+ * a list of values, without building the union. The matchers are evaluated from the smallest to
+ * the largest, followed by the reducers. Once the result is small enough compared to a predicate,
+ * the predicate is evaluated by probing its posting lists with the ids of the result instead of
+ * combining whole lists. The query stops as soon as the result is empty.
+ */
+
+// a predicate is probed id by id when it's that many times larger than the current result
+#define PROBE_RATIO 4
+
+typedef struct PredicatePlan
+{
+    QueryPredicate *predicate;
+    bool isMatcher; // EQ, CONTAINS, LIST_MATCH or REQ, the others are reducers
+    PostingList **leaves;
+    size_t leavesCount;
+    u_int64_t estimate;
+} PredicatePlan;
+
+static bool isMatcher(PredicateType type) {
+    return type == EQ || type == CONTAINS || type == LIST_MATCH || type == REQ;
+}
+
+static void planAddLeaf(PredicatePlan *plan, PostingList *leaf, size_t *capacity) {
+    if (plan->leavesCount == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 8;
+        plan->leaves = realloc(plan->leaves, *capacity * sizeof(PostingList *));
     }
-    RedisModule_DictIteratorStop(iter);
+    plan->leaves[plan->leavesCount++] = leaf;
+    plan->estimate += PostingList_Cardinality(leaf);
 }
 
-void _intersect(RedisModuleCtx *ctx, RedisModuleDict *left, RedisModuleDict *right) {
-    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(left, "^", NULL, 0);
-    char *currentKey;
-    size_t currentKeyLen;
-    while ((currentKey = RedisModule_DictNextC(iter, &currentKeyLen, NULL)) != NULL) {
-        int doesNotExist = 0;
-        RedisModule_DictGetC(right, currentKey, currentKeyLen, &doesNotExist);
-        if (doesNotExist == 0) {
-            continue;
+/*
+ * Extract the literal prefix every match of the regex starts with, a regex with an alternation has
+ * none. `isPrefixOnly` is set when the rest of the regex is `.*`, any value with the prefix matches.
+ */
+static size_t regexLiteralPrefix(const char *pattern, char *prefix, bool *isPrefixOnly) {
+    size_t n = 0;
+    *isPrefixOnly = false;
+    prefix[0] = '\0';
+    if (strchr(pattern, '|') != NULL) {
+        return 0;
+    }
+
+    const char *p = pattern;
+    if (*p == '^') {
+        p++;
+    }
+    while (*p != '\0') {
+        char literal;
+        size_t step = 1;
+        if (*p == '\\' && p[1] != '\0' && ispunct((unsigned char)p[1])) {
+            literal = p[1];
+            step = 2;
+        } else if (strchr(".[]()*+?{}|^$\\", *p) != NULL) {
+            break;
+        } else {
+            literal = *p;
+        }
+        // an optional or repeated literal ends the prefix, one repeated at least once is kept
+        const char next = p[step];
+        if (next == '*' || next == '?' || next == '{') {
+            break;
+        }
+        prefix[n++] = literal;
+        p += step;
+        if (next == '+') {
+            break;
         }
-        RedisModule_DictDelC(left, currentKey, currentKeyLen, NULL);
-        RedisModule_DictIteratorReseekC(iter, ">", currentKey, currentKeyLen);
     }
-    RedisModule_DictIteratorStop(iter);
+    prefix[n] = '\0';
+    *isPrefixOnly = strcmp(p, ".*") == 0;
+    return n;
 }
 
-void _difference(RedisModuleCtx *ctx, RedisModuleDict *left, RedisModuleDict *right) {
-    if (RedisModule_DictSize(right) == 0) {
-        // the right leaf is empty, this means that the diff is basically no-op since the left will
-        // remain intact.
+/*
+ * The label values are ordered in the index, so only the values starting with the literal prefix
+ * of the regex are scanned. The regex is evaluated once per distinct value, not per series.
+ */
+static void planRegexPredicate(RedisModuleCtx *ctx,
+                               const char *key,
+                               RedisModuleString *patternStr,
+                               PredicatePlan *plan) {
+    const char *pattern = RedisModule_StringPtrLen(patternStr, NULL);
+    size_t capacity = 0;
+    plan->leaves = NULL;
+
+    char *prefix = malloc(strlen(pattern) + 1);
+    bool isPrefixOnly;
+    size_t prefixLen = regexLiteralPrefix(pattern, prefix, &isPrefixOnly);
+    int nokey;
+
+    if (isPrefixOnly && prefixLen == 0) {
+        // .* matches every value of the label
+        RedisModuleString *index_key = RedisModule_CreateStringPrintf(ctx, K_PREFIX, key);
+        PostingList *leaf = RedisModule_DictGet(labelsIndex, index_key, &nokey);
+        RedisModule_FreeString(ctx, index_key);
+        if (leaf != NULL) {
+            planAddLeaf(plan, leaf, &capacity);
+        }
+        free(prefix);
+        return;
+    }
+
+    regex_t regex;
+    if (!isPrefixOnly && compileFullMatchRegex(&regex, pattern) != TSDB_OK) {
+        // validated by the parser
+        free(prefix);
         return;
     }
 
-    // iterating over the left dict (which is always smaller) will allow us to have less data to
-    // iterate over
-    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(left, "^", NULL, 0);
+    RedisModuleString *seek = RedisModule_CreateStringPrintf(ctx, KV_PREFIX, key, prefix);
+    size_t seekLen;
+    const char *seekStr = RedisModule_StringPtrLen(seek, &seekLen);
+    const size_t valueOffset = seekLen - prefixLen;
 
-    char *currentKey;
-    size_t currentKeyLen;
-    while ((currentKey = RedisModule_DictNextC(iter, &currentKeyLen, NULL)) != NULL) {
-        int doesNotExist = 0;
-        RedisModule_DictGetC(right, currentKey, currentKeyLen, &doesNotExist);
-        if (doesNotExist == 1) {
-            continue;
+    RedisModuleDictIter *iter =
+        RedisModule_DictIteratorStartC(labelsIndex, ">=", (void *)seekStr, seekLen);
+    char *indexKey;
+    size_t indexKeyLen;
+    PostingList *leaf;
+    char *value = NULL;
+    size_t valueCapacity = 0;
+    while ((indexKey = RedisModule_DictNextC(iter, &indexKeyLen, (void **)&leaf)) != NULL) {
+        if (indexKeyLen < seekLen || memcmp(indexKey, seekStr, seekLen) != 0) {
+            break;
         }
-        RedisModule_DictDelC(left, currentKey, currentKeyLen, NULL);
-        RedisModule_DictIteratorReseekC(iter, ">", currentKey, currentKeyLen);
+        if (!isPrefixOnly) {
+            const size_t valueLen = indexKeyLen - valueOffset;
+            if (valueLen + 1 > valueCapacity) {
+                valueCapacity = valueLen + 1;
+                value = realloc(value, valueCapacity);
+            }
+            memcpy(value, indexKey + valueOffset, valueLen);
+            value[valueLen] = '\0';
+            if (regexec(&regex, value, 0, NULL, 0) != 0) {
+                continue;
+            }
+        }
+        planAddLeaf(plan, leaf, &capacity);
     }
     RedisModule_DictIteratorStop(iter);
+    RedisModule_FreeString(ctx, seek);
+
+    if (!isPrefixOnly) {
+        regfree(&regex);
+    }
+    free(value);
+    free(prefix);
 }
 
-RedisModuleDict *GetPredicateKeysDict(RedisModuleCtx *ctx,
-                                      QueryPredicate *predicate,
-                                      bool *isCloned) {
-    /*
-     * Return the dictionary of all the keys that match the predicate.
-     */
-    RedisModuleDict *currentLeaf = NULL;
-    *isCloned = false;
-    RedisModuleString *index_key;
+static void planPredicate(RedisModuleCtx *ctx, QueryPredicate *predicate, PredicatePlan *plan) {
     size_t _s;
     const char *key = RedisModule_StringPtrLen(predicate->key, &_s);
-    const char *value;
+    plan->predicate = predicate;
+    plan->isMatcher = isMatcher(predicate->type);
+    plan->leavesCount = 0;
+    plan->estimate = 0;
 
     int nokey;
-
     if (predicate->type == NCONTAINS || predicate->type == CONTAINS) {
-        index_key = RedisModule_CreateStringPrintf(
-            ctx, K_PREFIX, RedisModule_StringPtrLen(predicate->key, &_s));
-        currentLeaf = RedisModule_DictGet(labelsIndex, index_key, &nokey);
+        plan->leaves = malloc(sizeof(PostingList *));
+        RedisModuleString *index_key = RedisModule_CreateStringPrintf(ctx, K_PREFIX, key);
+        PostingList *leaf = RedisModule_DictGet(labelsIndex, index_key, &nokey);
         RedisModule_FreeString(ctx, index_key);
-    } else { // one or more entries
-        RedisModuleDict *singleEntryLeaf;
-        int unioned_count = 0;
-        for (int i = 0; i < predicate->valueListCount; i++) {
-            value = RedisModule_StringPtrLen(predicate->valuesList[i], &_s);
-            index_key = RedisModule_CreateStringPrintf(ctx, KV_PREFIX, key, value);
-            singleEntryLeaf = RedisModule_DictGet(labelsIndex, index_key, &nokey);
-            RedisModule_FreeString(ctx, index_key);
-            if (singleEntryLeaf != NULL) {
-                // if there's only 1 item left to fetch from the index we can just return it
-                if (unioned_count == 0 && predicate->valueListCount - i == 1) {
-                    return singleEntryLeaf;
-                }
-                if (currentLeaf == NULL) {
-                    currentLeaf = RedisModule_CreateDict(ctx);
-                    *isCloned = true;
-                }
-                _union(ctx, currentLeaf, singleEntryLeaf);
-                unioned_count++;
-            }
+        if (leaf != NULL) {
+            plan->leaves[plan->leavesCount++] = leaf;
+            plan->estimate += PostingList_Cardinality(leaf);
         }
+        return;
     }
-    return currentLeaf;
-}
-
-RedisModuleDict *QueryIndexPredicate(RedisModuleCtx *ctx,
-                                     QueryPredicate *predicate,
-                                     RedisModuleDict *prevResults) {
-    RedisModuleDict *localResult = RedisModule_CreateDict(ctx);
-    RedisModuleDict *currentLeaf;
-    bool isCloned;
-    currentLeaf = GetPredicateKeysDict(ctx, predicate, &isCloned);
-
-    if (currentLeaf != NULL) {
-        // Copy everything to new dict only in case this is the first predicate.
-        // In the next iteration, when prevResults is no longer NULL, there is
-        // no need to copy again. We can work on currentLeaf, since only the left dict is being
-        // changed during intersection / difference.
-        if (prevResults == NULL) {
-            RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(currentLeaf, "^", NULL, 0);
-            RedisModuleString *currentKey;
-            while ((currentKey = RedisModule_DictNext(ctx, iter, NULL)) != NULL) {
-                RedisModule_DictSet(localResult, currentKey, (void *)1);
-                RedisModule_FreeString(ctx, currentKey);
-            }
-            RedisModule_DictIteratorStop(iter);
-        } else {
-            RedisModule_FreeDict(ctx, localResult);
-            localResult = currentLeaf;
-        }
-    }
-
-    RedisModuleDict *result = NULL;
-    if (prevResults != NULL) {
-        if (predicate->type == EQ || predicate->type == CONTAINS) {
-            _intersect(ctx, prevResults, localResult);
-        } else if (predicate->type == LIST_MATCH) {
-            _intersect(ctx, prevResults, localResult);
-        } else if (predicate->type == LIST_NOTMATCH) {
-            _difference(ctx, prevResults, localResult);
-        } else if (predicate->type == NCONTAINS) {
-            _difference(ctx, prevResults, localResult);
-        } else if (predicate->type == NEQ) {
-            _difference(ctx, prevResults, localResult);
-        }
-        result = prevResults;
-    } else if (predicate->type == EQ || predicate->type == CONTAINS ||
-               predicate->type == LIST_MATCH) {
-        result = localResult;
-    } else {
-        result = prevResults; // always NULL
+
+    if (predicate->type == REQ || predicate->type == NREQ) {
+        planRegexPredicate(ctx, key, predicate->valuesList[0], plan);
+        return;
     }
 
-    if (result != localResult && localResult != currentLeaf && localResult != NULL) {
-        RedisModule_FreeDict(ctx, localResult);
+    // one or more entries
+    plan->leaves = malloc((predicate->valueListCount ? predicate->valueListCount : 1) *
+                          sizeof(PostingList *));
+    for (int i = 0; i < predicate->valueListCount; i++) {
+        const char *value = RedisModule_StringPtrLen(predicate->valuesList[i], &_s);
+        RedisModuleString *index_key = RedisModule_CreateStringPrintf(ctx, KV_PREFIX, key, value);
+        PostingList *leaf = RedisModule_DictGet(labelsIndex, index_key, &nokey);
+        RedisModule_FreeString(ctx, index_key);
+        if (leaf != NULL) {
+            plan->leaves[plan->leavesCount++] = leaf;
+            plan->estimate += PostingList_Cardinality(leaf);
+        }
+    }
+}
+
+// matchers first, from the smallest, then the reducers from the largest
+static int comparePlans(const void *a, const void *b) {
+    const PredicatePlan *left = a, *right = b;
+    if (left->isMatcher != right->isMatcher) {
+        return left->isMatcher ? -1 : 1;
+    }
+    if (left->estimate == right->estimate) {
+        return 0;
     }
-    if (isCloned && currentLeaf != result) {
-        RedisModule_FreeDict(ctx, currentLeaf);
+    return (left->estimate < right->estimate) == left->isMatcher ? -1 : 1;
+}
+
+// Union of all the posting lists of a predicate with more than one
+static PostingList *planUnion(const PredicatePlan *plan) {
+    PostingList *result = PostingList_Or(plan->leaves[0], plan->leaves[1]);
+    for (size_t i = 2; i < plan->leavesCount; i++) {
+        PostingList *unioned = PostingList_Or(result, plan->leaves[i]);
+        PostingList_Free(result);
+        result = unioned;
     }
     return result;
 }
 
-void PromoteSmallestPredicateToFront(RedisModuleCtx *ctx,
-                                     QueryPredicate *index_predicate,
-                                     size_t predicate_count) {
-    /*
-     * Find the predicate that has the minimal amount of keys that match to it, and move it to the
-     * beginning of the predicate list so we will start our calculation from the smallest predicate.
-     * This is an optimization, so we will copy the smallest dict possible.
-     */
-    if (predicate_count > 1) {
-        int minIndex = 0;
-        unsigned int minDictSize = UINT_MAX;
-        bool isCloned;
-        for (int i = 0; i < predicate_count; i++) {
-            RedisModuleDict *currentPredicateKeys =
-                GetPredicateKeysDict(ctx, &index_predicate[i], &isCloned);
-            int currentDictSize =
-                (currentPredicateKeys != NULL) ? RedisModule_DictSize(currentPredicateKeys) : 0;
-            if (currentDictSize < minDictSize) {
-                minIndex = i;
-                minDictSize = currentDictSize;
-            }
-            if (currentPredicateKeys != NULL && isCloned) {
-                RedisModule_FreeDict(ctx, currentPredicateKeys);
+static bool planContains(const PredicatePlan *plan, u_int32_t id) {
+    for (size_t i = 0; i < plan->leavesCount; i++) {
+        if (PostingList_Contains(plan->leaves[i], id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The ids of `result` that match the predicate, `result` itself when nothing is filtered out
+static const PostingList *applyPlan(const PostingList *result, const PredicatePlan *plan) {
+    if (plan->leavesCount == 0) {
+        // nothing has the label/value: a matcher keeps nothing, a reducer removes nothing
+        return plan->isMatcher ? PostingList_New() : result;
+    }
+
+    if (plan->estimate > PostingList_Cardinality(result) * PROBE_RATIO) {
+        PostingList *filtered = PostingList_New();
+        PostingListIterator iter;
+        PostingListIterator_Init(&iter, result);
+        u_int32_t id;
+        while (PostingListIterator_Next(&iter, &id)) {
+            if (planContains(plan, id) == plan->isMatcher) {
+                PostingList_Add(filtered, id);
             }
         }
+        return filtered;
+    }
 
-        // switch between the minimal predicate and the predicate in the first place
-        if (minIndex != 0) {
-            QueryPredicate temp = index_predicate[minIndex];
-            index_predicate[minIndex] = index_predicate[0];
-            index_predicate[0] = temp;
+    if (plan->isMatcher) {
+        if (plan->leavesCount == 1) {
+            return PostingList_And(result, plan->leaves[0]);
         }
+        PostingList *unioned = planUnion(plan);
+        PostingList *filtered = PostingList_And(result, unioned);
+        PostingList_Free(unioned);
+        return filtered;
     }
+
+    // the difference with a union is the difference with each of its parts
+    PostingList *filtered = PostingList_AndNot(result, plan->leaves[0]);
+    for (size_t i = 1; i < plan->leavesCount; i++) {
+        PostingList *diff = PostingList_AndNot(filtered, plan->leaves[i]);
+        PostingList_Free(filtered);
+        filtered = diff;
+    }
+    return filtered;
 }
+
+/*
+ * Evaluate the query to the posting list of the matching series.
+ * The result may be a leaf of the index, which must not be modified. `owned` is set to the result
+ * when it was computed for the query and has to be freed by the caller.
+ */
+static const PostingList *evaluateQuery(RedisModuleCtx *ctx,
+                                        QueryPredicate *index_predicate,
+                                        size_t predicate_count,
+                                        PostingList **owned) {
+    PredicatePlan *plans = calloc(predicate_count, sizeof(PredicatePlan));
+    for (size_t i = 0; i < predicate_count; i++) {
+        planPredicate(ctx, &index_predicate[i], &plans[i]);
+    }
+    qsort(plans, predicate_count, sizeof(PredicatePlan), comparePlans);
+
+    // The reducers are sorted after the matchers, the result starts from the smallest matcher.
+    // A single posting list is used as is, the intersections then read it without copying it.
+    const PostingList *result = NULL;
+    *owned = NULL;
+    if (predicate_count > 0 && plans[0].isMatcher && plans[0].leavesCount > 0) {
+        if (plans[0].leavesCount == 1) {
+            result = plans[0].leaves[0];
+        } else {
+            *owned = planUnion(&plans[0]);
+            result = *owned;
+        }
+        for (size_t i = 1; i < predicate_count && PostingList_Cardinality(result) > 0; i++) {
+            const PostingList *filtered = applyPlan(result, &plans[i]);
+            if (filtered != result) {
+                PostingList_Free(*owned);
+                *owned = (PostingList *)filtered;
+                result = filtered;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < predicate_count; i++) {
+        free(plans[i].leaves);
+    }
+    free(plans);
+    return result;
+}
+
 RedisModuleDict *QueryIndex(RedisModuleCtx *ctx,
                             QueryPredicate *index_predicate,
                             size_t predicate_count) {
-    RedisModuleDict *result = NULL;
+    PostingList *owned;
+    const PostingList *ids = evaluateQuery(ctx, index_predicate, predicate_count, &owned);
+
+    // Translate the matching series ids to a dict of their key names
+    RedisModuleDict *result = RedisModule_CreateDict(ctx);
+    PostingListIterator iter;
+    PostingListIterator_Init(&iter, ids);
+    u_int32_t id;
+    while (PostingListIterator_Next(&iter, &id)) {
+        RedisModule_DictSet(result, seriesTable[id].keyName, (void *)1);
+    }
+    PostingList_Free(owned);
+    return result;
+}
 
-    PromoteSmallestPredicateToFront(ctx, index_predicate, predicate_count);
+struct QueryIndexResult
+{
+    u_int32_t *ids; // sorted by key name
+    size_t count;
+    size_t position;
+    RedisModuleString *current; // retained key name of the last returned series
+};
 
-    // EQ or Contains
-    for (int i = 0; i < predicate_count; i++) {
-        if (index_predicate[i].type == EQ || index_predicate[i].type == CONTAINS ||
-            index_predicate[i].type == LIST_MATCH) {
-            result = QueryIndexPredicate(ctx, &index_predicate[i], result);
-            if (result == NULL) {
-                return RedisModule_CreateDict(ctx);
-            }
+// same order as the keys of a RedisModuleDict
+static int compareSeriesKeys(const void *a, const void *b) {
+    size_t leftLen, rightLen;
+    const char *left = RedisModule_StringPtrLen(seriesTable[*(u_int32_t *)a].keyName, &leftLen);
+    const char *right = RedisModule_StringPtrLen(seriesTable[*(u_int32_t *)b].keyName, &rightLen);
+    int cmp = memcmp(left, right, leftLen < rightLen ? leftLen : rightLen);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return leftLen < rightLen ? -1 : (leftLen > rightLen);
+}
+
+QueryIndexResult *QueryIndexStart(RedisModuleCtx *ctx,
+                                  QueryPredicate *index_predicate,
+                                  size_t predicate_count) {
+    PostingList *owned;
+    const PostingList *ids = evaluateQuery(ctx, index_predicate, predicate_count, &owned);
+
+    // Only the ids are collected, opening the keys may delete expired series from the index
+    QueryIndexResult *result = calloc(1, sizeof(QueryIndexResult));
+    result->ids = malloc((PostingList_Cardinality(ids) ? PostingList_Cardinality(ids) : 1) *
+                         sizeof(u_int32_t));
+    PostingListIterator iter;
+    PostingListIterator_Init(&iter, ids);
+    u_int32_t id;
+    while (PostingListIterator_Next(&iter, &id)) {
+        result->ids[result->count++] = id;
+    }
+    PostingList_Free(owned);
+
+    qsort(result->ids, result->count, sizeof(u_int32_t), compareSeriesKeys);
+    return result;
+}
+
+size_t QueryIndexResult_Count(const QueryIndexResult *result) {
+    return result->count;
+}
+
+RedisModuleString *QueryIndexResult_Next(QueryIndexResult *result) {
+    if (result->current) {
+        RedisModule_FreeString(NULL, result->current);
+        result->current = NULL;
+    }
+    while (result->position < result->count) {
+        RedisModuleString *keyName = seriesTable[result->ids[result->position++]].keyName;
+        // skip the series removed from the index since the query
+        if (keyName != NULL) {
+            RedisModule_RetainString(NULL, keyName);
+            result->current = keyName;
+            return keyName;
         }
     }
+    return NULL;
+}
 
-    // The next two types of queries are reducers so we run them after the matcher
-    // NCONTAINS or NEQ
-    for (int i = 0; i < predicate_count; i++) {
-        if (index_predicate[i].type == NCONTAINS || index_predicate[i].type == NEQ ||
-            index_predicate[i].type == LIST_NOTMATCH) {
-            result = QueryIndexPredicate(ctx, &index_predicate[i], result);
-            if (result == NULL) {
-                return RedisModule_CreateDict(ctx);
-            }
+void QueryIndexResult_Free(QueryIndexResult *result) {
+    if (result->current) {
+        RedisModule_FreeString(NULL, result->current);
+    }
+    free(result->ids);
+    free(result);
+}
+
+void IndexGetStats(IndexStats *stats) {
+    stats->series = indexedSeries;
+    stats->labels = RedisModule_DictSize(labelValuesCount);
+    stats->labelValues = labelValuePairs;
+    stats->memoryUsage = indexMemory + seriesTableCapacity * sizeof(IndexedSeries);
+}
+
+static u_int64_t labelSeriesCount(const char *label) {
+    size_t len;
+    const char *key = formatIndexKey(label, NULL, &len);
+    int nokey = 0;
+    const PostingList *leaf = RedisModule_DictGetC(labelsIndex, (void *)key, len, &nokey);
+    return nokey ? 0 : PostingList_Cardinality(leaf);
+}
+
+bool IndexGetLabelStats(const char *label, u_int64_t *values, u_int64_t *series) {
+    int nokey = 0;
+    void *count = RedisModule_DictGetC(labelValuesCount, (void *)label, strlen(label), &nokey);
+    if (nokey) {
+        return false;
+    }
+    *values = (uintptr_t)count;
+    *series = labelSeriesCount(label);
+    return true;
+}
+
+// labels are ranked by their number of values, label values by their number of series
+static inline u_int64_t cardinalityWeight(const IndexCardinality *entry) {
+    return entry->values ? entry->values : entry->series;
+}
+
+static int compareCardinality(const IndexCardinality *a, const IndexCardinality *b, size_t bLen) {
+    const u_int64_t aWeight = cardinalityWeight(a), bWeight = cardinalityWeight(b);
+    if (aWeight != bWeight) {
+        return aWeight > bWeight ? -1 : 1;
+    }
+    const int cmp = strncmp(a->name, b->name, bLen);
+    return cmp != 0 ? cmp : (a->name[bLen] != '\0');
+}
+
+/*
+ * Keep the `n` highest ranked entries in `top`, sorted by descending weight and then by name.
+ * `name` doesn't need to be null terminated, it's copied when the entry is kept.
+ */
+static void topInsert(IndexCardinality *top,
+                      size_t *count,
+                      size_t n,
+                      const char *name,
+                      size_t nameLen,
+                      u_int64_t values,
+                      u_int64_t series) {
+    const IndexCardinality entry = { .name = (char *)name, .values = values, .series = series };
+    size_t pos = *count;
+    while (pos > 0 && compareCardinality(&top[pos - 1], &entry, nameLen) > 0) {
+        pos--;
+    }
+    if (pos >= n) {
+        return;
+    }
+    if (*count == n) {
+        free(top[n - 1].name);
+    } else {
+        (*count)++;
+    }
+    memmove(&top[pos + 1], &top[pos], (*count - 1 - pos) * sizeof(IndexCardinality));
+    top[pos] = entry;
+    top[pos].name = malloc(nameLen + 1);
+    memcpy(top[pos].name, name, nameLen);
+    top[pos].name[nameLen] = '\0';
+}
+
+size_t IndexTopLabels(size_t n, IndexCardinality *top) {
+    size_t count = 0;
+    if (n == 0) {
+        return 0;
+    }
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(labelValuesCount, "^", NULL, 0);
+    char *label;
+    size_t labelLen;
+    void *values;
+    while ((label = RedisModule_DictNextC(iter, &labelLen, &values)) != NULL) {
+        topInsert(top, &count, n, label, labelLen, (uintptr_t)values, 0);
+    }
+    RedisModule_DictIteratorStop(iter);
+
+    for (size_t i = 0; i < count; i++) {
+        top[i].series = labelSeriesCount(top[i].name);
+    }
+    return count;
+}
+
+size_t IndexTopLabelValues(const char *label, size_t n, IndexCardinality *top) {
+    size_t count = 0;
+    if (n == 0) {
+        return 0;
+    }
+    size_t prefixLen;
+    const char *prefix = formatIndexKey(label, "", &prefixLen);
+    RedisModuleDictIter *iter =
+        RedisModule_DictIteratorStartC(labelsIndex, ">=", (void *)prefix, prefixLen);
+    char *indexKey;
+    size_t indexKeyLen;
+    const PostingList *leaf;
+    while ((indexKey = RedisModule_DictNextC(iter, &indexKeyLen, (void **)&leaf)) != NULL) {
+        // the shared buffer still holds the prefix, it's only reused by the index updates
+        if (indexKeyLen < prefixLen || memcmp(indexKey, prefix, prefixLen) != 0) {
+            break;
         }
+        topInsert(top,
+                  &count,
+                  n,
+                  indexKey + prefixLen,
+                  indexKeyLen - prefixLen,
+                  0,
+                  PostingList_Cardinality(leaf));
     }
+    RedisModule_DictIteratorStop(iter);
+    return count;
+}
 
-    if (result == NULL) {
-        return RedisModule_CreateDict(ctx);
+void IndexCardinality_Free(IndexCardinality *top, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(top[i].name);
     }
-    return result;
 }
 
 void QueryPredicate_Free(QueryPredicate *predicate_list, size_t count) {
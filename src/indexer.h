@@ -8,6 +8,7 @@
 
 #include "redismodule.h"
 
+#include <stdbool.h>
 #include <sys/types.h>
 
 typedef struct
@@ -26,8 +27,8 @@ typedef enum
     NCONTAINS,
     LIST_MATCH,    // List of matching predicates
     LIST_NOTMATCH, // List of non-matching predicates
-    // REQ,
-    // NREQ
+    REQ,           // Label value matches a regular expression
+    NREQ           // Label value doesn't match a regular expression
 } PredicateType;
 
 typedef struct QueryPredicate
@@ -50,6 +51,10 @@ int parsePredicate(RedisModuleCtx *ctx,
                    size_t label_value_pair_size,
                    QueryPredicate *retQuery,
                    const char *separator);
+int parseRegexPredicate(const char *label_value_pair,
+                        size_t label_value_pair_size,
+                        size_t operator_pos,
+                        QueryPredicate *retQuery);
 void QueryPredicate_Free(QueryPredicate *predicate, size_t count);
 void QueryPredicateList_Free(QueryPredicateList *list);
 
@@ -63,9 +68,71 @@ void RemoveIndexedMetric(RedisModuleCtx *ctx,
                          RedisModuleString *ts_key,
                          Label *labels,
                          size_t labels_count);
+// Move an indexed series from its old labels to the new ones, only the differences are updated
+void ReindexMetric(RedisModuleCtx *ctx,
+                   RedisModuleString *ts_key,
+                   Label *old_labels,
+                   size_t old_labels_count,
+                   Label *new_labels,
+                   size_t new_labels_count);
+
+/*
+ * Index many series at once, like the series loaded from an RDB.
+ * The (label, value, series) entries are collected, sorted, and every posting list is then looked
+ * up once and filled with ascending ids. The keys and labels must stay valid until the build.
+ */
+typedef struct IndexBulk IndexBulk;
+IndexBulk *IndexBulk_New();
+void IndexBulk_Add(IndexBulk *bulk, RedisModuleString *ts_key, Label *labels, size_t labels_count);
+// Index the collected series and free the bulk
+void IndexBulk_Build(IndexBulk *bulk);
+
 RedisModuleDict *QueryIndex(RedisModuleCtx *ctx,
                             QueryPredicate *index_predicate,
                             size_t predicate_count);
 
+/*
+ * The series matching a query, by key name order.
+ * Only the series ids are collected by the query, the key names are resolved while iterating.
+ * The returned key name is valid until the next call.
+ */
+typedef struct QueryIndexResult QueryIndexResult;
+QueryIndexResult *QueryIndexStart(RedisModuleCtx *ctx,
+                                  QueryPredicate *index_predicate,
+                                  size_t predicate_count);
+size_t QueryIndexResult_Count(const QueryIndexResult *result);
+RedisModuleString *QueryIndexResult_Next(QueryIndexResult *result);
+void QueryIndexResult_Free(QueryIndexResult *result);
+
+/*
+ * Index statistics, kept up to date by the index updates.
+ * The memory usage covers the posting lists, the index keys and the indexed key names.
+ */
+#define INDEX_STATS_TOP_DEFAULT 10
+
+typedef struct IndexStats
+{
+    u_int64_t series;
+    u_int64_t labels;
+    u_int64_t labelValues; // distinct label=value pairs
+    size_t memoryUsage;
+} IndexStats;
+
+typedef struct IndexCardinality
+{
+    char *name;       // label, or label value
+    u_int64_t values; // values of a label, 0 for a label value
+    u_int64_t series;
+} IndexCardinality;
+
+void IndexGetStats(IndexStats *stats);
+// return false when no series has the label
+bool IndexGetLabelStats(const char *label, u_int64_t *values, u_int64_t *series);
+// Fill `top` with up to `n` labels with the most values, return the number of entries filled
+size_t IndexTopLabels(size_t n, IndexCardinality *top);
+// Fill `top` with up to `n` values of `label` with the most series
+size_t IndexTopLabelValues(const char *label, size_t n, IndexCardinality *top);
+void IndexCardinality_Free(IndexCardinality *top, size_t count);
+
 int CountPredicateType(QueryPredicateList *queries, PredicateType type);
 #endif
@@ -9,6 +9,7 @@
 #include "module.h"
 
 #include "RedisModulesSDK/redismodule.h"
+#include "cluster.h"
 #include "common.h"
 #include "compaction.h"
 #include "config.h"
@@ -16,16 +17,20 @@
 #include "gears_commands.h"
 #include "gears_integration.h"
 #include "indexer.h"
+#include "parallel_commands.h"
 #include "query_language.h"
 #include "rdb.h"
 #include "redisgears.h"
+#include "replication.h"
 #include "reply.h"
 #include "resultset.h"
+#include "thread_pool.h"
 #include "tsdb.h"
 #include "version.h"
 
 #include <ctype.h>
 #include <limits.h>
+#include <math.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
@@ -146,19 +151,16 @@ int TSDB_info(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 }
 
 void _TSDB_queryindex_impl(RedisModuleCtx *ctx, QueryPredicateList *queries) {
-    RedisModuleDict *result = QueryIndex(ctx, queries->list, queries->count);
+    QueryIndexResult *result = QueryIndexStart(ctx, queries->list, queries->count);
 
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-
-    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(result, "^", NULL, 0);
-    char *currentKey;
-    size_t currentKeyLen;
     long long replylen = 0;
-    while ((currentKey = RedisModule_DictNextC(iter, &currentKeyLen, NULL)) != NULL) {
-        RedisModule_ReplyWithStringBuffer(ctx, currentKey, currentKeyLen);
+    RedisModuleString *keyName;
+    while ((keyName = QueryIndexResult_Next(result)) != NULL) {
+        RedisModule_ReplyWithString(ctx, keyName);
         replylen++;
     }
-    RedisModule_DictIteratorStop(iter);
+    QueryIndexResult_Free(result);
     RedisModule_ReplySetArrayLength(ctx, replylen);
 }
 
@@ -178,7 +180,9 @@ int TSDB_queryindex(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         return RTS_ReplyGeneralError(ctx, "TSDB: failed parsing labels");
     }
 
-    if (CountPredicateType(queries, EQ) + CountPredicateType(queries, LIST_MATCH) == 0) {
+    if (CountPredicateType(queries, EQ) + CountPredicateType(queries, LIST_MATCH) +
+            CountPredicateType(queries, REQ) ==
+        0) {
         QueryPredicateList_Free(queries);
         return RTS_ReplyGeneralError(ctx, "TSDB: please provide at least one matcher");
     }
@@ -186,6 +190,9 @@ int TSDB_queryindex(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (IsGearsLoaded()) {
         TSDB_queryindex_RG(ctx, queries);
         QueryPredicateList_Free(queries);
+    } else if (Cluster_CanFanOut(ctx)) {
+        QueryPredicateList_Free(queries);
+        Cluster_FanOut(ctx, CLUSTER_QUERYINDEX, argv, argc);
     } else {
         _TSDB_queryindex_impl(ctx, queries);
         QueryPredicateList_Free(queries);
@@ -194,6 +201,88 @@ int TSDB_queryindex(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return REDISMODULE_OK;
 }
 
+static void replyIndexCardinality(RedisModuleCtx *ctx,
+                                  const IndexCardinality *top,
+                                  size_t count,
+                                  bool withValues) {
+    RedisModule_ReplyWithArray(ctx, count);
+    for (size_t i = 0; i < count; i++) {
+        RedisModule_ReplyWithArray(ctx, withValues ? 3 : 2);
+        RedisModule_ReplyWithSimpleString(ctx, top[i].name);
+        if (withValues) {
+            RedisModule_ReplyWithLongLong(ctx, top[i].values);
+        }
+        RedisModule_ReplyWithLongLong(ctx, top[i].series);
+    }
+}
+
+// TS.INDEXSTATS [LABEL label] [TOP n]
+int TSDB_indexstats(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    if (argc > 5 || argc % 2 == 0) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleString *label = NULL;
+    long long top = INDEX_STATS_TOP_DEFAULT;
+    for (int i = 1; i < argc; i += 2) {
+        const char *arg = RedisModule_StringPtrLen(argv[i], NULL);
+        if (strcasecmp(arg, "LABEL") == 0 && label == NULL) {
+            label = argv[i + 1];
+        } else if (strcasecmp(arg, "TOP") == 0) {
+            if (RedisModule_StringToLongLong(argv[i + 1], &top) != REDISMODULE_OK || top < 0) {
+                return RTS_ReplyGeneralError(ctx, "TSDB: TOP must be a non-negative integer");
+            }
+        } else {
+            return RTS_ReplyGeneralError(ctx, "TSDB: wrong parameters");
+        }
+    }
+
+    IndexCardinality *entries;
+    size_t count;
+    if (label == NULL) {
+        IndexStats stats;
+        IndexGetStats(&stats);
+        // there are never more entries than labels in the index
+        top = min(top, stats.labels);
+        entries = calloc(top ? top : 1, sizeof(IndexCardinality));
+        count = IndexTopLabels(top, entries);
+
+        RedisModule_ReplyWithArray(ctx, 5 * 2);
+        RedisModule_ReplyWithSimpleString(ctx, "seriesCount");
+        RedisModule_ReplyWithLongLong(ctx, stats.series);
+        RedisModule_ReplyWithSimpleString(ctx, "labelsCount");
+        RedisModule_ReplyWithLongLong(ctx, stats.labels);
+        RedisModule_ReplyWithSimpleString(ctx, "labelValuesCount");
+        RedisModule_ReplyWithLongLong(ctx, stats.labelValues);
+        RedisModule_ReplyWithSimpleString(ctx, "memoryUsage");
+        RedisModule_ReplyWithLongLong(ctx, stats.memoryUsage);
+        RedisModule_ReplyWithSimpleString(ctx, "topLabels");
+        replyIndexCardinality(ctx, entries, count, true);
+    } else {
+        u_int64_t values = 0, series = 0;
+        const char *labelName = RedisModule_StringPtrLen(label, NULL);
+        IndexGetLabelStats(labelName, &values, &series);
+        top = min(top, values);
+        entries = calloc(top ? top : 1, sizeof(IndexCardinality));
+        count = IndexTopLabelValues(labelName, top, entries);
+
+        RedisModule_ReplyWithArray(ctx, 4 * 2);
+        RedisModule_ReplyWithSimpleString(ctx, "label");
+        RedisModule_ReplyWithString(ctx, label);
+        RedisModule_ReplyWithSimpleString(ctx, "valuesCount");
+        RedisModule_ReplyWithLongLong(ctx, values);
+        RedisModule_ReplyWithSimpleString(ctx, "seriesCount");
+        RedisModule_ReplyWithLongLong(ctx, series);
+        RedisModule_ReplyWithSimpleString(ctx, "topValues");
+        replyIndexCardinality(ctx, entries, count, false);
+    }
+    IndexCardinality_Free(entries, count);
+    free(entries);
+    return REDISMODULE_OK;
+}
+
 // multi-series groupby logic
 static int replyGroupedMultiRange(RedisModuleCtx *ctx,
                                   TS_ResultSet *resultset,
@@ -227,7 +316,7 @@ static int replyGroupedMultiRange(RedisModuleCtx *ctx,
 
     // todo: this is duplicated in resultset.c
     // Apply the reducer
-    ResultSet_ApplyReducer(resultset, &args->rangeArgs, args->gropuByReducerOp, args->reverse);
+    ResultSet_ApplyReducer(resultset, &args->rangeArgs, args->gropuByReducerOp);
 
     // Do not apply the aggregation on the resultset, do apply max results on the final result
     RangeArgs minimizedArgs = args->rangeArgs;
@@ -323,7 +412,13 @@ int TSDB_mrange(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (IsGearsLoaded()) {
         return TSDB_mrange_RG(ctx, argv, argc, false);
     }
+    if (Cluster_CanFanOut(ctx)) {
+        return Cluster_FanOut(ctx, CLUSTER_MRANGE, argv, argc);
+    }
 
+    if (ThreadPool_IsEnabled() && CanRunOnWorkers(ctx)) {
+        return TSDB_mrange_parallel(ctx, argv, argc, false);
+    }
     return TSDB_generic_mrange(ctx, argv, argc, false);
 }
 
@@ -331,6 +426,13 @@ int TSDB_mrevrange(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (IsGearsLoaded()) {
         return TSDB_mrange_RG(ctx, argv, argc, true);
     }
+    if (Cluster_CanFanOut(ctx)) {
+        return Cluster_FanOut(ctx, CLUSTER_MREVRANGE, argv, argc);
+    }
+
+    if (ThreadPool_IsEnabled() && CanRunOnWorkers(ctx)) {
+        return TSDB_mrange_parallel(ctx, argv, argc, true);
+    }
     return TSDB_generic_mrange(ctx, argv, argc, true);
 }
 
@@ -399,14 +501,15 @@ static void handleCompaction(RedisModuleCtx *ctx,
         rule->startCurrentTimeBucket = currentTimestamp;
         RedisModule_CloseKey(key);
     }
-    rule->aggClass->appendValue(rule->aggContext, value);
+    rule->aggClass->appendValue(rule->aggContext, value, timestamp);
 }
 
 static int internalAdd(RedisModuleCtx *ctx,
                        Series *series,
                        api_timestamp_t timestamp,
                        double value,
-                       DuplicatePolicy dp_override) {
+                       DuplicatePolicy dp_override,
+                       SeriesEffects *effects) {
     timestamp_t lastTS = series->lastTimestamp;
     uint64_t retention = series->retentionTime;
     // ensure inside retention period.
@@ -421,11 +524,23 @@ static int internalAdd(RedisModuleCtx *ctx,
                                   "TSDB: Error at upsert, update is not supported in BLOCK mode");
             return REDISMODULE_ERR;
         }
+        if (effects != NULL) {
+            SeriesEffects_Upsert(effects, timestamp);
+        }
     } else {
+        Chunk_t *lastChunk = series->lastChunk;
         if (SeriesAddSample(series, timestamp, value) != REDISMODULE_OK) {
             RTS_ReplyGeneralError(ctx, "TSDB: Error at add");
             return REDISMODULE_ERR;
         }
+        if (effects != NULL && lastTS != 0 && timestamp <= lastTS) {
+            // the samples of the series were deleted, but a TS.MADDSERIES batch at or before the
+            // latest timestamp is rejected by the replica
+            SeriesEffects_SetVerbatim(effects);
+        } else if (effects != NULL) {
+            Sample sample = { .timestamp = timestamp, .value = value };
+            SeriesEffects_Append(effects, &sample, series->lastChunk != lastChunk);
+        }
         // handle compaction rules
         CompactionRule *rule = series->rules;
         while (rule != NULL) {
@@ -442,7 +557,8 @@ static inline int add(RedisModuleCtx *ctx,
                       RedisModuleString *timestampStr,
                       RedisModuleString *valueStr,
                       RedisModuleString **argv,
-                      int argc) {
+                      int argc,
+                      ReplicationEffects *effects) {
     RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ | REDISMODULE_WRITE);
     double value;
     const char *valueCStr = RedisModule_StringPtrLen(valueStr, NULL);
@@ -475,6 +591,7 @@ static inline int add(RedisModuleCtx *ctx,
 
         CreateTsKey(ctx, keyName, &cCtx, &series, &key);
         SeriesCreateRulesFromGlobalConfig(ctx, keyName, series, cCtx.labels, cCtx.labelsCount);
+        ReplicationEffects_SetVerbatim(effects);
     } else if (RedisModule_ModuleTypeGetType(key) != SeriesType) {
         return RTS_ReplyGeneralError(ctx, "TSDB: the key is not a TSDB key");
     } else {
@@ -485,7 +602,12 @@ static inline int add(RedisModuleCtx *ctx,
             return REDISMODULE_ERR;
         }
     }
-    int rv = internalAdd(ctx, series, timestamp, value, dp);
+    if (series->rules != NULL) {
+        // the replicas apply the rules themselves
+        ReplicationEffects_SetVerbatim(effects);
+    }
+    SeriesEffects *seriesEffects = ReplicationEffects_Series(effects, keyName, series);
+    int rv = internalAdd(ctx, series, timestamp, value, dp, seriesEffects);
     RedisModule_CloseKey(key);
     return rv;
 }
@@ -497,14 +619,15 @@ int TSDB_madd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         return RedisModule_WrongArity(ctx);
     }
 
+    ReplicationEffects *effects = ReplicationEffects_New();
     RedisModule_ReplyWithArray(ctx, (argc - 1) / 3);
     for (int i = 1; i < argc; i += 3) {
         RedisModuleString *keyName = argv[i];
         RedisModuleString *timestampStr = argv[i + 1];
         RedisModuleString *valueStr = argv[i + 2];
-        add(ctx, keyName, timestampStr, valueStr, NULL, -1);
+        add(ctx, keyName, timestampStr, valueStr, NULL, -1, effects);
     }
-    RedisModule_ReplicateVerbatim(ctx);
+    ReplicationEffects_Replicate(ctx, effects);
 
     for (int i = 1; i < argc; i += 3) {
         RedisModule_NotifyKeyspaceEvent(ctx, REDISMODULE_NOTIFY_MODULE, "ts.add", argv[i]);
@@ -524,14 +647,143 @@ int TSDB_add(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModuleString *timestampStr = argv[2];
     RedisModuleString *valueStr = argv[3];
 
-    int result = add(ctx, keyName, timestampStr, valueStr, argv, argc);
-    RedisModule_ReplicateVerbatim(ctx);
+    ReplicationEffects *effects = ReplicationEffects_New();
+    int result = add(ctx, keyName, timestampStr, valueStr, argv, argc, effects);
+    ReplicationEffects_Replicate(ctx, effects);
 
     RedisModule_NotifyKeyspaceEvent(ctx, REDISMODULE_NOTIFY_MODULE, "ts.add", keyName);
 
     return result;
 }
 
+// TS.MADDSERIES key payload
+// Append the packed samples of `payload`, in the FORMAT BINARY layout, to an existing series
+int TSDB_maddseries(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleString *keyName = argv[1];
+    size_t len;
+    const char *payload = RedisModule_StringPtrLen(argv[2], &len);
+    if (len % BINARY_SAMPLE_SIZE != 0) {
+        return RTS_ReplyGeneralError(ctx, "TSDB: invalid samples payload");
+    }
+    const size_t count = len / BINARY_SAMPLE_SIZE;
+
+    Series *series;
+    RedisModuleKey *key;
+    if (!GetSeries(ctx, keyName, &key, &series, REDISMODULE_READ | REDISMODULE_WRITE)) {
+        return REDISMODULE_ERR;
+    }
+
+    // the whole batch is validated first, so it's either appended entirely or not at all.
+    // The latest timestamp outlives the deletion of the samples, like for TS.ADD a sample at or
+    // before it would be a duplicate to resolve, which a batch doesn't support.
+    bool hasLast = series->totalSamples != 0 || series->lastTimestamp != 0;
+    u_int64_t last = series->lastTimestamp;
+    for (size_t i = 0; i < count; i++) {
+        u_int64_t timestamp;
+        double value;
+        memcpy(&timestamp, payload + i * BINARY_SAMPLE_SIZE, sizeof(timestamp));
+        memcpy(&value, payload + i * BINARY_SAMPLE_SIZE + sizeof(timestamp), sizeof(value));
+        if (timestamp > LLONG_MAX || isnan(value)) {
+            RedisModule_CloseKey(key);
+            return RTS_ReplyGeneralError(ctx, "TSDB: invalid samples payload");
+        }
+        if (hasLast && timestamp <= last) {
+            RedisModule_CloseKey(key);
+            return RTS_ReplyGeneralError(
+                ctx, "TSDB: samples must be newer than the latest sample and in ascending order");
+        }
+        hasLast = true;
+        last = timestamp;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        u_int64_t timestamp;
+        double value;
+        memcpy(&timestamp, payload + i * BINARY_SAMPLE_SIZE, sizeof(timestamp));
+        memcpy(&value, payload + i * BINARY_SAMPLE_SIZE + sizeof(timestamp), sizeof(value));
+        SeriesAddSample(series, timestamp, value);
+        CompactionRule *rule = series->rules;
+        while (rule != NULL) {
+            handleCompaction(ctx, series, rule, timestamp, value);
+            rule = rule->nextRule;
+        }
+    }
+    RedisModule_CloseKey(key);
+
+    RedisModule_ReplyWithLongLong(ctx, count);
+    RedisModule_ReplicateVerbatim(ctx);
+
+    RedisModule_NotifyKeyspaceEvent(ctx, REDISMODULE_NOTIFY_MODULE, "ts.add", keyName);
+
+    return REDISMODULE_OK;
+}
+
+// TS.ADOPTCHUNKS key payload
+// Replace the samples of a series in the ranges of the chunks serialized in `payload`, replicated
+// by a primary in the CHUNKS replication mode. The chunks are only checked against the length of
+// the payload, so the command only runs from the replication stream or from the AOF.
+int TSDB_adoptchunks(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    const int flags = RedisModule_GetContextFlags(ctx);
+    if (!(flags & (REDISMODULE_CTX_FLAGS_REPLICATED | REDISMODULE_CTX_FLAGS_LOADING))) {
+        return RTS_ReplyGeneralError(ctx, "TSDB: TS.ADOPTCHUNKS is only accepted from a primary");
+    }
+
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleString *keyName = argv[1];
+    Series *series;
+    RedisModuleKey *key;
+    if (!GetSeries(ctx, keyName, &key, &series, REDISMODULE_READ | REDISMODULE_WRITE)) {
+        return REDISMODULE_ERR;
+    }
+
+    ChunkBlob blob = { 0 };
+    blob.data = (char *)RedisModule_StringPtrLen(argv[2], &blob.len);
+    const u_int64_t numChunks = ChunkBlob_ReadUnsigned(&blob);
+    // every chunk takes more than a byte of the payload
+    Chunk_t **chunks = blob.error ? NULL : malloc(min(numChunks, blob.len) * sizeof(Chunk_t *));
+    u_int64_t loaded = 0;
+    while (!blob.error && loaded < numChunks) {
+        Chunk_t *chunk = NULL;
+        series->funcs->LoadFromBlob(&chunk, &blob);
+        if (blob.error) {
+            break;
+        }
+        chunks[loaded++] = chunk;
+    }
+    if (blob.error || blob.offset != blob.len) {
+        for (u_int64_t i = 0; i < loaded; i++) {
+            series->funcs->FreeChunk(chunks[i]);
+        }
+        free(chunks);
+        RedisModule_CloseKey(key);
+        return RTS_ReplyGeneralError(ctx, "TSDB: invalid chunks payload");
+    }
+
+    for (u_int64_t i = 0; i < loaded; i++) {
+        SeriesAdoptChunk(series, chunks[i]);
+    }
+    free(chunks);
+    RedisModule_CloseKey(key);
+
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    RedisModule_ReplicateVerbatim(ctx);
+
+    RedisModule_NotifyKeyspaceEvent(ctx, REDISMODULE_NOTIFY_MODULE, "ts.add", keyName);
+
+    return REDISMODULE_OK;
+}
+
 int CreateTsKey(RedisModuleCtx *ctx,
                 RedisModuleString *keyName,
                 CreateCtx *cCtx,
@@ -617,14 +869,10 @@ int TSDB_alter(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     }
 
     if (RMUtil_ArgIndex("LABELS", argv, argc) > 0) {
-        RemoveIndexedMetric(ctx, keyName, series->labels, series->labelsCount);
-        // free current labels
-        FreeLabels(series->labels, series->labelsCount);
-
-        // set new newLabels
-        series->labels = cCtx.labels;
-        series->labelsCount = cCtx.labelsCount;
-        IndexMetric(ctx, keyName, series->labels, series->labelsCount);
+        ReindexMetric(
+            ctx, keyName, series->labels, series->labelsCount, cCtx.labels, cCtx.labelsCount);
+        // free current labels and set the new ones
+        SeriesSetLabels(series, cCtx.labels, cCtx.labelsCount);
     }
     RedisModule_ReplyWithSimpleString(ctx, "OK");
     RedisModule_ReplicateVerbatim(ctx);
@@ -816,7 +1064,7 @@ int TSDB_incrby(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         result -= incrby;
     }
 
-    int rv = internalAdd(ctx, series, currentUpdatedTime, result, DP_LAST);
+    int rv = internalAdd(ctx, series, currentUpdatedTime, result, DP_LAST, NULL);
     RedisModule_ReplicateVerbatim(ctx);
     RedisModule_CloseKey(key);
 
@@ -850,6 +1098,9 @@ int TSDB_mget(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (IsGearsLoaded()) {
         return TSDB_mget_RG(ctx, argv, argc);
     }
+    if (Cluster_CanFanOut(ctx)) {
+        return Cluster_FanOut(ctx, CLUSTER_MGET, argv, argc);
+    }
 
     RedisModule_AutoMemory(ctx);
 
@@ -858,40 +1109,28 @@ int TSDB_mget(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         return REDISMODULE_ERR;
     }
 
-    const char **limitLabelsStr = calloc(args.numLimitLabels, sizeof(char *));
-    for (int i = 0; i < args.numLimitLabels; i++) {
-        limitLabelsStr[i] = RedisModule_StringPtrLen(args.limitLabels[i], NULL);
-    }
-
-    RedisModuleDict *result =
-        QueryIndex(ctx, args.queryPredicates->list, args.queryPredicates->count);
+    QueryIndexResult *result =
+        QueryIndexStart(ctx, args.queryPredicates->list, args.queryPredicates->count);
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(result, "^", NULL, 0);
-    char *currentKey;
-    size_t currentKeyLen;
+    RedisModuleString *keyName;
     long long replylen = 0;
     Series *series;
-    while ((currentKey = RedisModule_DictNextC(iter, &currentKeyLen, NULL)) != NULL) {
+    while ((keyName = QueryIndexResult_Next(result)) != NULL) {
         RedisModuleKey *key;
-        const int status = SilentGetSeries(ctx,
-                                           RedisModule_CreateString(ctx, currentKey, currentKeyLen),
-                                           &key,
-                                           &series,
-                                           REDISMODULE_READ);
+        const int status = SilentGetSeries(ctx, keyName, &key, &series, REDISMODULE_READ);
         if (!status) {
             RedisModule_Log(ctx,
                             "warning",
-                            "couldn't open key or key is not a Timeseries. key=%.*s",
-                            currentKeyLen,
-                            currentKey);
+                            "couldn't open key or key is not a Timeseries. key=%s",
+                            RedisModule_StringPtrLen(keyName, NULL));
             continue;
         }
         RedisModule_ReplyWithArray(ctx, 3);
-        RedisModule_ReplyWithStringBuffer(ctx, currentKey, currentKeyLen);
+        RedisModule_ReplyWithString(ctx, keyName);
         if (args.withLabels) {
             ReplyWithSeriesLabels(ctx, series);
         } else if (args.numLimitLabels > 0) {
-            ReplyWithSeriesLabelsWithLimitC(ctx, series, limitLabelsStr, args.numLimitLabels);
+            ReplyWithSeriesLabelsWithLimit(ctx, series, args.limitLabels, args.numLimitLabels);
         } else {
             RedisModule_ReplyWithArray(ctx, 0);
         }
@@ -900,9 +1139,8 @@ int TSDB_mget(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         RedisModule_CloseKey(key);
     }
     RedisModule_ReplySetArrayLength(ctx, replylen);
-    RedisModule_DictIteratorStop(iter);
+    QueryIndexResult_Free(result);
     MGetArgs_Free(&args);
-    free(limitLabelsStr);
     return REDISMODULE_OK;
 }
 
@@ -963,6 +1201,22 @@ void module_loaded(RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent,
     }
 }
 
+void loading_event(RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent, void *data) {
+    switch (subevent) {
+        // an AOF replays commands while it's loaded, so its series are loaded one by one
+        case REDISMODULE_SUBEVENT_LOADING_RDB_START:
+        case REDISMODULE_SUBEVENT_LOADING_REPL_START:
+            RdbLoad_Begin();
+            break;
+        case REDISMODULE_SUBEVENT_LOADING_ENDED:
+        case REDISMODULE_SUBEVENT_LOADING_FAILED:
+            RdbLoad_End(ctx);
+            break;
+        default:
+            break;
+    }
+}
+
 /*
 module loading function, possible arguments:
 COMPACTION_POLICY - compaction policy from parse_policies,h
@@ -1017,17 +1271,24 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         return REDISMODULE_ERR;
     }
 
+    if (ThreadPool_Init(TSGlobalConfig.workerThreads) != TSDB_OK) {
+        RedisModule_Log(ctx, "warning", "Failed to start the worker threads");
+        return REDISMODULE_ERR;
+    }
+
     // ignore errors from redis gears registration, this can fail if the module is not loaded.
     register_rg(ctx);
 
+    Cluster_Init(ctx);
+
     RedisModuleTypeMethods tm = { .version = REDISMODULE_TYPE_METHOD_VERSION,
                                   .rdb_load = series_rdb_load,
                                   .rdb_save = series_rdb_save,
-                                  .aof_rewrite = RMUtil_DefaultAofRewrite,
+                                  .aof_rewrite = series_aof_rewrite,
                                   .mem_usage = SeriesMemUsage,
                                   .free = FreeSeries };
 
-    SeriesType = RedisModule_CreateDataType(ctx, "TSDB-TYPE", TS_SIZE_RDB_VER, &tm);
+    SeriesType = RedisModule_CreateDataType(ctx, "TSDB-TYPE", TS_LATEST_ENCVER, &tm);
     if (SeriesType == NULL)
         return REDISMODULE_ERR;
     IndexInit();
@@ -1036,6 +1297,8 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "ts.createrule", TSDB_createRule);
     RMUtil_RegisterWriteCmd(ctx, "ts.deleterule", TSDB_deleteRule);
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "ts.add", TSDB_add);
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "ts.maddseries", TSDB_maddseries);
+    RMUtil_RegisterWriteCmd(ctx, "ts.adoptchunks", TSDB_adoptchunks);
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "ts.incrby", TSDB_incrby);
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "ts.decrby", TSDB_incrby);
     RMUtil_RegisterReadCmd(ctx, "ts.range", TSDB_range);
@@ -1045,6 +1308,10 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
+    if (RedisModule_CreateCommand(ctx, "ts.indexstats", TSDB_indexstats, "readonly", 0, 0, 0) ==
+        REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
     RMUtil_RegisterReadCmd(ctx, "ts.info", TSDB_info);
     RMUtil_RegisterReadCmd(ctx, "ts.get", TSDB_get);
     RMUtil_RegisterWriteCmd(ctx, "ts.del", TSDB_delete);
@@ -1068,6 +1335,7 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_GENERIC, NotifyCallback);
 
     RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_ModuleChange, module_loaded);
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_Loading, loading_event);
 
     return REDISMODULE_OK;
 }
@@ -0,0 +1,292 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "parallel_commands.h"
+
+#include "consts.h"
+#include "indexer.h"
+#include "reply.h"
+#include "resultset.h"
+#include "thread_pool.h"
+#include "tsdb.h"
+
+#include "rmutil/alloc.h"
+
+// number of tasks per worker thread, smaller tasks balance better between the workers
+#define TASKS_PER_THREAD 4
+
+/*
+ * A TS.MRANGE executed by the worker threads.
+ *
+ * The matched series are snapshotted on the main thread: the chunks overlapping the range are
+ * cloned into temporary series, so the workers never touch the keyspace. Every worker reduces its
+ * share of the snapshots (filters + aggregation) into uncompressed temporary result series, and
+ * the last one to finish replies to the blocked client.
+ */
+typedef struct MRangeJob
+{
+    RedisModuleBlockedClient *bc;
+    MRangeArgs args;
+    size_t count;
+    Series **snapshots;
+    Series **results;
+    timestamp_t *startTimestamps; // range start of each series after applying its retention
+    size_t pendingTasks;
+} MRangeJob;
+
+typedef struct MRangeTask
+{
+    MRangeJob *job;
+    size_t from;
+    size_t to;
+} MRangeTask;
+
+bool CanRunOnWorkers(RedisModuleCtx *ctx) {
+    int flags = RedisModule_GetContextFlags(ctx);
+    return !(flags & (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA));
+}
+
+static Label *copyLabels(const Label *labels, size_t count) {
+    Label *copy = calloc(count, sizeof(Label));
+    for (size_t i = 0; i < count; i++) {
+        copy[i].key = RedisModule_CreateStringFromString(NULL, labels[i].key);
+        copy[i].value = RedisModule_CreateStringFromString(NULL, labels[i].value);
+    }
+    return copy;
+}
+
+// Clone the chunks of `series` overlapping [start, end] into a temporary series
+static Series *snapshotSeries(Series *series, timestamp_t start, timestamp_t end) {
+    CreateCtx cCtx = {
+        .chunkSizeBytes = series->chunkSizeBytes,
+        .options = series->options,
+        .isTemporary = true,
+        .skipChunkCreation = true,
+    };
+    Series *snapshot = NewSeries(RedisModule_CreateStringFromString(NULL, series->keyName), &cCtx);
+    if (start > end) {
+        return snapshot;
+    }
+
+    timestamp_t rax_key;
+    seriesEncodeTimestamp(&rax_key, start);
+    RedisModuleDictIter *iter =
+        RedisModule_DictIteratorStartC(series->chunks, "<=", &rax_key, sizeof(rax_key));
+    Chunk_t *chunk = NULL;
+    if (!RedisModule_DictNextC(iter, NULL, (void *)&chunk)) {
+        RedisModule_DictIteratorReseekC(iter, "^", NULL, 0);
+        if (!RedisModule_DictNextC(iter, NULL, (void *)&chunk)) {
+            chunk = NULL;
+        }
+    }
+    while (chunk != NULL) {
+        ChunkFuncs *funcs = series->funcs;
+        if (funcs->GetNumOfSample(chunk) > 0) {
+            timestamp_t firstTimestamp = funcs->GetFirstTimestamp(chunk);
+            if (firstTimestamp > end) {
+                break;
+            }
+            dictOperator(snapshot->chunks, funcs->CloneChunk(chunk), firstTimestamp, DICT_OP_SET);
+        }
+        if (!RedisModule_DictNextC(iter, NULL, (void *)&chunk)) {
+            chunk = NULL;
+        }
+    }
+    RedisModule_DictIteratorStop(iter);
+    return snapshot;
+}
+
+static Series *newResultSeries(Series *series) {
+    CreateCtx cCtx = {
+        .labels = copyLabels(series->labels, series->labelsCount),
+        .labelsCount = series->labelsCount,
+        .chunkSizeBytes = Chunk_SIZE_BYTES_SECS,
+        .options = SERIES_OPT_UNCOMPRESSED,
+        .isTemporary = true,
+    };
+    return NewSeries(RedisModule_CreateStringFromString(NULL, series->keyName), &cCtx);
+}
+
+static void MRangeJob_Free(MRangeJob *job) {
+    for (size_t i = 0; i < job->count; i++) {
+        FreeSeries(job->results[i]);
+    }
+    for (unsigned short i = 0; i < job->args.numLimitLabels; i++) {
+        RedisModule_FreeString(NULL, job->args.limitLabels[i]);
+    }
+    free((char *)job->args.groupByLabel);
+    free(job->snapshots);
+    free(job->results);
+    free(job->startTimestamps);
+    free(job);
+}
+
+static void MRangeJob_Reply(RedisModuleCtx *ctx, MRangeJob *job) {
+    // The filters and the aggregation were already applied by the workers
+    RangeArgs minimizedArgs = job->args.rangeArgs;
+    minimizedArgs.startTimestamp = 0;
+    minimizedArgs.endTimestamp = UINT64_MAX;
+    minimizedArgs.aggregationArgs.aggregationClass = NULL;
+    minimizedArgs.aggregationArgs.timeDelta = 0;
+    minimizedArgs.filterByTSArgs.hasValue = false;
+    minimizedArgs.filterByValueArgs.hasValue = false;
+
+    if (job->args.groupByLabel) {
+        TS_ResultSet *resultset = ResultSet_Create();
+        ResultSet_GroupbyLabel(resultset, job->args.groupByLabel);
+        for (size_t i = 0; i < job->count; i++) {
+            ResultSet_AddSerie(
+                resultset, job->results[i], RedisModule_StringPtrLen(job->results[i]->keyName, NULL));
+        }
+
+        RangeArgs reducerArgs = minimizedArgs;
+        ResultSet_ApplyReducer(resultset, &reducerArgs, job->args.gropuByReducerOp);
+        replyResultSet(ctx,
+                       resultset,
+                       job->args.withLabels,
+                       job->args.limitLabels,
+                       job->args.numLimitLabels,
+                       &minimizedArgs,
+                       job->args.reverse);
+        ResultSet_Free(resultset);
+        return;
+    }
+
+    RedisModule_ReplyWithArray(ctx, job->count);
+    for (size_t i = 0; i < job->count; i++) {
+        RangeArgs args = minimizedArgs;
+        ReplySeriesArrayPos(ctx,
+                            job->results[i],
+                            job->args.withLabels,
+                            job->args.limitLabels,
+                            job->args.numLimitLabels,
+                            &args,
+                            job->args.reverse);
+    }
+}
+
+static void MRangeTask_Run(void *arg) {
+    MRangeTask *task = arg;
+    MRangeJob *job = task->job;
+    const RangeArgs *rangeArgs = &job->args.rangeArgs;
+    // COUNT is applied by the reply on the reduced series when grouping, and on the newest
+    // samples when reversed, the workers can only stop early on a forward ungrouped query
+    const bool stopOnCount =
+        rangeArgs->count != -1 && !job->args.reverse && job->args.groupByLabel == NULL;
+
+    for (size_t i = task->from; i < task->to; i++) {
+        Series *result = job->results[i];
+        RangeArgs args = *rangeArgs;
+        args.startTimestamp = job->startTimestamps[i];
+        if (args.startTimestamp <= args.endTimestamp) {
+            Sample sample;
+            long long count = 0;
+            AbstractIterator *iter = SeriesQuery(job->snapshots[i], &args, false);
+            while ((!stopOnCount || count < rangeArgs->count) &&
+                   iter->GetNext(iter, &sample) == CR_OK) {
+                SeriesAddSample(result, sample.timestamp, sample.value);
+                count++;
+            }
+            iter->Close(iter);
+        }
+        FreeSeries(job->snapshots[i]);
+        job->snapshots[i] = NULL;
+    }
+    free(task);
+
+    if (__atomic_sub_fetch(&job->pendingTasks, 1, __ATOMIC_ACQ_REL) == 0) {
+        RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(job->bc);
+        MRangeJob_Reply(rctx, job);
+        RedisModule_UnblockClient(job->bc, NULL);
+        RedisModule_FreeThreadSafeContext(rctx);
+        MRangeJob_Free(job);
+    }
+}
+
+int TSDB_mrange_parallel(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, bool reverse) {
+    RedisModule_AutoMemory(ctx);
+
+    MRangeArgs args;
+    if (parseMRangeCommand(ctx, argv, argc, &args) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+    args.reverse = reverse;
+
+    RedisModuleDict *resultSeries =
+        QueryIndex(ctx, args.queryPredicates->list, args.queryPredicates->count);
+    MRangeArgs_Free(&args);
+    args.queryPredicates = NULL;
+
+    MRangeJob *job = calloc(1, sizeof(MRangeJob));
+    job->args = args;
+    // the arguments must outlive the command, take copies of the ones referencing argv
+    for (unsigned short i = 0; i < args.numLimitLabels; i++) {
+        job->args.limitLabels[i] = RedisModule_CreateStringFromString(NULL, args.limitLabels[i]);
+    }
+    if (args.groupByLabel) {
+        job->args.groupByLabel = strdup(args.groupByLabel);
+    }
+
+    size_t maxCount = RedisModule_DictSize(resultSeries);
+    job->snapshots = calloc(maxCount, sizeof(Series *));
+    job->results = calloc(maxCount, sizeof(Series *));
+    job->startTimestamps = calloc(maxCount, sizeof(timestamp_t));
+
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(resultSeries, "^", NULL, 0);
+    char *currentKey;
+    size_t currentKeyLen;
+    while ((currentKey = RedisModule_DictNextC(iter, &currentKeyLen, NULL)) != NULL &&
+           job->count < maxCount) {
+        RedisModuleKey *key;
+        Series *series;
+        const int status = SilentGetSeries(ctx,
+                                           RedisModule_CreateString(ctx, currentKey, currentKeyLen),
+                                           &key,
+                                           &series,
+                                           REDISMODULE_READ);
+        if (!status) {
+            RedisModule_Log(ctx,
+                            "warning",
+                            "couldn't open key or key is not a Timeseries. key=%.*s",
+                            (int)currentKeyLen,
+                            currentKey);
+            // The iterator may have been invalidated, stop and restart from after the current key.
+            RedisModule_DictIteratorStop(iter);
+            iter = RedisModule_DictIteratorStartC(resultSeries, ">", currentKey, currentKeyLen);
+            continue;
+        }
+        // like the serial path, the retention only limits the ungrouped replies
+        timestamp_t start = args.groupByLabel
+                                ? args.rangeArgs.startTimestamp
+                                : SeriesClampToRetention(series, args.rangeArgs.startTimestamp);
+        job->startTimestamps[job->count] = start;
+        job->snapshots[job->count] = snapshotSeries(series, start, args.rangeArgs.endTimestamp);
+        job->results[job->count] = newResultSeries(series);
+        job->count++;
+        RedisModule_CloseKey(key);
+    }
+    RedisModule_DictIteratorStop(iter);
+
+    if (job->count == 0) {
+        MRangeJob_Reply(ctx, job);
+        MRangeJob_Free(job);
+        return REDISMODULE_OK;
+    }
+
+    size_t numTasks = min(job->count, ThreadPool_NumThreads() * TASKS_PER_THREAD);
+    size_t perTask = (job->count + numTasks - 1) / numTasks;
+    numTasks = (job->count + perTask - 1) / perTask;
+    job->pendingTasks = numTasks;
+    job->bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+
+    for (size_t i = 0; i < numTasks; i++) {
+        MRangeTask *task = malloc(sizeof(MRangeTask));
+        task->job = job;
+        task->from = i * perTask;
+        task->to = min(task->from + perTask, job->count);
+        ThreadPool_AddTask(MRangeTask_Run, task);
+    }
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "query_language.h"
+#include "redismodule.h"
+
+#ifndef REDIS_TIMESERIES_PARALLEL_COMMANDS_H
+#define REDIS_TIMESERIES_PARALLEL_COMMANDS_H
+
+// Whether the command can be executed on the worker threads, blocking is not allowed inside
+// MULTI/EXEC and Lua scripts
+bool CanRunOnWorkers(RedisModuleCtx *ctx);
+
+int TSDB_mrange_parallel(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, bool reverse);
+
+#endif // REDIS_TIMESERIES_PARALLEL_COMMANDS_H
@@ -0,0 +1,525 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "posting_list.h"
+
+#include <string.h>
+#include "rmutil/alloc.h"
+
+#define BITMAP_WORDS 1024 // 65536 bits
+// a bitmap is converted back to an array only well below POSTING_ARRAY_MAX, so alternating
+// additions and removals around the limit don't convert the container back and forth
+#define BITMAP_MIN (POSTING_ARRAY_MAX / 2)
+// an array intersection binary searches the larger array when it's that many times larger
+#define GALLOP_RATIO 8
+
+static inline u_int16_t *arrayOf(const PostingContainer *c) {
+    return (u_int16_t *)c->data;
+}
+
+static inline u_int64_t *wordsOf(const PostingContainer *c) {
+    return (u_int64_t *)c->data;
+}
+
+static inline size_t containerBytes(const PostingContainer *c) {
+    return c->isBitmap ? BITMAP_WORDS * sizeof(u_int64_t) : c->capacity * sizeof(u_int16_t);
+}
+
+static inline bool bitmapTest(const u_int64_t *words, u_int16_t low) {
+    return (words[low >> 6] >> (low & 63)) & 1;
+}
+
+// index of the first value >= low in arr[from, count)
+static u_int32_t arrayLowerBound(const u_int16_t *arr,
+                                 u_int32_t from,
+                                 u_int32_t count,
+                                 u_int16_t low) {
+    u_int32_t hi = count;
+    while (from < hi) {
+        u_int32_t mid = from + (hi - from) / 2;
+        if (arr[mid] < low) {
+            from = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return from;
+}
+
+static void containerInitArray(PostingContainer *c, u_int16_t key, u_int32_t capacity) {
+    c->key = key;
+    c->isBitmap = false;
+    c->cardinality = 0;
+    c->capacity = capacity;
+    c->data = capacity > 0 ? malloc(capacity * sizeof(u_int16_t)) : NULL;
+}
+
+static void containerInitBitmap(PostingContainer *c, u_int16_t key) {
+    c->key = key;
+    c->isBitmap = true;
+    c->cardinality = 0;
+    c->capacity = 0;
+    c->data = calloc(BITMAP_WORDS, sizeof(u_int64_t));
+}
+
+static void containerCopy(PostingContainer *dest, const PostingContainer *src) {
+    *dest = *src;
+    size_t size = src->isBitmap ? BITMAP_WORDS * sizeof(u_int64_t)
+                                : src->cardinality * sizeof(u_int16_t);
+    dest->capacity = src->isBitmap ? 0 : src->cardinality;
+    dest->data = size > 0 ? malloc(size) : NULL;
+    if (size > 0) {
+        memcpy(dest->data, src->data, size);
+    }
+}
+
+static void containerToBitmap(PostingContainer *c) {
+    u_int64_t *words = calloc(BITMAP_WORDS, sizeof(u_int64_t));
+    const u_int16_t *arr = arrayOf(c);
+    for (u_int32_t i = 0; i < c->cardinality; i++) {
+        words[arr[i] >> 6] |= 1ULL << (arr[i] & 63);
+    }
+    free(c->data);
+    c->data = words;
+    c->isBitmap = true;
+    c->capacity = 0;
+}
+
+static void containerToArray(PostingContainer *c) {
+    u_int16_t *arr = malloc((c->cardinality > 0 ? c->cardinality : 1) * sizeof(u_int16_t));
+    const u_int64_t *words = wordsOf(c);
+    u_int32_t n = 0;
+    for (u_int32_t i = 0; i < BITMAP_WORDS; i++) {
+        u_int64_t word = words[i];
+        while (word != 0) {
+            arr[n++] = (u_int16_t)(i * 64 + __builtin_ctzll(word));
+            word &= word - 1;
+        }
+    }
+    free(c->data);
+    c->data = arr;
+    c->isBitmap = false;
+    c->capacity = c->cardinality > 0 ? c->cardinality : 1;
+}
+
+// Set the cardinality of a bitmap built word by word, converting it to an array if sparse
+static void bitmapFinish(PostingContainer *c) {
+    const u_int64_t *words = wordsOf(c);
+    u_int32_t cardinality = 0;
+    for (u_int32_t i = 0; i < BITMAP_WORDS; i++) {
+        cardinality += __builtin_popcountll(words[i]);
+    }
+    c->cardinality = cardinality;
+    if (cardinality <= POSTING_ARRAY_MAX) {
+        containerToArray(c);
+    }
+}
+
+static bool containerContains(const PostingContainer *c, u_int16_t low) {
+    if (c->isBitmap) {
+        return bitmapTest(wordsOf(c), low);
+    }
+    u_int32_t i = arrayLowerBound(arrayOf(c), 0, c->cardinality, low);
+    return i < c->cardinality && arrayOf(c)[i] == low;
+}
+
+static bool containerAdd(PostingContainer *c, u_int16_t low) {
+    if (c->isBitmap) {
+        u_int64_t *word = &wordsOf(c)[low >> 6];
+        const u_int64_t mask = 1ULL << (low & 63);
+        if (*word & mask) {
+            return false;
+        }
+        *word |= mask;
+        c->cardinality++;
+        return true;
+    }
+
+    u_int16_t *arr = arrayOf(c);
+    u_int32_t i = arrayLowerBound(arr, 0, c->cardinality, low);
+    if (i < c->cardinality && arr[i] == low) {
+        return false;
+    }
+    if (c->cardinality == POSTING_ARRAY_MAX) {
+        containerToBitmap(c);
+        return containerAdd(c, low);
+    }
+    if (c->cardinality == c->capacity) {
+        c->capacity = c->capacity < 4 ? 4 : c->capacity * 2;
+        if (c->capacity > POSTING_ARRAY_MAX) {
+            c->capacity = POSTING_ARRAY_MAX;
+        }
+        c->data = realloc(c->data, c->capacity * sizeof(u_int16_t));
+        arr = arrayOf(c);
+    }
+    memmove(arr + i + 1, arr + i, (c->cardinality - i) * sizeof(u_int16_t));
+    arr[i] = low;
+    c->cardinality++;
+    return true;
+}
+
+static bool containerRemove(PostingContainer *c, u_int16_t low) {
+    if (c->isBitmap) {
+        u_int64_t *word = &wordsOf(c)[low >> 6];
+        const u_int64_t mask = 1ULL << (low & 63);
+        if (!(*word & mask)) {
+            return false;
+        }
+        *word &= ~mask;
+        c->cardinality--;
+        if (c->cardinality <= BITMAP_MIN) {
+            containerToArray(c);
+        }
+        return true;
+    }
+
+    u_int16_t *arr = arrayOf(c);
+    u_int32_t i = arrayLowerBound(arr, 0, c->cardinality, low);
+    if (i == c->cardinality || arr[i] != low) {
+        return false;
+    }
+    memmove(arr + i, arr + i + 1, (c->cardinality - i - 1) * sizeof(u_int16_t));
+    c->cardinality--;
+    if (c->cardinality > 0 && c->cardinality < c->capacity / 4) {
+        c->capacity /= 2;
+        c->data = realloc(c->data, c->capacity * sizeof(u_int16_t));
+    }
+    return true;
+}
+
+static void containerAnd(PostingContainer *out,
+                         const PostingContainer *a,
+                         const PostingContainer *b) {
+    if (a->isBitmap && b->isBitmap) {
+        containerInitBitmap(out, a->key);
+        u_int64_t *words = wordsOf(out);
+        for (u_int32_t i = 0; i < BITMAP_WORDS; i++) {
+            words[i] = wordsOf(a)[i] & wordsOf(b)[i];
+        }
+        bitmapFinish(out);
+        return;
+    }
+
+    // probe the larger container with the members of the smaller one
+    const PostingContainer *small = a, *large = b;
+    if (small->isBitmap || (!large->isBitmap && large->cardinality < small->cardinality)) {
+        small = b;
+        large = a;
+    }
+    containerInitArray(out, a->key, small->cardinality);
+    u_int16_t *dest = arrayOf(out);
+    const u_int16_t *src = arrayOf(small);
+
+    if (large->isBitmap) {
+        for (u_int32_t i = 0; i < small->cardinality; i++) {
+            if (bitmapTest(wordsOf(large), src[i])) {
+                dest[out->cardinality++] = src[i];
+            }
+        }
+    } else if (large->cardinality > small->cardinality * GALLOP_RATIO) {
+        const u_int16_t *other = arrayOf(large);
+        u_int32_t j = 0;
+        for (u_int32_t i = 0; i < small->cardinality && j < large->cardinality; i++) {
+            j = arrayLowerBound(other, j, large->cardinality, src[i]);
+            if (j < large->cardinality && other[j] == src[i]) {
+                dest[out->cardinality++] = src[i];
+            }
+        }
+    } else {
+        const u_int16_t *other = arrayOf(large);
+        u_int32_t i = 0, j = 0;
+        while (i < small->cardinality && j < large->cardinality) {
+            if (src[i] < other[j]) {
+                i++;
+            } else if (src[i] > other[j]) {
+                j++;
+            } else {
+                dest[out->cardinality++] = src[i];
+                i++;
+                j++;
+            }
+        }
+    }
+}
+
+static void bitmapOrContainer(u_int64_t *words, const PostingContainer *c) {
+    if (c->isBitmap) {
+        for (u_int32_t i = 0; i < BITMAP_WORDS; i++) {
+            words[i] |= wordsOf(c)[i];
+        }
+        return;
+    }
+    const u_int16_t *arr = arrayOf(c);
+    for (u_int32_t i = 0; i < c->cardinality; i++) {
+        words[arr[i] >> 6] |= 1ULL << (arr[i] & 63);
+    }
+}
+
+static void containerOr(PostingContainer *out,
+                        const PostingContainer *a,
+                        const PostingContainer *b) {
+    if (!a->isBitmap && !b->isBitmap && a->cardinality + b->cardinality <= POSTING_ARRAY_MAX) {
+        containerInitArray(out, a->key, a->cardinality + b->cardinality);
+        u_int16_t *dest = arrayOf(out);
+        const u_int16_t *left = arrayOf(a), *right = arrayOf(b);
+        u_int32_t i = 0, j = 0;
+        while (i < a->cardinality || j < b->cardinality) {
+            if (j == b->cardinality || (i < a->cardinality && left[i] < right[j])) {
+                dest[out->cardinality++] = left[i++];
+            } else if (i == a->cardinality || right[j] < left[i]) {
+                dest[out->cardinality++] = right[j++];
+            } else {
+                dest[out->cardinality++] = left[i];
+                i++;
+                j++;
+            }
+        }
+        return;
+    }
+
+    containerInitBitmap(out, a->key);
+    bitmapOrContainer(wordsOf(out), a);
+    bitmapOrContainer(wordsOf(out), b);
+    bitmapFinish(out);
+}
+
+static void containerAndNot(PostingContainer *out,
+                            const PostingContainer *a,
+                            const PostingContainer *b) {
+    if (a->isBitmap) {
+        containerCopy(out, a);
+        u_int64_t *words = wordsOf(out);
+        if (b->isBitmap) {
+            for (u_int32_t i = 0; i < BITMAP_WORDS; i++) {
+                words[i] &= ~wordsOf(b)[i];
+            }
+        } else {
+            const u_int16_t *arr = arrayOf(b);
+            for (u_int32_t i = 0; i < b->cardinality; i++) {
+                words[arr[i] >> 6] &= ~(1ULL << (arr[i] & 63));
+            }
+        }
+        bitmapFinish(out);
+        return;
+    }
+
+    containerInitArray(out, a->key, a->cardinality);
+    const u_int16_t *src = arrayOf(a);
+    u_int16_t *dest = arrayOf(out);
+    for (u_int32_t i = 0; i < a->cardinality; i++) {
+        if (!containerContains(b, src[i])) {
+            dest[out->cardinality++] = src[i];
+        }
+    }
+}
+
+// index of the container with the given key, or of where it should be inserted
+static u_int32_t listLowerBound(const PostingList *list, u_int16_t key) {
+    u_int32_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        u_int32_t mid = lo + (hi - lo) / 2;
+        if (list->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void listReserve(PostingList *list, u_int32_t count) {
+    if (count > list->capacity) {
+        list->memUsage -= list->capacity * sizeof(PostingContainer);
+        list->capacity = count > list->capacity * 2 ? count : list->capacity * 2;
+        list->containers = realloc(list->containers, list->capacity * sizeof(PostingContainer));
+        list->memUsage += list->capacity * sizeof(PostingContainer);
+    }
+}
+
+// Append a container built by a set operation, empty ones are dropped
+static void listPush(PostingList *list, PostingContainer *c) {
+    if (c->cardinality == 0) {
+        free(c->data);
+        return;
+    }
+    listReserve(list, list->count + 1);
+    list->containers[list->count++] = *c;
+    list->cardinality += c->cardinality;
+    list->memUsage += containerBytes(c);
+}
+
+PostingList *PostingList_New() {
+    PostingList *list = calloc(1, sizeof(PostingList));
+    list->memUsage = sizeof(PostingList);
+    return list;
+}
+
+void PostingList_Free(PostingList *list) {
+    if (list == NULL) {
+        return;
+    }
+    for (u_int32_t i = 0; i < list->count; i++) {
+        free(list->containers[i].data);
+    }
+    free(list->containers);
+    free(list);
+}
+
+PostingList *PostingList_Copy(const PostingList *list) {
+    PostingList *copy = PostingList_New();
+    listReserve(copy, list->count);
+    for (u_int32_t i = 0; i < list->count; i++) {
+        containerCopy(&copy->containers[i], &list->containers[i]);
+        copy->memUsage += containerBytes(&copy->containers[i]);
+    }
+    copy->count = list->count;
+    copy->cardinality = list->cardinality;
+    return copy;
+}
+
+bool PostingList_Add(PostingList *list, u_int32_t id) {
+    const u_int16_t key = id >> 16;
+    u_int32_t i = listLowerBound(list, key);
+    if (i == list->count || list->containers[i].key != key) {
+        listReserve(list, list->count + 1);
+        memmove(&list->containers[i + 1],
+                &list->containers[i],
+                (list->count - i) * sizeof(PostingContainer));
+        containerInitArray(&list->containers[i], key, 0);
+        list->count++;
+    }
+    PostingContainer *c = &list->containers[i];
+    const size_t bytes = containerBytes(c);
+    if (!containerAdd(c, id & 0xFFFF)) {
+        return false;
+    }
+    list->cardinality++;
+    list->memUsage += containerBytes(c) - bytes;
+    return true;
+}
+
+bool PostingList_Remove(PostingList *list, u_int32_t id) {
+    const u_int16_t key = id >> 16;
+    u_int32_t i = listLowerBound(list, key);
+    if (i == list->count || list->containers[i].key != key) {
+        return false;
+    }
+    PostingContainer *c = &list->containers[i];
+    const size_t bytes = containerBytes(c);
+    if (!containerRemove(c, id & 0xFFFF)) {
+        return false;
+    }
+    list->cardinality--;
+    list->memUsage += containerBytes(c) - bytes;
+    if (c->cardinality == 0) {
+        list->memUsage -= containerBytes(c);
+        free(c->data);
+        memmove(&list->containers[i],
+                &list->containers[i + 1],
+                (list->count - i - 1) * sizeof(PostingContainer));
+        list->count--;
+    }
+    return true;
+}
+
+bool PostingList_Contains(const PostingList *list, u_int32_t id) {
+    const u_int16_t key = id >> 16;
+    u_int32_t i = listLowerBound(list, key);
+    return i < list->count && list->containers[i].key == key &&
+           containerContains(&list->containers[i], id & 0xFFFF);
+}
+
+PostingList *PostingList_And(const PostingList *left, const PostingList *right) {
+    PostingList *result = PostingList_New();
+    u_int32_t i = 0, j = 0;
+    while (i < left->count && j < right->count) {
+        const PostingContainer *a = &left->containers[i], *b = &right->containers[j];
+        if (a->key < b->key) {
+            i++;
+        } else if (a->key > b->key) {
+            j++;
+        } else {
+            PostingContainer c;
+            containerAnd(&c, a, b);
+            listPush(result, &c);
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+PostingList *PostingList_Or(const PostingList *left, const PostingList *right) {
+    PostingList *result = PostingList_New();
+    u_int32_t i = 0, j = 0;
+    while (i < left->count || j < right->count) {
+        PostingContainer c;
+        if (j == right->count ||
+            (i < left->count && left->containers[i].key < right->containers[j].key)) {
+            containerCopy(&c, &left->containers[i++]);
+        } else if (i == left->count || right->containers[j].key < left->containers[i].key) {
+            containerCopy(&c, &right->containers[j++]);
+        } else {
+            containerOr(&c, &left->containers[i++], &right->containers[j++]);
+        }
+        listPush(result, &c);
+    }
+    return result;
+}
+
+PostingList *PostingList_AndNot(const PostingList *left, const PostingList *right) {
+    PostingList *result = PostingList_New();
+    u_int32_t j = 0;
+    for (u_int32_t i = 0; i < left->count; i++) {
+        const PostingContainer *a = &left->containers[i];
+        while (j < right->count && right->containers[j].key < a->key) {
+            j++;
+        }
+        PostingContainer c;
+        if (j < right->count && right->containers[j].key == a->key) {
+            containerAndNot(&c, a, &right->containers[j]);
+        } else {
+            containerCopy(&c, a);
+        }
+        listPush(result, &c);
+    }
+    return result;
+}
+
+void PostingListIterator_Init(PostingListIterator *iter, const PostingList *list) {
+    iter->list = list;
+    iter->container = 0;
+    iter->position = 0;
+}
+
+bool PostingListIterator_Next(PostingListIterator *iter, u_int32_t *id) {
+    const PostingList *list = iter->list;
+    while (list != NULL && iter->container < list->count) {
+        const PostingContainer *c = &list->containers[iter->container];
+        const u_int32_t high = (u_int32_t)c->key << 16;
+        if (!c->isBitmap) {
+            if (iter->position < c->cardinality) {
+                *id = high | arrayOf(c)[iter->position++];
+                return true;
+            }
+        } else if (iter->position < BITMAP_WORDS * 64) {
+            const u_int64_t *words = wordsOf(c);
+            u_int32_t w = iter->position >> 6;
+            u_int64_t word = words[w] & (~0ULL << (iter->position & 63));
+            while (word == 0 && ++w < BITMAP_WORDS) {
+                word = words[w];
+            }
+            if (word != 0) {
+                const u_int32_t bit = w * 64 + __builtin_ctzll(word);
+                iter->position = bit + 1;
+                *id = high | bit;
+                return true;
+            }
+        }
+        iter->container++;
+        iter->position = 0;
+    }
+    return false;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+
+#ifndef POSTING_LIST_H
+#define POSTING_LIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Compressed set of 32 bit series ids, laid out like a roaring bitmap.
+ *
+ * The ids are partitioned by their high 16 bits into containers. A container holding at most
+ * POSTING_ARRAY_MAX ids keeps their low 16 bits in a sorted array, a denser one uses a 65536 bit
+ * bitmap (8KB). Set operations work container by container, probing the larger container with the
+ * members of the smaller one.
+ */
+#define POSTING_ARRAY_MAX 4096
+
+typedef struct PostingContainer
+{
+    u_int16_t key; // high 16 bits of the ids
+    bool isBitmap;
+    u_int32_t cardinality;
+    u_int32_t capacity; // of the array, in ids
+    void *data;         // u_int16_t[capacity] or u_int64_t[1024]
+} PostingContainer;
+
+typedef struct PostingList
+{
+    u_int32_t count;
+    u_int32_t capacity;
+    u_int64_t cardinality;
+    size_t memUsage;
+    PostingContainer *containers; // sorted by key
+} PostingList;
+
+typedef struct PostingListIterator
+{
+    const PostingList *list;
+    u_int32_t container;
+    u_int32_t position; // array index or bit index in the current container
+} PostingListIterator;
+
+PostingList *PostingList_New();
+void PostingList_Free(PostingList *list);
+PostingList *PostingList_Copy(const PostingList *list);
+
+// return whether the set changed
+bool PostingList_Add(PostingList *list, u_int32_t id);
+bool PostingList_Remove(PostingList *list, u_int32_t id);
+bool PostingList_Contains(const PostingList *list, u_int32_t id);
+
+static inline u_int64_t PostingList_Cardinality(const PostingList *list) {
+    return list ? list->cardinality : 0;
+}
+
+// The set operations allocate a new list and leave their inputs untouched
+PostingList *PostingList_And(const PostingList *left, const PostingList *right);
+PostingList *PostingList_Or(const PostingList *left, const PostingList *right);
+PostingList *PostingList_AndNot(const PostingList *left, const PostingList *right);
+
+static inline size_t PostingList_MemUsage(const PostingList *list) {
+    return list ? list->memUsage : 0;
+}
+
+void PostingListIterator_Init(PostingListIterator *iter, const PostingList *list);
+// ids are returned in ascending order
+bool PostingListIterator_Next(PostingListIterator *iter, u_int32_t *id);
+
+#endif // POSTING_LIST_H
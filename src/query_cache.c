@@ -0,0 +1,327 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "query_cache.h"
+
+#include "config.h"
+
+#include "rmutil/alloc.h"
+
+#define QUERY_CACHE_INITIAL_CAPACITY 16
+
+static QueryCacheEntry *lruHead = NULL; // most recently used
+static QueryCacheEntry *lruTail = NULL; // least recently used
+static size_t cacheMemory = 0;
+
+typedef enum
+{
+    QC_STAGE_HEAD = 0, // live partial bucket before the first aligned bucket
+    QC_STAGE_CACHED,   // buckets served from the entry
+    QC_STAGE_TAIL,     // live buckets after the cached ones
+} QueryCacheStage;
+
+typedef struct QueryCacheIterator
+{
+    AbstractIterator base;
+    QueryCacheEntry *entry;
+    AbstractIterator *head;
+    AbstractIterator *tail;
+    size_t cachedStart; // [cachedStart, cachedEnd) indexes into entry->buckets
+    size_t cachedEnd;
+    size_t cachedPos;
+    QueryCacheStage stages[3];
+    int currentStage;
+    bool reverse;
+    bool extend;             // tail buckets before `limit` are appended to the entry
+    bool tailDone;           // tail iterator reached its end
+    timestamp_t limit;       // buckets starting before limit are complete and final
+    Sample *pending;         // finalized buckets collected by a reverse tail
+    size_t pendingCount;
+    size_t pendingCapacity;
+} QueryCacheIterator;
+
+static inline size_t entryMemUsage(const QueryCacheEntry *entry) {
+    return sizeof(QueryCacheEntry) + entry->capacity * sizeof(Sample);
+}
+
+static void lruUnlink(QueryCacheEntry *entry) {
+    if (entry->lruPrev) {
+        entry->lruPrev->lruNext = entry->lruNext;
+    } else {
+        lruHead = entry->lruNext;
+    }
+    if (entry->lruNext) {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    } else {
+        lruTail = entry->lruPrev;
+    }
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void lruPushFront(QueryCacheEntry *entry) {
+    entry->lruPrev = NULL;
+    entry->lruNext = lruHead;
+    if (lruHead) {
+        lruHead->lruPrev = entry;
+    }
+    lruHead = entry;
+    if (lruTail == NULL) {
+        lruTail = entry;
+    }
+}
+
+static void entryFree(QueryCacheEntry *entry) {
+    QueryCacheEntry **link = &entry->series->queryCache;
+    while (*link != entry) {
+        link = &(*link)->nextInSeries;
+    }
+    *link = entry->nextInSeries;
+    lruUnlink(entry);
+    cacheMemory -= entryMemUsage(entry);
+    free(entry->buckets);
+    free(entry);
+}
+
+static void entryReset(QueryCacheEntry *entry, timestamp_t from) {
+    entry->from = from;
+    entry->to = from;
+    entry->count = 0;
+}
+
+static void entryAppend(QueryCacheEntry *entry, const Sample *sample) {
+    if (entry->count == entry->capacity) {
+        cacheMemory -= entryMemUsage(entry);
+        entry->capacity = entry->capacity ? entry->capacity * 2 : QUERY_CACHE_INITIAL_CAPACITY;
+        entry->buckets = realloc(entry->buckets, entry->capacity * sizeof(Sample));
+        cacheMemory += entryMemUsage(entry);
+    }
+    entry->buckets[entry->count++] = *sample;
+}
+
+// index of the first bucket with timestamp >= ts
+static size_t entryLowerBound(const QueryCacheEntry *entry, timestamp_t ts) {
+    size_t lo = 0, hi = entry->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entry->buckets[mid].timestamp < ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void evictToBudget(const QueryCacheEntry *keep) {
+    QueryCacheEntry *victim = lruTail;
+    while (cacheMemory > (size_t)TSGlobalConfig.queryCacheMaxMemory && victim != NULL) {
+        QueryCacheEntry *prev = victim->lruPrev;
+        if (victim != keep) {
+            entryFree(victim);
+        }
+        victim = prev;
+    }
+}
+
+static QueryCacheEntry *entryGetOrCreate(Series *series,
+                                         AggregationClass *aggClass,
+                                         timestamp_t timeDelta,
+                                         timestamp_t from) {
+    QueryCacheEntry *entry = series->queryCache;
+    while (entry != NULL) {
+        if (entry->aggClass == aggClass && entry->timeDelta == timeDelta) {
+            lruUnlink(entry);
+            lruPushFront(entry);
+            // only a contiguous range can be extended
+            if (from < entry->from || from > entry->to) {
+                entryReset(entry, from);
+            }
+            return entry;
+        }
+        entry = entry->nextInSeries;
+    }
+
+    entry = calloc(1, sizeof(QueryCacheEntry));
+    entry->series = series;
+    entry->aggClass = aggClass;
+    entry->timeDelta = timeDelta;
+    entryReset(entry, from);
+    entry->nextInSeries = series->queryCache;
+    series->queryCache = entry;
+    lruPushFront(entry);
+    cacheMemory += entryMemUsage(entry);
+    evictToBudget(entry);
+    return entry;
+}
+
+static void pendingAppend(QueryCacheIterator *iter, const Sample *sample) {
+    if (iter->pendingCount == iter->pendingCapacity) {
+        iter->pendingCapacity =
+            iter->pendingCapacity ? iter->pendingCapacity * 2 : QUERY_CACHE_INITIAL_CAPACITY;
+        iter->pending = realloc(iter->pending, iter->pendingCapacity * sizeof(Sample));
+    }
+    iter->pending[iter->pendingCount++] = *sample;
+}
+
+static ChunkResult QueryCacheIterator_GetNext(struct AbstractIterator *base, Sample *sample) {
+    QueryCacheIterator *self = (QueryCacheIterator *)base;
+    while (self->currentStage < 3) {
+        switch (self->stages[self->currentStage]) {
+            case QC_STAGE_HEAD:
+                if (self->head && self->head->GetNext(self->head, sample) == CR_OK) {
+                    return CR_OK;
+                }
+                break;
+            case QC_STAGE_CACHED:
+                if (self->cachedPos < self->cachedEnd - self->cachedStart) {
+                    size_t i = self->reverse ? self->cachedEnd - 1 - self->cachedPos
+                                             : self->cachedStart + self->cachedPos;
+                    self->cachedPos++;
+                    *sample = self->entry->buckets[i];
+                    return CR_OK;
+                }
+                break;
+            case QC_STAGE_TAIL:
+                if (self->tail && self->tail->GetNext(self->tail, sample) == CR_OK) {
+                    if (self->extend && sample->timestamp < self->limit) {
+                        if (self->reverse) {
+                            pendingAppend(self, sample);
+                        } else {
+                            entryAppend(self->entry, sample);
+                            self->entry->to = sample->timestamp + self->entry->timeDelta;
+                        }
+                    }
+                    return CR_OK;
+                }
+                self->tailDone = true;
+                break;
+            default:
+                break;
+        }
+        self->currentStage++;
+    }
+    return CR_END;
+}
+
+static void QueryCacheIterator_Close(struct AbstractIterator *base) {
+    QueryCacheIterator *self = (QueryCacheIterator *)base;
+    QueryCacheEntry *entry = self->entry;
+    if (self->head) {
+        self->head->Close(self->head);
+    }
+    if (self->tail) {
+        self->tail->Close(self->tail);
+    }
+
+    // A reverse tail is only known to cover [entry->to, limit) once it was fully consumed
+    if (self->extend && self->tailDone) {
+        while (self->pendingCount > 0) {
+            entryAppend(entry, &self->pending[--self->pendingCount]);
+        }
+        entry->to = max(entry->to, self->limit);
+    }
+    free(self->pending);
+
+    evictToBudget(NULL);
+    free(self);
+}
+
+static bool isCacheable(const Series *series, const RangeArgs *args) {
+    return TSGlobalConfig.queryCacheMaxMemory > 0 && !series->isTemporary &&
+           series->totalSamples > 0 && args->aggregationArgs.aggregationClass != NULL &&
+           args->aggregationArgs.alignment == 0 &&
+           args->aggregationArgs.emptyFill == EmptyBucketFill_None &&
+           !args->filterByValueArgs.hasValue && !args->filterByTSArgs.hasValue;
+}
+
+AbstractIterator *QueryCache_SeriesQuery(Series *series, RangeArgs *args, bool reverse) {
+    if (!isCacheable(series, args)) {
+        return SeriesQuery(series, args, reverse);
+    }
+
+    const timestamp_t delta = args->aggregationArgs.timeDelta;
+    const timestamp_t start = args->startTimestamp;
+    const timestamp_t end = min(args->endTimestamp, series->lastTimestamp);
+
+    // first bucket fully inside the range
+    const timestamp_t alignedStart = start % delta == 0 ? start : start - start % delta + delta;
+    // buckets before the bucket of the last sample can't change by appending samples, and
+    // buckets before (end + 1) are fully inside the range
+    const timestamp_t lastBucket = CalcWindowStart(series->lastTimestamp, delta);
+    const timestamp_t limit = min(lastBucket, CalcWindowStart(end + 1, delta));
+    if (start > end || alignedStart >= limit) {
+        return SeriesQuery(series, args, reverse);
+    }
+
+    QueryCacheIterator *iter = calloc(1, sizeof(QueryCacheIterator));
+    iter->base.GetNext = QueryCacheIterator_GetNext;
+    iter->base.Close = QueryCacheIterator_Close;
+    iter->base.input = NULL;
+    iter->reverse = reverse;
+    iter->limit = limit;
+
+    QueryCacheEntry *entry = entryGetOrCreate(
+        series, args->aggregationArgs.aggregationClass, delta, alignedStart);
+    iter->entry = entry;
+
+    const timestamp_t cachedTo = min(entry->to, limit);
+    iter->cachedStart = entryLowerBound(entry, alignedStart);
+    iter->cachedEnd = entryLowerBound(entry, cachedTo);
+    iter->cachedPos = 0;
+    iter->extend = (entry->to <= limit);
+
+    RangeArgs liveArgs = *args;
+    if (start < alignedStart) {
+        liveArgs.startTimestamp = start;
+        liveArgs.endTimestamp = alignedStart - 1;
+        iter->head = SeriesQuery(series, &liveArgs, reverse);
+    }
+    if (cachedTo <= args->endTimestamp) {
+        liveArgs.startTimestamp = cachedTo;
+        liveArgs.endTimestamp = args->endTimestamp;
+        iter->tail = SeriesQuery(series, &liveArgs, reverse);
+    } else {
+        iter->tailDone = true;
+    }
+
+    if (reverse) {
+        iter->stages[0] = QC_STAGE_TAIL;
+        iter->stages[1] = QC_STAGE_CACHED;
+        iter->stages[2] = QC_STAGE_HEAD;
+    } else {
+        iter->stages[0] = QC_STAGE_HEAD;
+        iter->stages[1] = QC_STAGE_CACHED;
+        iter->stages[2] = QC_STAGE_TAIL;
+    }
+    iter->currentStage = 0;
+
+    return (AbstractIterator *)iter;
+}
+
+void QueryCache_InvalidateFrom(Series *series, timestamp_t timestamp) {
+    QueryCacheEntry *entry = series->queryCache;
+    while (entry != NULL) {
+        const timestamp_t bucket = CalcWindowStart(timestamp, entry->timeDelta);
+        if (bucket < entry->to) {
+            if (bucket <= entry->from) {
+                entryReset(entry, entry->from);
+            } else {
+                entry->count = entryLowerBound(entry, bucket);
+                entry->to = bucket;
+            }
+        }
+        entry = entry->nextInSeries;
+    }
+}
+
+void QueryCache_FreeSeriesEntries(Series *series) {
+    while (series->queryCache != NULL) {
+        entryFree(series->queryCache);
+    }
+}
+
+size_t QueryCache_MemUsage() {
+    return cacheMemory;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "abstract_iterator.h"
+#include "query_language.h"
+#include "tsdb.h"
+
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+/*
+ * Aggregated range results cache.
+ *
+ * Every series keeps a list of entries, one per (aggregation, time bucket) pair that was
+ * queried. An entry holds the finalized buckets of a contiguous range [from, to), that is
+ * buckets that were fully covered by a query and that end before the bucket of the last
+ * sample of the series. Appending new samples never modifies such buckets, any other write
+ * truncates the entries from the bucket of the written timestamp onwards.
+ *
+ * All the entries share a single LRU list bounded by TSGlobalConfig.queryCacheMaxMemory.
+ */
+typedef struct QueryCacheEntry
+{
+    Series *series;
+    AggregationClass *aggClass;
+    timestamp_t timeDelta;
+    timestamp_t from;
+    timestamp_t to;
+    Sample *buckets; // non-empty buckets in [from, to) ordered by timestamp
+    size_t count;
+    size_t capacity;
+    struct QueryCacheEntry *nextInSeries;
+    struct QueryCacheEntry *lruPrev;
+    struct QueryCacheEntry *lruNext;
+} QueryCacheEntry;
+
+// Same as SeriesQuery, serving the finalized buckets of aggregated queries from the cache
+AbstractIterator *QueryCache_SeriesQuery(Series *series, RangeArgs *args, bool reverse);
+
+// Drop the cached buckets of the series from the bucket of `timestamp` onwards
+void QueryCache_InvalidateFrom(Series *series, timestamp_t timestamp);
+
+void QueryCache_FreeSeriesEntries(Series *series);
+
+size_t QueryCache_MemUsage();
+
+#endif // QUERY_CACHE_H
@@ -10,12 +10,21 @@
 #include "rmutil/strings.h"
 #include "rmutil/util.h"
 
-#define QUERY_TOKEN_SIZE 9
+#define QUERY_TOKEN_SIZE 13
 static const char *QUERY_TOKENS[] = {
-    "WITHLABELS", "AGGREGATION",     "LIMIT",        "GROUPBY", "REDUCE",
-    "FILTER",     "FILTER_BY_VALUE", "FILTER_BY_TS", "COUNT",
+    "WITHLABELS",   "AGGREGATION", "LIMIT",  "GROUPBY", "REDUCE", "FILTER",          "FILTER_BY_VALUE",
+    "FILTER_BY_TS", "COUNT",       "FORMAT", "ALIGN",   "EMPTY",  "SELECTED_LABELS",
 };
 
+static bool isQueryToken(const char *str) {
+    for (int i = 0; i < QUERY_TOKEN_SIZE; ++i) {
+        if (strcasecmp(QUERY_TOKENS[i], str) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 int parseLabelsFromArgs(RedisModuleString **argv, int argc, size_t *label_count, Label **labels) {
     int pos = RMUtil_ArgIndex("LABELS", argv, argc);
     int first_label_pos = pos + 1;
@@ -261,6 +270,100 @@ static int parseFilterByTimestamp(RedisModuleCtx *ctx,
     return TSDB_OK;
 }
 
+static int parseFormatArgument(RedisModuleCtx *ctx,
+                               RedisModuleString **argv,
+                               int argc,
+                               ReplyFormat *format) {
+    int offset = RMUtil_ArgIndex("FORMAT", argv, argc);
+    if (offset > 0) {
+        if (offset + 1 == argc) {
+            RTS_ReplyGeneralError(ctx, "TSDB: FORMAT argument is missing");
+            return TSDB_ERROR;
+        }
+        const char *formatStr = RedisModule_StringPtrLen(argv[offset + 1], NULL);
+        if (strcasecmp(formatStr, "BINARY") == 0) {
+            *format = ReplyFormat_Binary;
+        } else if (strcasecmp(formatStr, "DEFAULT") == 0) {
+            *format = ReplyFormat_Default;
+        } else {
+            RTS_ReplyGeneralError(ctx, "TSDB: Unknown FORMAT");
+            return TSDB_ERROR;
+        }
+    }
+    return TSDB_OK;
+}
+
+static int parseAlignArgument(RedisModuleCtx *ctx,
+                              RedisModuleString **argv,
+                              int argc,
+                              RangeArgs *args) {
+    int offset = RMUtil_ArgIndex("ALIGN", argv, argc);
+    if (offset > 0) {
+        if (args->aggregationArgs.aggregationClass == NULL) {
+            RTS_ReplyGeneralError(ctx, "TSDB: ALIGN parameter can only be used with AGGREGATION");
+            return TSDB_ERROR;
+        }
+        if (offset + 1 == argc) {
+            RTS_ReplyGeneralError(ctx, "TSDB: ALIGN argument is missing");
+            return TSDB_ERROR;
+        }
+        const char *alignStr = RedisModule_StringPtrLen(argv[offset + 1], NULL);
+        long long alignment;
+        if (strcasecmp(alignStr, "start") == 0 || strcmp(alignStr, "-") == 0) {
+            alignment = args->startTimestamp;
+        } else if (strcasecmp(alignStr, "end") == 0 || strcmp(alignStr, "+") == 0) {
+            alignment = args->endTimestamp;
+        } else if (RedisModule_StringToLongLong(argv[offset + 1], &alignment) != REDISMODULE_OK ||
+                   alignment < 0) {
+            RTS_ReplyGeneralError(ctx, "TSDB: unknown ALIGN parameter");
+            return TSDB_ERROR;
+        }
+        args->aggregationArgs.alignment = alignment % args->aggregationArgs.timeDelta;
+    }
+    return TSDB_OK;
+}
+
+static int parseEmptyArgument(RedisModuleCtx *ctx,
+                              RedisModuleString **argv,
+                              int argc,
+                              AggregationArgs *args) {
+    int offset = RMUtil_ArgIndex("EMPTY", argv, argc);
+    if (offset > 0) {
+        if (args->aggregationClass == NULL) {
+            RTS_ReplyGeneralError(ctx, "TSDB: EMPTY parameter can only be used with AGGREGATION");
+            return TSDB_ERROR;
+        }
+        // empty sum and count buckets are naturally 0, any other aggregation is undefined
+        if (args->aggregationClass == GetAggClass(TS_AGG_SUM) ||
+            args->aggregationClass == GetAggClass(TS_AGG_COUNT)) {
+            args->emptyFill = EmptyBucketFill_Zero;
+        } else {
+            args->emptyFill = EmptyBucketFill_NaN;
+        }
+
+        // the fill policy is optional, the next argument may be another option
+        const char *fillStr =
+            offset + 1 < argc ? RedisModule_StringPtrLen(argv[offset + 1], NULL) : NULL;
+        if (fillStr != NULL && !isQueryToken(fillStr)) {
+            if (strcasecmp(fillStr, "NAN") == 0) {
+                args->emptyFill = EmptyBucketFill_NaN;
+            } else if (strcasecmp(fillStr, "ZERO") == 0) {
+                args->emptyFill = EmptyBucketFill_Zero;
+            } else if (strcasecmp(fillStr, "PREV") == 0) {
+                args->emptyFill = EmptyBucketFill_Prev;
+            } else if (strcasecmp(fillStr, "NEXT") == 0) {
+                args->emptyFill = EmptyBucketFill_Next;
+            } else if (strcasecmp(fillStr, "LINEAR") == 0) {
+                args->emptyFill = EmptyBucketFill_Linear;
+            } else {
+                RTS_ReplyGeneralError(ctx, "TSDB: unknown EMPTY fill policy");
+                return TSDB_ERROR;
+            }
+        }
+    }
+    return TSDB_OK;
+}
+
 int parseRangeArguments(RedisModuleCtx *ctx,
                         int start_index,
                         RedisModuleString **argv,
@@ -306,6 +409,14 @@ int parseRangeArguments(RedisModuleCtx *ctx,
         return REDISMODULE_ERR;
     }
 
+    if (parseAlignArgument(ctx, argv, argc, &args) == TSDB_ERROR) {
+        return REDISMODULE_ERR;
+    }
+
+    if (parseEmptyArgument(ctx, argv, argc, &args.aggregationArgs) == TSDB_ERROR) {
+        return REDISMODULE_ERR;
+    }
+
     if (parseFilterByValueArgument(ctx, argv, argc, &args.filterByValueArgs) == TSDB_ERROR) {
         return REDISMODULE_ERR;
     }
@@ -314,6 +425,11 @@ int parseRangeArguments(RedisModuleCtx *ctx,
         return REDISMODULE_ERR;
     }
 
+    args.format = ReplyFormat_Default;
+    if (parseFormatArgument(ctx, argv, argc, &args.format) == TSDB_ERROR) {
+        return REDISMODULE_ERR;
+    }
+
     *out = args;
 
     return REDISMODULE_OK;
@@ -336,6 +452,37 @@ QueryPredicateList *parseLabelListFromArgs(RedisModuleCtx *ctx,
         size_t label_value_pair_size;
         QueryPredicate *query = &queries->list[current_index];
         const char *label_value_pair = RedisModule_StringPtrLen(argv[i], &label_value_pair_size);
+        // The regex may contain any character, the operator is the first "=" or "!~" of the filter
+        const char *equals = strchr(label_value_pair, '=');
+        const char *notMatch = strstr(label_value_pair, "!~");
+        // l!=~v is the "!=" operator with a value starting with "~"
+        const bool notEquals = equals != NULL && equals > label_value_pair && equals[-1] == '!';
+        // l!~regex key with label l that doesn't match the regex
+        if (notMatch != NULL && (equals == NULL || notMatch < equals)) {
+            query->type = NREQ;
+            if (parseRegexPredicate(label_value_pair,
+                                    label_value_pair_size,
+                                    notMatch - label_value_pair,
+                                    query) == TSDB_ERROR) {
+                *response = TSDB_ERROR;
+                break;
+            }
+            current_index++;
+            continue;
+        }
+        // l=~regex key with label l that matches the regex
+        if (equals != NULL && !notEquals && equals[1] == '~') {
+            query->type = REQ;
+            if (parseRegexPredicate(label_value_pair,
+                                    label_value_pair_size,
+                                    equals - label_value_pair,
+                                    query) == TSDB_ERROR) {
+                *response = TSDB_ERROR;
+                break;
+            }
+            current_index++;
+            continue;
+        }
         // l!=(v1,v2,...) key with label l that doesn't equal any of the values in the list
         // Note: order is important! Must be before "!=".
         if (strstr(label_value_pair, "!=(") != NULL) {
@@ -401,6 +548,42 @@ int parseMultiSeriesReduceOp(const char *reducerstr, MultiSeriesReduceOp *reduce
     } else if (strncasecmp(reducerstr, "min", 3) == 0) {
         *reducerOp = MultiSeriesReduceOp_Min;
         return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "p50") == 0) {
+        *reducerOp = MultiSeriesReduceOp_P50;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "p90") == 0) {
+        *reducerOp = MultiSeriesReduceOp_P90;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "p99") == 0) {
+        *reducerOp = MultiSeriesReduceOp_P99;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "count") == 0) {
+        *reducerOp = MultiSeriesReduceOp_Count;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "avg") == 0) {
+        *reducerOp = MultiSeriesReduceOp_Avg;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "range") == 0) {
+        *reducerOp = MultiSeriesReduceOp_Range;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "std.p") == 0) {
+        *reducerOp = MultiSeriesReduceOp_StdP;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "std.s") == 0) {
+        *reducerOp = MultiSeriesReduceOp_StdS;
+        return TSDB_OK;
+
+    } else if (strcasecmp(reducerstr, "last") == 0) {
+        *reducerOp = MultiSeriesReduceOp_Last;
+        return TSDB_OK;
     }
     return TSDB_ERROR;
 }
@@ -423,14 +606,7 @@ int parseLabelQuery(RedisModuleCtx *ctx,
         for (int i = limit_location + 1; i < argc; i++) {
             size_t len;
             const char *c_str = RedisModule_StringPtrLen(argv[i], &len);
-            bool found = false;
-            for (int j = 0; j < QUERY_TOKEN_SIZE; ++j) {
-                if (strcasecmp(QUERY_TOKENS[j], c_str) == 0) {
-                    found = true;
-                    break;
-                }
-            }
-            if (found) {
+            if (isQueryToken(c_str)) {
                 break;
             }
             if (count >= LIMIT_LABELS_SIZE) {
@@ -465,7 +641,9 @@ int parseFilter(RedisModuleCtx *ctx,
         return REDISMODULE_ERR;
     }
 
-    if (CountPredicateType(queries, EQ) + CountPredicateType(queries, LIST_MATCH) == 0) {
+    if (CountPredicateType(queries, EQ) + CountPredicateType(queries, LIST_MATCH) +
+            CountPredicateType(queries, REQ) ==
+        0) {
         QueryPredicateList_Free(queries);
         RTS_ReplyGeneralError(ctx, "TSDB: please provide at least one matcher");
         return REDISMODULE_ERR;
@@ -17,10 +17,22 @@
 #ifndef REDISTIMESERIES_QUERY_LANGUAGE_H
 #define REDISTIMESERIES_QUERY_LANGUAGE_H
 
+typedef enum EmptyBucketFill
+{
+    EmptyBucketFill_None,   // empty buckets are not reported
+    EmptyBucketFill_NaN,
+    EmptyBucketFill_Zero,
+    EmptyBucketFill_Prev,   // value of the previous bucket in time
+    EmptyBucketFill_Next,   // value of the next bucket in time
+    EmptyBucketFill_Linear, // linear interpolation between the surrounding buckets
+} EmptyBucketFill;
+
 typedef struct AggregationArgs
 {
     api_timestamp_t timeDelta;
     AggregationClass *aggregationClass;
+    timestamp_t alignment; // buckets start at alignment + k * timeDelta
+    EmptyBucketFill emptyFill;
 } AggregationArgs;
 
 typedef struct FilterByValueArgs
@@ -39,6 +51,12 @@ typedef struct FilterByTSArgs
     timestamp_t values[MAX_TS_VALUES_FILTER];
 } FilterByTSArgs;
 
+typedef enum ReplyFormat
+{
+    ReplyFormat_Default,
+    ReplyFormat_Binary, // single bulk string of packed (u64 timestamp, f64 value) pairs
+} ReplyFormat;
+
 typedef struct RangeArgs
 {
     api_timestamp_t startTimestamp;
@@ -47,6 +65,7 @@ typedef struct RangeArgs
     AggregationArgs aggregationArgs;
     FilterByValueArgs filterByValueArgs;
     FilterByTSArgs filterByTSArgs;
+    ReplyFormat format;
 } RangeArgs;
 
 typedef enum MultiSeriesReduceOp
@@ -54,6 +73,15 @@ typedef enum MultiSeriesReduceOp
     MultiSeriesReduceOp_Min,
     MultiSeriesReduceOp_Max,
     MultiSeriesReduceOp_Sum,
+    MultiSeriesReduceOp_P50,
+    MultiSeriesReduceOp_P90,
+    MultiSeriesReduceOp_P99,
+    MultiSeriesReduceOp_Count,
+    MultiSeriesReduceOp_Avg,
+    MultiSeriesReduceOp_Range,
+    MultiSeriesReduceOp_StdP,
+    MultiSeriesReduceOp_StdS,
+    MultiSeriesReduceOp_Last,
 } MultiSeriesReduceOp;
 
 #define LIMIT_LABELS_SIZE 50
@@ -7,9 +7,175 @@
 
 #include "consts.h"
 #include "endianconv.h"
+#include "indexer.h"
+#include "reply.h"
+#include "thread_pool.h"
 
+#include <assert.h>
+#include <pthread.h>
 #include <string.h>
 #include <rmutil/alloc.h>
+#include <rmutil/util.h>
+
+// samples per TS.MADDSERIES command of an AOF rewrite
+#define AOF_REWRITE_BATCH_SAMPLES 4096
+
+/*
+ * While the server loads an RDB, the series are indexed once the loading ends. When the worker
+ * threads are enabled, series_rdb_load only reads the raw chunks blob, or the samples of the older
+ * encodings, and the workers decode them into the series. The framing of the blob is checked first
+ * so that a corrupted blob still fails the load. A series is handed to the server before it's
+ * decoded, which is safe since no command runs while an RDB is loaded, and a series freed meanwhile
+ * waits for its decoding.
+ */
+typedef struct DeferredLoad
+{
+    Series *series; // NULL once the series was freed during the loading
+    ChunkBlob blob;
+    uint64_t numChunks;
+    Sample *samples; // encodings before TS_SIZE_RDB_VER are replayed sample by sample
+    uint64_t samplesCount;
+    bool decoded;
+    bool corrupted;
+} DeferredLoad;
+
+static pthread_mutex_t deferredLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deferredCond = PTHREAD_COND_INITIALIZER;
+static bool deferLoading = false;
+static size_t pendingDecodes = 0;
+// only accessed by the loading thread
+static DeferredLoad **deferredLoads = NULL;
+static size_t deferredCount = 0;
+static size_t deferredCapacity = 0;
+
+static int decodeChunksBlob(Series *series, ChunkBlob *blob, uint64_t numChunks) {
+    for (uint64_t i = 0; i < numChunks && !blob->error; ++i) {
+        Chunk_t *chunk = NULL;
+        series->funcs->LoadFromBlob(&chunk, blob);
+        if (blob->error) {
+            break;
+        }
+        dictOperator(series->chunks, chunk, series->funcs->GetFirstTimestamp(chunk), DICT_OP_SET);
+        series->lastChunk = chunk;
+    }
+    return (!blob->error && blob->offset == blob->len) ? TSDB_OK : TSDB_ERROR;
+}
+
+// Checks the framing of the chunks so that decoding them can't fail
+static int checkChunksBlob(ChunkFuncs *funcs, ChunkBlob *blob, uint64_t numChunks) {
+    for (uint64_t i = 0; i < numChunks && !blob->error; ++i) {
+        funcs->SkipInBlob(blob);
+    }
+    const bool valid = !blob->error && blob->offset == blob->len;
+    blob->offset = 0;
+    blob->error = false;
+    return valid ? TSDB_OK : TSDB_ERROR;
+}
+
+static void decodeSeries(DeferredLoad *load) {
+    Series *series = load->series;
+    for (uint64_t i = 0; i < load->samplesCount; i++) {
+        SeriesAddSample(series, load->samples[i].timestamp, load->samples[i].value);
+    }
+    if (load->blob.data != NULL) {
+        load->corrupted = decodeChunksBlob(series, &load->blob, load->numChunks) != TSDB_OK;
+    }
+    free(load->samples);
+    free(load->blob.data);
+    load->samples = NULL;
+    load->blob.data = NULL;
+}
+
+static void decodeSeriesTask(void *arg) {
+    DeferredLoad *load = arg;
+    decodeSeries(load);
+
+    pthread_mutex_lock(&deferredLock);
+    load->decoded = true;
+    pendingDecodes--;
+    pthread_cond_broadcast(&deferredCond);
+    pthread_mutex_unlock(&deferredLock);
+}
+
+static void deferSeriesLoad(DeferredLoad *load) {
+    if (deferredCount == deferredCapacity) {
+        deferredCapacity = deferredCapacity ? deferredCapacity * 2 : 1024;
+        deferredLoads = realloc(deferredLoads, deferredCapacity * sizeof(DeferredLoad *));
+    }
+    deferredLoads[deferredCount++] = load;
+    load->series->deferredLoad = load;
+
+    if (!load->decoded) {
+        pthread_mutex_lock(&deferredLock);
+        pendingDecodes++;
+        pthread_mutex_unlock(&deferredLock);
+        ThreadPool_AddTask(decodeSeriesTask, load);
+    }
+}
+
+void RdbLoad_Begin() {
+    deferLoading = true;
+}
+
+void RdbLoad_End(RedisModuleCtx *ctx) {
+    pthread_mutex_lock(&deferredLock);
+    while (pendingDecodes > 0) {
+        pthread_cond_wait(&deferredCond, &deferredLock);
+    }
+    pthread_mutex_unlock(&deferredLock);
+
+    // no command runs before the loading ends, so the queries only see the complete index
+    IndexBulk *bulk = IndexBulk_New();
+    for (size_t i = 0; i < deferredCount; i++) {
+        Series *series = deferredLoads[i]->series;
+        if (series != NULL) {
+            IndexBulk_Add(bulk, series->keyName, series->labels, series->labelsCount);
+        }
+    }
+    IndexBulk_Build(bulk);
+
+    for (size_t i = 0; i < deferredCount; i++) {
+        DeferredLoad *load = deferredLoads[i];
+        Series *series = load->series;
+        if (series != NULL) {
+            // the framing of the chunks was checked before they were handed to a worker
+            assert(!load->corrupted);
+            series->deferredLoad = NULL;
+        }
+        free(load);
+    }
+    free(deferredLoads);
+    deferredLoads = NULL;
+    deferredCount = deferredCapacity = 0;
+    deferLoading = false;
+}
+
+void RdbLoad_Detach(Series *series) {
+    DeferredLoad *load = series->deferredLoad;
+    pthread_mutex_lock(&deferredLock);
+    while (!load->decoded) {
+        pthread_cond_wait(&deferredCond, &deferredLock);
+    }
+    load->series = NULL;
+    pthread_mutex_unlock(&deferredLock);
+    series->deferredLoad = NULL;
+}
+
+static void saveChunksBlob(RedisModuleIO *io, Series *series, uint64_t numChunks) {
+    ChunkBlob blob = { 0 };
+    blob.capacity = SeriesGetChunksSize(series) + numChunks * CHUNK_BLOB_HEADER_SIZE;
+    blob.data = malloc(blob.capacity);
+
+    Chunk_t *chunk;
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(series->chunks, "^", NULL, 0);
+    while (RedisModule_DictNextC(iter, NULL, &chunk)) {
+        series->funcs->SaveToBlob(chunk, &blob);
+    }
+    RedisModule_DictIteratorStop(iter);
+
+    RedisModule_SaveStringBuffer(io, blob.data, blob.len);
+    free(blob.data);
+}
 
 void *series_rdb_load(RedisModuleIO *io, int encver) {
     if (encver < TS_ENC_VER || encver > TS_LATEST_ENCVER) {
@@ -76,15 +242,17 @@ void *series_rdb_load(RedisModuleIO *io, int encver) {
         lastRule = rule;
     }
 
+    DeferredLoad *load = calloc(1, sizeof(DeferredLoad));
+    load->series = series;
+
     if (encver < TS_SIZE_RDB_VER) {
-        uint64_t samplesCount = RedisModule_LoadUnsigned(io);
-        for (size_t sampleIndex = 0; sampleIndex < samplesCount; sampleIndex++) {
-            timestamp_t ts = RedisModule_LoadUnsigned(io);
-            double val = RedisModule_LoadDouble(io);
-            int result = SeriesAddSample(series, ts, val);
-            if (result != TSDB_OK) {
-                RedisModule_LogIOError(io, "warning", "couldn't load sample: %ld %lf", ts, val);
-            }
+        load->samplesCount = RedisModule_LoadUnsigned(io);
+        if (load->samplesCount > 0) {
+            load->samples = malloc(load->samplesCount * sizeof(Sample));
+        }
+        for (size_t sampleIndex = 0; sampleIndex < load->samplesCount; sampleIndex++) {
+            load->samples[sampleIndex].timestamp = RedisModule_LoadUnsigned(io);
+            load->samples[sampleIndex].value = RedisModule_LoadDouble(io);
         }
     } else {
         Chunk_t *chunk = NULL;
@@ -93,13 +261,19 @@ void *series_rdb_load(RedisModuleIO *io, int encver) {
         chunk = (Chunk_t *)RedisModule_DictGetC(series->chunks, &rax_key, sizeof(rax_key), NULL);
         if (chunk != NULL) {
             series->funcs->FreeChunk(chunk);
+            chunk = NULL;
         }
         dictOperator(series->chunks, NULL, 0, DICT_OP_DEL);
         uint64_t numChunks = RedisModule_LoadUnsigned(io);
-        for (int i = 0; i < numChunks; ++i) {
-            series->funcs->LoadFromRDB(&chunk, io);
-            dictOperator(
-                series->chunks, chunk, series->funcs->GetFirstTimestamp(chunk), DICT_OP_SET);
+        if (encver < TS_CHUNK_BLOB_VER) {
+            for (int i = 0; i < numChunks; ++i) {
+                series->funcs->LoadFromRDB(&chunk, io);
+                dictOperator(
+                    series->chunks, chunk, series->funcs->GetFirstTimestamp(chunk), DICT_OP_SET);
+            }
+        } else {
+            load->numChunks = numChunks;
+            load->blob.data = RedisModule_LoadStringBuffer(io, &load->blob.len);
         }
         series->totalSamples = totalSamples;
         series->srcKey = srcKey;
@@ -108,6 +282,29 @@ void *series_rdb_load(RedisModuleIO *io, int encver) {
         series->lastChunk = chunk;
     }
 
+    bool corrupted;
+    if (deferLoading && ThreadPool_IsEnabled() &&
+        (load->samples != NULL || load->blob.data != NULL)) {
+        corrupted = load->blob.data != NULL &&
+                    checkChunksBlob(series->funcs, &load->blob, load->numChunks) != TSDB_OK;
+    } else {
+        decodeSeries(load);
+        load->decoded = true;
+        corrupted = load->corrupted;
+    }
+    if (corrupted) {
+        free(load->blob.data);
+        free(load);
+        DiscardSeries(series);
+        RedisModule_LogIOError(io, "error", "chunks of the series are corrupted");
+        return NULL;
+    }
+
+    if (deferLoading) {
+        deferSeriesLoad(load);
+        return series;
+    }
+    free(load);
     IndexMetric(ctx, keyName, series->labels, series->labelsCount);
     return series;
 }
@@ -156,13 +353,85 @@ void series_rdb_save(RedisModuleIO *io, void *value) {
         rule = rule->nextRule;
     }
 
-    Chunk_t *chunk;
     uint64_t numChunks = RedisModule_DictSize(series->chunks);
     RedisModule_SaveUnsigned(io, numChunks);
+    saveChunksBlob(io, series, numChunks);
+}
+
+static void emitCreate(RedisModuleIO *aof, RedisModuleString *key, Series *series) {
+    size_t argc = 0;
+    RedisModuleString **argv = malloc((8 + series->labelsCount * 2) * sizeof(RedisModuleString *));
+    argv[argc++] = RedisModule_CreateStringFromString(NULL, key);
+    argv[argc++] = RedisModule_CreateString(NULL, "RETENTION", strlen("RETENTION"));
+    argv[argc++] = RedisModule_CreateStringFromLongLong(NULL, series->retentionTime);
+    argv[argc++] = RedisModule_CreateString(NULL, "CHUNK_SIZE", strlen("CHUNK_SIZE"));
+    argv[argc++] = RedisModule_CreateStringFromLongLong(NULL, series->chunkSizeBytes);
+    if (series->options & SERIES_OPT_UNCOMPRESSED) {
+        argv[argc++] = RedisModule_CreateString(NULL, "UNCOMPRESSED", strlen("UNCOMPRESSED"));
+    }
+    if (series->duplicatePolicy != DP_NONE) {
+        const char *policy = DuplicatePolicyToString(series->duplicatePolicy);
+        argv[argc++] =
+            RedisModule_CreateString(NULL, DUPLICATE_POLICY_ARG, strlen(DUPLICATE_POLICY_ARG));
+        argv[argc++] = RedisModule_CreateString(NULL, policy, strlen(policy));
+    }
+    if (series->labelsCount > 0) {
+        argv[argc++] = RedisModule_CreateString(NULL, "LABELS", strlen("LABELS"));
+        for (size_t i = 0; i < series->labelsCount; i++) {
+            argv[argc++] = RedisModule_CreateStringFromString(NULL, series->labels[i].key);
+            argv[argc++] = RedisModule_CreateStringFromString(NULL, series->labels[i].value);
+        }
+    }
+
+    RedisModule_EmitAOF(aof, "TS.CREATE", "v", argv, argc);
+
+    for (size_t i = 0; i < argc; i++) {
+        RedisModule_FreeString(NULL, argv[i]);
+    }
+    free(argv);
+}
+
+/*
+ * A series is rewritten as TS.CREATE followed by TS.MADDSERIES batches of packed samples, which are
+ * replayed as plain appends. The partial buckets of the compaction rules and the link to a source
+ * series can't be expressed by commands, so series with rules or a source are rewritten as a
+ * RESTORE of their serialized value instead.
+ */
+void series_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+    Series *series = value;
+    if (series->rules != NULL || series->srcKey != NULL) {
+        RMUtil_DefaultAofRewrite(aof, key, value);
+        return;
+    }
+
+    emitCreate(aof, key, series);
+
+    char *buf = malloc(AOF_REWRITE_BATCH_SAMPLES * BINARY_SAMPLE_SIZE);
+    size_t batched = 0;
+    Chunk_t *chunk;
+    Sample sample;
+    ChunkIterFuncs iterFuncs;
     RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(series->chunks, "^", NULL, 0);
     while (RedisModule_DictNextC(iter, NULL, &chunk)) {
-        series->funcs->SaveToRDB(chunk, io);
-        numChunks--;
+        ChunkIter_t *chunkIter =
+            series->funcs->NewChunkIterator(chunk, CHUNK_ITER_OP_NONE, &iterFuncs);
+        while (iterFuncs.GetNext(chunkIter, &sample) == CR_OK) {
+            u_int64_t timestamp = sample.timestamp;
+            char *pos = buf + batched * BINARY_SAMPLE_SIZE;
+            memcpy(pos, &timestamp, sizeof(timestamp));
+            memcpy(pos + sizeof(timestamp), &sample.value, sizeof(sample.value));
+            if (++batched == AOF_REWRITE_BATCH_SAMPLES) {
+                RedisModule_EmitAOF(
+                    aof, "TS.MADDSERIES", "sb", key, buf, batched * BINARY_SAMPLE_SIZE);
+                batched = 0;
+            }
+        }
+        iterFuncs.Free(chunkIter);
     }
     RedisModule_DictIteratorStop(iter);
+
+    if (batched > 0) {
+        RedisModule_EmitAOF(aof, "TS.MADDSERIES", "sb", key, buf, batched * BINARY_SAMPLE_SIZE);
+    }
+    free(buf);
 }
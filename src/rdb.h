@@ -12,11 +12,20 @@
 #define TS_ENC_VER 0
 #define TS_UNCOMPRESSED_VER 1
 #define TS_SIZE_RDB_VER 2
+#define TS_CHUNK_BLOB_VER 3 // all the chunks of a series are saved as a single string
 
 // This flag should be updated whenever a new rdb version is introduced
-#define TS_LATEST_ENCVER TS_SIZE_RDB_VER
+#define TS_LATEST_ENCVER TS_CHUNK_BLOB_VER
 
 void *series_rdb_load(RedisModuleIO *io, int encver);
 void series_rdb_save(RedisModuleIO *io, void *value);
+void series_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key, void *value);
+
+// Between RdbLoad_Begin and RdbLoad_End the loaded series are decoded by the worker threads and
+// indexed at the end. It must only surround an RDB load, no command may access the series.
+void RdbLoad_Begin();
+void RdbLoad_End(RedisModuleCtx *ctx);
+// Called when a series is freed before the loading ends
+void RdbLoad_Detach(Series *series);
 
 #endif
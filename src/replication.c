@@ -0,0 +1,245 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "replication.h"
+
+#include "config.h"
+#include "consts.h"
+#include "reply.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "rmutil/alloc.h"
+
+struct SeriesEffects
+{
+    RedisModuleString *keyName;
+    Series *series;
+    timestamp_t *upserts;
+    size_t upsertsCount;
+    size_t upsertsCapacity;
+    Sample *appends; // ascending, all newer than the samples of the series before the command
+    size_t appendsCount;
+    size_t appendsCapacity;
+    bool sealed;
+    bool verbatim;
+};
+
+struct ReplicationEffects
+{
+    SeriesEffects **series;    // in the order the command changed them
+    RedisModuleDict *bySeries; // the effects keyed by the address of their series
+    size_t count;
+    size_t capacity;
+    bool verbatim;
+};
+
+typedef struct DirtyChunk
+{
+    timestamp_t first;
+    Chunk_t *chunk;
+} DirtyChunk;
+
+ReplicationEffects *ReplicationEffects_New() {
+    if (!TSGlobalConfig.replicateChunks) {
+        return NULL;
+    }
+    ReplicationEffects *effects = calloc(1, sizeof(ReplicationEffects));
+    effects->bySeries = RedisModule_CreateDict(NULL);
+    return effects;
+}
+
+void ReplicationEffects_SetVerbatim(ReplicationEffects *effects) {
+    if (effects != NULL) {
+        effects->verbatim = true;
+    }
+}
+
+SeriesEffects *ReplicationEffects_Series(ReplicationEffects *effects,
+                                         RedisModuleString *keyName,
+                                         Series *series) {
+    if (effects == NULL) {
+        return NULL;
+    }
+    SeriesEffects *seriesEffects =
+        RedisModule_DictGetC(effects->bySeries, &series, sizeof(series), NULL);
+    if (seriesEffects != NULL) {
+        return seriesEffects;
+    }
+    if (effects->count == effects->capacity) {
+        effects->capacity = effects->capacity ? effects->capacity * 2 : 4;
+        effects->series = realloc(effects->series, effects->capacity * sizeof(SeriesEffects *));
+    }
+    seriesEffects = calloc(1, sizeof(SeriesEffects));
+    seriesEffects->keyName = keyName;
+    seriesEffects->series = series;
+    effects->series[effects->count++] = seriesEffects;
+    RedisModule_DictSetC(effects->bySeries, &series, sizeof(series), seriesEffects);
+    return seriesEffects;
+}
+
+void SeriesEffects_Append(SeriesEffects *effects, const Sample *sample, bool sealed) {
+    if (effects->appendsCount == effects->appendsCapacity) {
+        effects->appendsCapacity = effects->appendsCapacity ? effects->appendsCapacity * 2 : 16;
+        effects->appends = realloc(effects->appends, effects->appendsCapacity * sizeof(Sample));
+    }
+    effects->appends[effects->appendsCount++] = *sample;
+    effects->sealed |= sealed;
+}
+
+void SeriesEffects_Upsert(SeriesEffects *effects, timestamp_t timestamp) {
+    if (effects->upsertsCount == effects->upsertsCapacity) {
+        effects->upsertsCapacity = effects->upsertsCapacity ? effects->upsertsCapacity * 2 : 16;
+        effects->upserts =
+            realloc(effects->upserts, effects->upsertsCapacity * sizeof(timestamp_t));
+    }
+    effects->upserts[effects->upsertsCount++] = timestamp;
+}
+
+void SeriesEffects_SetVerbatim(SeriesEffects *effects) {
+    effects->verbatim = true;
+}
+
+// the chunk of the series a sample with `timestamp` belongs to
+static Chunk_t *seriesChunkAt(Series *series, timestamp_t timestamp) {
+    Chunk_t *chunk = NULL;
+    timestamp_t rax_key;
+    seriesEncodeTimestamp(&rax_key, timestamp);
+    RedisModuleDictIter *iter =
+        RedisModule_DictIteratorStartC(series->chunks, "<=", &rax_key, sizeof(rax_key));
+    if (!RedisModule_DictNextC(iter, NULL, (void *)&chunk)) {
+        RedisModule_DictIteratorReseekC(iter, "^", NULL, 0);
+        RedisModule_DictNextC(iter, NULL, (void *)&chunk);
+    }
+    RedisModule_DictIteratorStop(iter);
+    return chunk;
+}
+
+static void pushDirtyChunk(DirtyChunk **dirty, size_t *count, size_t *capacity, Chunk_t *chunk) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        *dirty = realloc(*dirty, *capacity * sizeof(DirtyChunk));
+    }
+    (*dirty)[*count].chunk = chunk;
+    (*count)++;
+}
+
+static int compareDirtyChunks(const void *a, const void *b) {
+    const DirtyChunk *left = a;
+    const DirtyChunk *right = b;
+    if (left->first != right->first) {
+        return left->first < right->first ? -1 : 1;
+    }
+    return 0;
+}
+
+static void replicateSeriesEffects(RedisModuleCtx *ctx, SeriesEffects *effects) {
+    Series *series = effects->series;
+    ChunkFuncs *funcs = series->funcs;
+    DirtyChunk *dirty = NULL;
+    size_t dirtyCount = 0, dirtyCapacity = 0;
+
+    for (size_t i = 0; i < effects->upsertsCount; i++) {
+        Chunk_t *chunk = seriesChunkAt(series, effects->upserts[i]);
+        if (chunk != NULL) {
+            pushDirtyChunk(&dirty, &dirtyCount, &dirtyCapacity, chunk);
+        }
+    }
+    if (effects->sealed) {
+        // every chunk from the one the appends started in, up to the open chunk
+        timestamp_t rax_key;
+        seriesEncodeTimestamp(&rax_key, effects->appends[0].timestamp);
+        RedisModuleDictIter *iter =
+            RedisModule_DictIteratorStartC(series->chunks, "<=", &rax_key, sizeof(rax_key));
+        if (!RedisModule_DictNextC(iter, NULL, NULL)) {
+            RedisModule_DictIteratorReseekC(iter, "^", NULL, 0);
+        } else {
+            RedisModule_DictIteratorReseekC(iter, "<=", &rax_key, sizeof(rax_key));
+        }
+        Chunk_t *chunk;
+        while (RedisModule_DictNextC(iter, NULL, (void *)&chunk) && chunk != series->lastChunk) {
+            pushDirtyChunk(&dirty, &dirtyCount, &dirtyCapacity, chunk);
+        }
+        RedisModule_DictIteratorStop(iter);
+    }
+
+    for (size_t i = 0; i < dirtyCount; i++) {
+        dirty[i].first = funcs->GetFirstTimestamp(dirty[i].chunk);
+    }
+    if (dirtyCount > 1) {
+        qsort(dirty, dirtyCount, sizeof(DirtyChunk), compareDirtyChunks);
+    }
+    size_t unique = 0;
+    for (size_t i = 0; i < dirtyCount; i++) {
+        if (unique == 0 || dirty[i].chunk != dirty[unique - 1].chunk) {
+            dirty[unique++] = dirty[i];
+        }
+    }
+    dirtyCount = unique;
+
+    // the appends already in the replicated chunks aren't replicated again
+    timestamp_t replicatedUpTo = 0;
+    if (dirtyCount > 0) {
+        ChunkBlob blob = { 0 };
+        blob.capacity = sizeof(u_int64_t);
+        for (size_t i = 0; i < dirtyCount; i++) {
+            blob.capacity += funcs->GetChunkSize(dirty[i].chunk, false) + CHUNK_BLOB_HEADER_SIZE;
+        }
+        blob.data = malloc(blob.capacity);
+        ChunkBlob_WriteUnsigned(&blob, dirtyCount);
+        for (size_t i = 0; i < dirtyCount; i++) {
+            funcs->SaveToBlob(dirty[i].chunk, &blob);
+            replicatedUpTo = max(replicatedUpTo, funcs->GetLastTimestamp(dirty[i].chunk));
+        }
+        RedisModule_Replicate(ctx, "TS.ADOPTCHUNKS", "sb", effects->keyName, blob.data, blob.len);
+        free(blob.data);
+    }
+    free(dirty);
+
+    size_t from = 0;
+    while (dirtyCount > 0 && from < effects->appendsCount &&
+           effects->appends[from].timestamp <= replicatedUpTo) {
+        from++;
+    }
+    if (from < effects->appendsCount) {
+        const size_t count = effects->appendsCount - from;
+        char *buf = malloc(count * BINARY_SAMPLE_SIZE);
+        for (size_t i = 0; i < count; i++) {
+            const Sample *sample = &effects->appends[from + i];
+            u_int64_t timestamp = sample->timestamp;
+            char *pos = buf + i * BINARY_SAMPLE_SIZE;
+            memcpy(pos, &timestamp, sizeof(timestamp));
+            memcpy(pos + sizeof(timestamp), &sample->value, sizeof(sample->value));
+        }
+        RedisModule_Replicate(
+            ctx, "TS.MADDSERIES", "sb", effects->keyName, buf, count * BINARY_SAMPLE_SIZE);
+        free(buf);
+    }
+}
+
+void ReplicationEffects_Replicate(RedisModuleCtx *ctx, ReplicationEffects *effects) {
+    if (effects == NULL) {
+        RedisModule_ReplicateVerbatim(ctx);
+        return;
+    }
+    for (size_t i = 0; i < effects->count && !effects->verbatim; i++) {
+        effects->verbatim = effects->series[i]->verbatim;
+    }
+    if (effects->verbatim) {
+        RedisModule_ReplicateVerbatim(ctx);
+    } else {
+        for (size_t i = 0; i < effects->count; i++) {
+            replicateSeriesEffects(ctx, effects->series[i]);
+        }
+    }
+    for (size_t i = 0; i < effects->count; i++) {
+        free(effects->series[i]->upserts);
+        free(effects->series[i]->appends);
+        free(effects->series[i]);
+    }
+    free(effects->series);
+    RedisModule_FreeDict(NULL, effects->bySeries);
+    free(effects);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "redismodule.h"
+#include "tsdb.h"
+
+#include <stdbool.h>
+
+/*
+ * Effects of a write command, replicated instead of the command when REPLICATION_MODE is CHUNKS.
+ *
+ * The chunks rewritten by upserts and the chunks sealed by appends are replicated as their bytes
+ * with TS.ADOPTCHUNKS, and the samples appended to the open chunk of a series as a TS.MADDSERIES
+ * batch. A replica adopts the chunks as they are, without decoding or re-encoding any sample.
+ */
+typedef struct ReplicationEffects ReplicationEffects;
+typedef struct SeriesEffects SeriesEffects;
+
+// NULL when the commands are replicated verbatim
+ReplicationEffects *ReplicationEffects_New();
+
+// Replicate the command verbatim after all, e.g. when it created a key or the compaction rules of a
+// series were applied
+void ReplicationEffects_SetVerbatim(ReplicationEffects *effects);
+
+// The effects on the series `keyName`, NULL when `effects` is NULL
+SeriesEffects *ReplicationEffects_Series(ReplicationEffects *effects,
+                                         RedisModuleString *keyName,
+                                         Series *series);
+
+// `sealed` is set when the sample didn't fit in the last chunk of the series
+void SeriesEffects_Append(SeriesEffects *effects, const Sample *sample, bool sealed);
+void SeriesEffects_Upsert(SeriesEffects *effects, timestamp_t timestamp);
+
+// Replicate the whole command verbatim, for a change of the series its effects can't express
+void SeriesEffects_SetVerbatim(SeriesEffects *effects);
+
+// Replicate the effects, or the command itself when `effects` is NULL, and free them
+void ReplicationEffects_Replicate(RedisModuleCtx *ctx, ReplicationEffects *effects);
+
+#endif // REPLICATION_H
@@ -7,6 +7,7 @@
 #include "reply.h"
 
 #include "fpconv.h"
+#include "query_cache.h"
 #include "query_language.h"
 #include "redismodule.h"
 #include "series_iterator.h"
@@ -14,13 +15,11 @@
 
 #include "rmutil/alloc.h"
 
-int ReplySeriesArrayPos(RedisModuleCtx *ctx,
-                        Series *s,
-                        bool withlabels,
-                        RedisModuleString *limitLabels[],
-                        ushort limitLabelsSize,
-                        RangeArgs *args,
-                        bool rev) {
+static void replySeriesHeader(RedisModuleCtx *ctx,
+                              const Series *s,
+                              bool withlabels,
+                              RedisModuleString *limitLabels[],
+                              ushort limitLabelsSize) {
     RedisModule_ReplyWithArray(ctx, 3);
     RedisModule_ReplyWithString(ctx, s->keyName);
     if (withlabels) {
@@ -30,75 +29,117 @@ int ReplySeriesArrayPos(RedisModuleCtx *ctx,
     } else {
         RedisModule_ReplyWithArray(ctx, 0);
     }
+}
+
+int ReplySeriesArrayPos(RedisModuleCtx *ctx,
+                        Series *s,
+                        bool withlabels,
+                        RedisModuleString *limitLabels[],
+                        ushort limitLabelsSize,
+                        RangeArgs *args,
+                        bool rev) {
+    replySeriesHeader(ctx, s, withlabels, limitLabels, limitLabelsSize);
     ReplySeriesRange(ctx, s, args, rev);
     return REDISMODULE_OK;
 }
 
-int ReplySeriesRange(RedisModuleCtx *ctx, Series *series, RangeArgs *args, bool reverse) {
+int ReplySeriesIteratorArrayPos(RedisModuleCtx *ctx,
+                                const Series *s,
+                                bool withlabels,
+                                RedisModuleString *limitLabels[],
+                                ushort limitLabelsSize,
+                                AbstractIterator *iter,
+                                const RangeArgs *args) {
+    replySeriesHeader(ctx, s, withlabels, limitLabels, limitLabelsSize);
+    ReplyWithSamples(ctx, iter, args);
+    return REDISMODULE_OK;
+}
+
+#define BINARY_REPLY_INITIAL_SAMPLES 256
+
+static void ReplyWithSamplesBinary(RedisModuleCtx *ctx, AbstractIterator *iter, long long count) {
     Sample sample;
-    long long arraylen = 0;
+    size_t len = 0;
+    size_t cap = BINARY_REPLY_INITIAL_SAMPLES;
+    if (count != -1 && count < cap) {
+        cap = max(count, 1);
+    }
+    char *buf = malloc(cap * BINARY_SAMPLE_SIZE);
+    while ((count == -1 || len < count) && iter->GetNext(iter, &sample) == CR_OK) {
+        if (len == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap * BINARY_SAMPLE_SIZE);
+        }
+        u_int64_t timestamp = sample.timestamp;
+        char *pos = buf + len * BINARY_SAMPLE_SIZE;
+        memcpy(pos, &timestamp, sizeof(timestamp));
+        memcpy(pos + sizeof(timestamp), &sample.value, sizeof(sample.value));
+        len++;
+    }
+    RedisModule_ReplyWithStringBuffer(ctx, buf, len * BINARY_SAMPLE_SIZE);
+    free(buf);
+}
 
+int ReplySeriesRange(RedisModuleCtx *ctx, Series *series, RangeArgs *args, bool reverse) {
     // In case a retention is set shouldn't return chunks older than the retention
     // TODO: move to parseRangeArguments(?) or to iterator
     if (series->retentionTime) {
-        args->startTimestamp =
-            series->lastTimestamp > series->retentionTime
-                ? max(args->startTimestamp, series->lastTimestamp - series->retentionTime)
-                : args->startTimestamp;
+        args->startTimestamp = SeriesClampToRetention(series, args->startTimestamp);
         // if new start_ts > end_ts, there are no results to return
         if (args->startTimestamp > args->endTimestamp) {
+            if (args->format == ReplyFormat_Binary) {
+                return RedisModule_ReplyWithStringBuffer(ctx, "", 0);
+            }
             return RedisModule_ReplyWithArray(ctx, 0);
         }
     }
 
-    AbstractIterator *iter = SeriesQuery(series, args, reverse);
+    AbstractIterator *iter = QueryCache_SeriesQuery(series, args, reverse);
+    ReplyWithSamples(ctx, iter, args);
+    iter->Close(iter);
+    return REDISMODULE_OK;
+}
 
+void ReplyWithSamples(RedisModuleCtx *ctx, AbstractIterator *iter, const RangeArgs *args) {
+    if (args->format == ReplyFormat_Binary) {
+        ReplyWithSamplesBinary(ctx, iter, args->count);
+        return;
+    }
+
+    Sample sample;
+    long long arraylen = 0;
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-    while (iter->GetNext(iter, &sample) == CR_OK && (args->count == -1 || arraylen < args->count)) {
+    while ((args->count == -1 || arraylen < args->count) && iter->GetNext(iter, &sample) == CR_OK) {
         ReplyWithSample(ctx, sample.timestamp, sample.value);
         arraylen++;
     }
-    iter->Close(iter);
-
     RedisModule_ReplySetArrayLength(ctx, arraylen);
-    return REDISMODULE_OK;
+}
+
+static void replyWithSeriesLabel(RedisModuleCtx *ctx,
+                                 const Series *series,
+                                 const char *labelKey,
+                                 size_t labelKeyLen) {
+    RedisModule_ReplyWithArray(ctx, 2);
+    const Label *label = SeriesGetLabel(series, labelKey, labelKeyLen, false);
+    if (label != NULL) {
+        RedisModule_ReplyWithString(ctx, label->key);
+        RedisModule_ReplyWithString(ctx, label->value);
+    } else {
+        RedisModule_ReplyWithStringBuffer(ctx, labelKey, labelKeyLen);
+        RedisModule_ReplyWithNull(ctx);
+    }
 }
 
 void ReplyWithSeriesLabelsWithLimit(RedisModuleCtx *ctx,
                                     const Series *series,
                                     RedisModuleString **limitLabels,
                                     ushort limitLabelsSize) {
-    char **limitLabelsStr = malloc(sizeof(char *) * limitLabelsSize);
-    for (int i = 0; i < limitLabelsSize; i++) {
-        limitLabelsStr[i] = RedisModule_StringPtrLen(limitLabels[i], NULL);
-    }
-    ReplyWithSeriesLabelsWithLimitC(ctx, series, limitLabelsStr, limitLabelsSize);
-    free(limitLabelsStr);
-}
-
-void ReplyWithSeriesLabelsWithLimitC(RedisModuleCtx *ctx,
-                                     const Series *series,
-                                     char **limitLabels,
-                                     ushort limitLabelsSize) {
-    long count = 0;
     RedisModule_ReplyWithArray(ctx, limitLabelsSize);
     for (int i = 0; i < limitLabelsSize; i++) {
-        bool found = false;
-        for (int j = 0; j < series->labelsCount; ++j) {
-            const char *key = RedisModule_StringPtrLen(series->labels[j].key, NULL);
-            if (strcasecmp(key, limitLabels[i]) == 0) {
-                RedisModule_ReplyWithArray(ctx, 2);
-                RedisModule_ReplyWithString(ctx, series->labels[j].key);
-                RedisModule_ReplyWithString(ctx, series->labels[j].value);
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            RedisModule_ReplyWithArray(ctx, 2);
-            RedisModule_ReplyWithCString(ctx, limitLabels[i]);
-            RedisModule_ReplyWithNull(ctx);
-        }
+        size_t len;
+        const char *labelKey = RedisModule_StringPtrLen(limitLabels[i], &len);
+        replyWithSeriesLabel(ctx, series, labelKey, len);
     }
 }
 
@@ -12,6 +12,9 @@
 #ifndef REDISTIMESERIES_REPLY_H
 #define REDISTIMESERIES_REPLY_H
 
+// Each binary sample is a u64 timestamp followed by an f64 value, in host byte order
+#define BINARY_SAMPLE_SIZE (sizeof(u_int64_t) + sizeof(double))
+
 int ReplySeriesArrayPos(RedisModuleCtx *ctx,
                         Series *series,
                         bool withlabels,
@@ -20,17 +23,24 @@ int ReplySeriesArrayPos(RedisModuleCtx *ctx,
                         RangeArgs *args,
                         bool rev);
 
+// Reply with the samples of `iter` instead of the samples of the series
+int ReplySeriesIteratorArrayPos(RedisModuleCtx *ctx,
+                                const Series *series,
+                                bool withlabels,
+                                RedisModuleString *limitLabels[],
+                                ushort limitLabelsSize,
+                                AbstractIterator *iter,
+                                const RangeArgs *args);
+
 int ReplySeriesRange(RedisModuleCtx *ctx, Series *series, RangeArgs *args, bool rev);
+// Reply with the samples of the iterator, up to the COUNT and in the format of `args`
+void ReplyWithSamples(RedisModuleCtx *ctx, AbstractIterator *iter, const RangeArgs *args);
 
 void ReplyWithSeriesLabels(RedisModuleCtx *ctx, const Series *series);
 void ReplyWithSeriesLabelsWithLimit(RedisModuleCtx *ctx,
                                     const Series *series,
                                     RedisModuleString **limitLabels,
                                     ushort limitLabelsSize);
-void ReplyWithSeriesLabelsWithLimitC(RedisModuleCtx *ctx,
-                                     const Series *series,
-                                     char **limitLabels,
-                                     ushort limitLabelsSize);
 
 void ReplyWithSample(RedisModuleCtx *ctx, u_int64_t timestamp, double value);
 
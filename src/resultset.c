@@ -6,6 +6,7 @@
 
 #include "resultset.h"
 
+#include "filter_iterator.h"
 #include "indexer.h"
 #include "redismodule.h"
 #include "reply.h"
@@ -13,12 +14,15 @@
 #include "string.h"
 #include "tsdb.h"
 
+#include <math.h>
+
 #include "rmutil/alloc.h"
 
 struct TS_ResultSet
 {
     RedisModuleDict *groups;
     char *labelkey;
+    size_t labelkeyLen;
 };
 
 struct TS_GroupList
@@ -26,6 +30,11 @@ struct TS_GroupList
     char *labelValue;
     size_t count;
     Series **list;
+    // once a reducer is applied, the group is replied as a single series named and labeled by
+    // `reduced`, whose samples are reduced from the series of the group while replying
+    Series *reduced;
+    AggregationClass *reducer;
+    RangeArgs reducerArgs;
 };
 
 TS_GroupList *GroupList_Create();
@@ -35,8 +44,7 @@ void GroupList_Free(TS_GroupList *g);
 void GroupList_ApplyReducer(TS_GroupList *group,
                             char *labelKey,
                             RangeArgs *args,
-                            MultiSeriesReduceOp reducerOp,
-                            bool reverse);
+                            MultiSeriesReduceOp reducerOp);
 
 void GroupList_ReplyResultSet(RedisModuleCtx *ctx,
                               TS_GroupList *group,
@@ -62,6 +70,7 @@ void FreeTempSeries(Series *s) {
     if (s->labels) {
         FreeLabels(s->labels, s->labelsCount);
     }
+    free(s->labelsOrder);
     free(s);
 }
 
@@ -70,12 +79,19 @@ TS_GroupList *GroupList_Create() {
     g->count = 0;
     g->labelValue = NULL;
     g->list = NULL;
+    g->reduced = NULL;
+    g->reducer = NULL;
     return g;
 }
 
 void GroupList_Free(TS_GroupList *groupList) {
-    for (int i = 0; i < groupList->count; i++) {
-        FreeTempSeries(groupList->list[i]);
+    if (groupList->reduced) {
+        // the reduced series are owned by the caller
+        FreeTempSeries(groupList->reduced);
+    } else {
+        for (int i = 0; i < groupList->count; i++) {
+            FreeTempSeries(groupList->list[i]);
+        }
     }
     free(groupList->labelValue);
     if (groupList->list)
@@ -101,6 +117,18 @@ void GroupList_ReplyResultSet(RedisModuleCtx *ctx,
                               ushort limitLabelsSize,
                               RangeArgs *args,
                               bool rev) {
+    if (group->reduced) {
+        AbstractIterator **inputs = malloc(group->count * sizeof(AbstractIterator *));
+        for (size_t i = 0; i < group->count; i++) {
+            inputs[i] = SeriesQuery(group->list[i], &group->reducerArgs, rev);
+        }
+        AbstractIterator *iter = (AbstractIterator *)MultiSeriesReduceIterator_New(
+            inputs, group->count, group->reducer, rev);
+        ReplySeriesIteratorArrayPos(
+            ctx, group->reduced, withlabels, limitLabels, limitLabelsSize, iter, args);
+        iter->Close(iter);
+        return;
+    }
     for (int i = 0; i < group->count; i++) {
         ReplySeriesArrayPos(
             ctx, group->list[i], withlabels, limitLabels, limitLabelsSize, args, rev);
@@ -123,6 +151,33 @@ Label *createReducedSeriesLabels(char *labelKey, char *labelValue, MultiSeriesRe
         case MultiSeriesReduceOp_Sum:
             reducer_str = "sum";
             break;
+        case MultiSeriesReduceOp_P50:
+            reducer_str = "p50";
+            break;
+        case MultiSeriesReduceOp_P90:
+            reducer_str = "p90";
+            break;
+        case MultiSeriesReduceOp_P99:
+            reducer_str = "p99";
+            break;
+        case MultiSeriesReduceOp_Count:
+            reducer_str = "count";
+            break;
+        case MultiSeriesReduceOp_Avg:
+            reducer_str = "avg";
+            break;
+        case MultiSeriesReduceOp_Range:
+            reducer_str = "range";
+            break;
+        case MultiSeriesReduceOp_StdP:
+            reducer_str = "std.p";
+            break;
+        case MultiSeriesReduceOp_StdS:
+            reducer_str = "std.s";
+            break;
+        case MultiSeriesReduceOp_Last:
+            reducer_str = "last";
+            break;
     }
     Label *labels = malloc(sizeof(Label) * 3);
     labels[0].key = RedisModule_CreateStringPrintf(NULL, "%s", labelKey);
@@ -138,6 +193,7 @@ TS_ResultSet *ResultSet_Create() {
     TS_ResultSet *r = malloc(sizeof(TS_ResultSet));
     r->groups = RedisModule_CreateDict(NULL);
     r->labelkey = NULL;
+    r->labelkeyLen = 0;
     return r;
 }
 
@@ -148,72 +204,261 @@ int GroupList_SetLabelValue(TS_GroupList *r, const char *label) {
 
 int ResultSet_GroupbyLabel(TS_ResultSet *r, const char *label) {
     r->labelkey = strdup(label);
+    r->labelkeyLen = strlen(label);
     return true;
 }
 
-int ResultSet_ApplyReducer(TS_ResultSet *r,
-                           RangeArgs *args,
-                           MultiSeriesReduceOp reducerOp,
-                           bool reverse) {
+int ResultSet_ApplyReducer(TS_ResultSet *r, RangeArgs *args, MultiSeriesReduceOp reducerOp) {
     // ^ seek the smallest element of the radix tree.
     RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(r->groups, "^", NULL, 0);
     TS_GroupList *groupList;
     while (RedisModule_DictNextC(iter, NULL, (void **)&groupList) != NULL) {
-        GroupList_ApplyReducer(groupList, r->labelkey, args, reducerOp, reverse);
+        GroupList_ApplyReducer(groupList, r->labelkey, args, reducerOp);
     }
     RedisModule_DictIteratorStop(iter);
 
     return TSDB_OK;
 }
-void GroupList_ApplyReducer(TS_GroupList *group,
-                            char *labelKey,
-                            RangeArgs *args,
-                            MultiSeriesReduceOp reducerOp,
-                            bool reverse) {
-    Label *labels = createReducedSeriesLabels(labelKey, group->labelValue, reducerOp);
-    size_t serie_name_len = strlen(labelKey) + strlen(group->labelValue) + 2;
+static AggregationClass *reducerAggClass(MultiSeriesReduceOp reducerOp) {
+    switch (reducerOp) {
+        case MultiSeriesReduceOp_Max:
+            return GetAggClass(TS_AGG_MAX);
+        case MultiSeriesReduceOp_Min:
+            return GetAggClass(TS_AGG_MIN);
+        case MultiSeriesReduceOp_Sum:
+            return GetAggClass(TS_AGG_SUM);
+        case MultiSeriesReduceOp_P50:
+            return GetAggClass(TS_AGG_P50);
+        case MultiSeriesReduceOp_P90:
+            return GetAggClass(TS_AGG_P90);
+        case MultiSeriesReduceOp_P99:
+            return GetAggClass(TS_AGG_P99);
+        case MultiSeriesReduceOp_Count:
+            return GetAggClass(TS_AGG_COUNT);
+        case MultiSeriesReduceOp_Avg:
+            return GetAggClass(TS_AGG_AVG);
+        case MultiSeriesReduceOp_Range:
+            return GetAggClass(TS_AGG_RANGE);
+        case MultiSeriesReduceOp_StdP:
+            return GetAggClass(TS_AGG_STD_P);
+        case MultiSeriesReduceOp_StdS:
+            return GetAggClass(TS_AGG_STD_S);
+        case MultiSeriesReduceOp_Last:
+            // the samples sharing a timestamp are appended by the order of the series in the group
+            return GetAggClass(TS_AGG_LAST);
+        default:
+            return NULL;
+    }
+}
+
+Series *NewReducedSeries(const char *labelKey,
+                         const char *labelValue,
+                         MultiSeriesReduceOp reducerOp,
+                         RedisModuleString **sources,
+                         size_t sourcesCount) {
+    Label *labels = createReducedSeriesLabels((char *)labelKey, (char *)labelValue, reducerOp);
+    size_t serie_name_len = strlen(labelKey) + strlen(labelValue) + 2;
     char *serie_name = malloc(serie_name_len);
-    serie_name_len = sprintf(serie_name, "%s=%s", labelKey, group->labelValue);
+    serie_name_len = sprintf(serie_name, "%s=%s", labelKey, labelValue);
 
-    // create a temp serie
+    for (size_t i = 0; i < sourcesCount; i++) {
+        size_t keyLen = 0;
+        const char *keyname = RedisModule_StringPtrLen(sources[i], &keyLen);
+        RedisModule_StringAppendBuffer(NULL, labels[2].value, keyname, keyLen);
+        // check if its the last item in the group, if not append a comma
+        if (i < sourcesCount - 1) {
+            RedisModule_StringAppendBuffer(NULL, labels[2].value, ",", 1);
+        }
+    }
+
+    // The reduced series only names the group, its samples are merged from the sources by the
+    // reply, without being stored
     CreateCtx cCtx = {
-        .labels = NULL, .labelsCount = 0, .chunkSizeBytes = Chunk_SIZE_BYTES_SECS, .options = 0
+        .labels = labels,
+        .labelsCount = 3,
+        .chunkSizeBytes = Chunk_SIZE_BYTES_SECS,
+        .options = SERIES_OPT_UNCOMPRESSED,
+        .isTemporary = true,
+        .skipChunkCreation = true,
     };
-    cCtx.options |= SERIES_OPT_UNCOMPRESSED;
-    cCtx.isTemporary = true;
-
     Series *reduced = NewSeries(RedisModule_CreateString(NULL, serie_name, serie_name_len), &cCtx);
+    free(serie_name);
+    return reduced;
+}
 
-    Series *source = NULL;
-    for (int i = 0; i < group->count; i++) {
-        source = group->list[i];
-        MultiSerieReduce(reduced, source, reducerOp, args, reverse);
+static int compareSeriesKeys(const void *a, const void *b) {
+    return RedisModule_StringCompare((*(Series *const *)a)->keyName,
+                                     (*(Series *const *)b)->keyName);
+}
 
-        size_t keyLen = 0;
-        const char *keyname = RedisModule_StringPtrLen(source->keyName, &keyLen);
-        RedisModule_StringAppendBuffer(NULL, labels[2].value, keyname, keyLen);
-        // check if its the last item in the group, if not append a comma
-        if (i < group->count - 1) {
-            RedisModule_StringAppendBuffer(NULL, labels[2].value, ",", 1);
+void GroupList_ApplyReducer(TS_GroupList *group,
+                            char *labelKey,
+                            RangeArgs *args,
+                            MultiSeriesReduceOp reducerOp) {
+    // The series of a cluster are added in the order the shards answered, `last` and the sources
+    // follow the order of the keys like the series of a single shard
+    qsort(group->list, group->count, sizeof(Series *), compareSeriesKeys);
+    RedisModuleString **sources = malloc(group->count * sizeof(RedisModuleString *));
+    for (size_t i = 0; i < group->count; i++) {
+        sources[i] = group->list[i]->keyName;
+    }
+    group->reduced = NewReducedSeries(labelKey, group->labelValue, reducerOp, sources, group->count);
+    group->reducer = reducerAggClass(reducerOp);
+    group->reducerArgs = *args;
+    free(sources);
+}
+
+bool ReducerPartial_IsMergeable(MultiSeriesReduceOp reducerOp) {
+    switch (reducerOp) {
+        case MultiSeriesReduceOp_P50:
+        case MultiSeriesReduceOp_P90:
+        case MultiSeriesReduceOp_P99:
+        case MultiSeriesReduceOp_Last:
+            return false;
+        default:
+            return true;
+    }
+}
+
+void ReducerPartial_Init(ReducerPartial *partial,
+                         const Sample *sample,
+                         MultiSeriesReduceOp reducerOp) {
+    partial->timestamp = sample->timestamp;
+    partial->count = 1;
+    partial->value = sample->value;
+    partial->aux = (reducerOp == MultiSeriesReduceOp_Range) ? sample->value
+                                                             : sample->value * sample->value;
+}
+
+static void ReducerPartial_Add(ReducerPartial *dest,
+                               const ReducerPartial *src,
+                               MultiSeriesReduceOp reducerOp) {
+    switch (reducerOp) {
+        case MultiSeriesReduceOp_Min:
+            if (src->value < dest->value) {
+                dest->value = src->value;
+            }
+            break;
+        case MultiSeriesReduceOp_Max:
+            if (src->value > dest->value) {
+                dest->value = src->value;
+            }
+            break;
+        case MultiSeriesReduceOp_Range:
+            if (src->value < dest->value) {
+                dest->value = src->value;
+            }
+            if (src->aux > dest->aux) {
+                dest->aux = src->aux;
+            }
+            break;
+        case MultiSeriesReduceOp_StdP:
+        case MultiSeriesReduceOp_StdS:
+            dest->aux += src->aux;
+            // fall through
+        case MultiSeriesReduceOp_Sum:
+        case MultiSeriesReduceOp_Avg:
+            dest->value += src->value;
+            break;
+        default:
+            break;
+    }
+    dest->count += src->count;
+}
+
+void ReducerPartials_Merge(ReducerPartial **dest,
+                           size_t *destCount,
+                           const ReducerPartial *src,
+                           size_t srcCount,
+                           MultiSeriesReduceOp reducerOp) {
+    ReducerPartial *merged = malloc((*destCount + srcCount) * sizeof(ReducerPartial));
+    size_t i = 0, j = 0, count = 0;
+    while (i < *destCount || j < srcCount) {
+        if (j == srcCount || (i < *destCount && (*dest)[i].timestamp < src[j].timestamp)) {
+            merged[count++] = (*dest)[i++];
+        } else if (i == *destCount || src[j].timestamp < (*dest)[i].timestamp) {
+            merged[count++] = src[j++];
+        } else {
+            merged[count] = (*dest)[i++];
+            ReducerPartial_Add(&merged[count++], &src[j++], reducerOp);
         }
     }
-    group->list[0] = reduced;
-    group->count = 1;
+    free(*dest);
+    *dest = merged;
+    *destCount = count;
+}
 
-    // replace labels
-    FreeLabels(reduced->labels, reduced->labelsCount);
-    reduced->labels = labels;
-    reduced->labelsCount = 3;
+static double ReducerPartial_Finalize(const ReducerPartial *partial,
+                                      MultiSeriesReduceOp reducerOp) {
+    switch (reducerOp) {
+        case MultiSeriesReduceOp_Count:
+            return partial->count;
+        case MultiSeriesReduceOp_Avg:
+            return partial->value / partial->count;
+        case MultiSeriesReduceOp_Range:
+            return partial->aux - partial->value;
+        case MultiSeriesReduceOp_StdP:
+            return sqrt(CalcVariance(partial->value, partial->aux, partial->count));
+        case MultiSeriesReduceOp_StdS:
+            if (partial->count == 1) {
+                return 0;
+            }
+            return sqrt(CalcVariance(partial->value, partial->aux, partial->count) *
+                        partial->count / (partial->count - 1));
+        default:
+            return partial->value;
+    }
+}
 
-    free(serie_name);
+typedef struct ReducerPartialsIterator
+{
+    AbstractIterator base;
+    const ReducerPartial *partials;
+    size_t count;
+    size_t next;
+    MultiSeriesReduceOp reducerOp;
+    bool reverse;
+} ReducerPartialsIterator;
+
+static ChunkResult ReducerPartialsIterator_GetNext(AbstractIterator *base, Sample *sample) {
+    ReducerPartialsIterator *self = (ReducerPartialsIterator *)base;
+    if (self->next == self->count) {
+        return CR_END;
+    }
+    const size_t pos = self->reverse ? self->count - 1 - self->next : self->next;
+    self->next++;
+    sample->timestamp = self->partials[pos].timestamp;
+    sample->value = ReducerPartial_Finalize(&self->partials[pos], self->reducerOp);
+    return CR_OK;
+}
+
+static void ReducerPartialsIterator_Close(AbstractIterator *base) {
+    free(base);
+}
+
+AbstractIterator *ReducerPartialsIterator_New(const ReducerPartial *partials,
+                                              size_t count,
+                                              MultiSeriesReduceOp reducerOp,
+                                              bool reverse) {
+    ReducerPartialsIterator *iter = malloc(sizeof(ReducerPartialsIterator));
+    iter->base.GetNext = ReducerPartialsIterator_GetNext;
+    iter->base.Close = ReducerPartialsIterator_Close;
+    iter->base.input = NULL;
+    iter->partials = partials;
+    iter->count = count;
+    iter->next = 0;
+    iter->reducerOp = reducerOp;
+    iter->reverse = reverse;
+    return &iter->base;
 }
 
 int ResultSet_AddSerie(TS_ResultSet *r, Series *serie, const char *name) {
     int result = false;
 
-    char *labelValue = SeriesGetCStringLabelValue(serie, r->labelkey);
-    if (labelValue != NULL) {
-        const size_t labelLen = strlen(labelValue);
+    const Label *label = SeriesGetLabel(serie, r->labelkey, r->labelkeyLen, true);
+    if (label != NULL) {
+        size_t labelLen;
+        const char *labelValue = RedisModule_StringPtrLen(label->value, &labelLen);
         int nokey;
         TS_GroupList *labelGroup =
             (TS_GroupList *)RedisModule_DictGetC(r->groups, (void *)labelValue, labelLen, &nokey);
@@ -222,7 +467,6 @@ int ResultSet_AddSerie(TS_ResultSet *r, Series *serie, const char *name) {
             GroupList_SetLabelValue(labelGroup, labelValue);
             RedisModule_DictSetC(r->groups, (void *)labelValue, labelLen, labelGroup);
         }
-        free(labelValue);
         result = GroupList_AddSerie(labelGroup, serie, name);
     }
 
@@ -22,10 +22,8 @@ int ResultSet_SetLabelKey(TS_ResultSet *r, const char *labelKey);
 
 int ResultSet_SetLabelValue(TS_ResultSet *r, const char *label);
 
-int ResultSet_ApplyReducer(TS_ResultSet *r,
-                           RangeArgs *args,
-                           MultiSeriesReduceOp reducerOp,
-                           bool reverse);
+// The groups are reduced while replying, `args` has to outlive the reply
+int ResultSet_ApplyReducer(TS_ResultSet *r, RangeArgs *args, MultiSeriesReduceOp reducerOp);
 
 int parseMultiSeriesReduceOp(const char *reducerstr, MultiSeriesReduceOp *reducerOp);
 
@@ -41,10 +39,45 @@ void replyResultSet(RedisModuleCtx *ctx,
 
 void ResultSet_Free(TS_ResultSet *r);
 
-int MultiSerieReduce(Series *dest,
-                     Series *source,
-                     MultiSeriesReduceOp op,
-                     RangeArgs *args,
-                     bool reverse);
+// The series naming the group `labelKey`=`labelValue` reduced from the series `sources`
+Series *NewReducedSeries(const char *labelKey,
+                         const char *labelValue,
+                         MultiSeriesReduceOp reducerOp,
+                         RedisModuleString **sources,
+                         size_t sourcesCount);
+
+/*
+ * Mergeable state of a GROUPBY reducer over the samples of a group sharing a timestamp. The shards
+ * of a cluster reduce the series of their groups into partials, and the coordinator only merges
+ * the partials of every shard before finalizing them.
+ */
+typedef struct ReducerPartial
+{
+    timestamp_t timestamp;
+    u_int64_t count;
+    double value; // sum (sum, avg, std.p, std.s), min (min, range) or max (max)
+    double aux;   // max (range) or sum of squares (std.p, std.s)
+} ReducerPartial;
+
+// The percentiles have no mergeable partial state, and `last` depends on the order of the series
+// of every shard
+bool ReducerPartial_IsMergeable(MultiSeriesReduceOp reducerOp);
+
+void ReducerPartial_Init(ReducerPartial *partial,
+                         const Sample *sample,
+                         MultiSeriesReduceOp reducerOp);
+
+// Merge the partials of `src` into `dest`, both sorted by timestamp
+void ReducerPartials_Merge(ReducerPartial **dest,
+                           size_t *destCount,
+                           const ReducerPartial *src,
+                           size_t srcCount,
+                           MultiSeriesReduceOp reducerOp);
+
+// Iterate the finalized partials, which aren't owned by the iterator
+AbstractIterator *ReducerPartialsIterator_New(const ReducerPartial *partials,
+                                              size_t count,
+                                              MultiSeriesReduceOp reducerOp,
+                                              bool reverse);
 
 #endif // REDISTIMESERIES_RESULTSET_H
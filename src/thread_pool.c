@@ -0,0 +1,80 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#include "thread_pool.h"
+
+#include "consts.h"
+
+#include <pthread.h>
+#include "rmutil/alloc.h"
+
+typedef struct ThreadPoolTask
+{
+    ThreadPoolTaskFunc func;
+    void *arg;
+    struct ThreadPoolTask *next;
+} ThreadPoolTask;
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+static ThreadPoolTask *queueHead = NULL;
+static ThreadPoolTask *queueTail = NULL;
+static size_t poolSize = 0;
+
+static void *ThreadPool_WorkerMain(void *unused) {
+    while (true) {
+        pthread_mutex_lock(&queueLock);
+        while (queueHead == NULL) {
+            pthread_cond_wait(&queueCond, &queueLock);
+        }
+        ThreadPoolTask *task = queueHead;
+        queueHead = task->next;
+        if (queueHead == NULL) {
+            queueTail = NULL;
+        }
+        pthread_mutex_unlock(&queueLock);
+
+        task->func(task->arg);
+        free(task);
+    }
+    return NULL;
+}
+
+int ThreadPool_Init(size_t numThreads) {
+    for (size_t i = 0; i < numThreads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, ThreadPool_WorkerMain, NULL) != 0) {
+            return TSDB_ERROR;
+        }
+        pthread_detach(thread);
+        poolSize++;
+    }
+    return TSDB_OK;
+}
+
+bool ThreadPool_IsEnabled() {
+    return poolSize > 0;
+}
+
+size_t ThreadPool_NumThreads() {
+    return poolSize;
+}
+
+void ThreadPool_AddTask(ThreadPoolTaskFunc func, void *arg) {
+    ThreadPoolTask *task = malloc(sizeof(ThreadPoolTask));
+    task->func = func;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&queueLock);
+    if (queueTail) {
+        queueTail->next = task;
+    } else {
+        queueHead = task;
+    }
+    queueTail = task;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueLock);
+}
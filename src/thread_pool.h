@@ -0,0 +1,23 @@
+/*
+ * Copyright 2018-2021 Redis Labs Ltd. and Contributors
+ *
+ * This file is available under the Redis Labs Source Available License Agreement
+ */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*ThreadPoolTaskFunc)(void *arg);
+
+// Starts `numThreads` worker threads, 0 keeps the pool disabled
+int ThreadPool_Init(size_t numThreads);
+
+bool ThreadPool_IsEnabled();
+size_t ThreadPool_NumThreads();
+
+// Queues `func(arg)` to run on one of the worker threads
+void ThreadPool_AddTask(ThreadPoolTaskFunc func, void *arg);
+
+#endif // THREAD_POOL_H
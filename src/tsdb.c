@@ -11,9 +11,13 @@
 #include "filter_iterator.h"
 #include "indexer.h"
 #include "module.h"
+#include "query_cache.h"
+#include "rdb.h"
 #include "series_iterator.h"
 
 #include <math.h>
+#include <string.h>
+#include <strings.h>
 #include "rmutil/alloc.h"
 #include "rmutil/logging.h"
 #include "rmutil/strings.h"
@@ -87,11 +91,15 @@ Series *NewSeries(RedisModuleString *keyName, CreateCtx *cCtx) {
     newSeries->lastTimestamp = 0;
     newSeries->lastValue = 0;
     newSeries->totalSamples = 0;
-    newSeries->labels = cCtx->labels;
-    newSeries->labelsCount = cCtx->labelsCount;
+    newSeries->labels = NULL;
+    newSeries->labelsCount = 0;
+    newSeries->labelsOrder = NULL;
+    SeriesSetLabels(newSeries, cCtx->labels, cCtx->labelsCount);
     newSeries->options = cCtx->options;
     newSeries->duplicatePolicy = cCtx->duplicatePolicy;
     newSeries->isTemporary = cCtx->isTemporary;
+    newSeries->queryCache = NULL;
+    newSeries->deferredLoad = NULL;
 
     if (newSeries->options & SERIES_OPT_UNCOMPRESSED) {
         newSeries->options |= SERIES_OPT_UNCOMPRESSED;
@@ -165,21 +173,26 @@ void seriesEncodeTimestamp(void *buf, timestamp_t timestamp) {
     memcpy(buf, &e, sizeof(e));
 }
 
-void freeLastDeletedSeries() {
-    if (lastDeletedSeries == NULL) {
-        return;
-    }
-    CompactionRule *rule = lastDeletedSeries->rules;
+// the rules, the key names and the struct, which outlive the other fields of a deleted series
+static void freeSeriesKeys(Series *series) {
+    CompactionRule *rule = series->rules;
     while (rule != NULL) {
         CompactionRule *nextRule = rule->nextRule;
         FreeCompactionRule(rule);
         rule = nextRule;
     }
-    if (lastDeletedSeries->srcKey != NULL) {
-        RedisModule_FreeString(NULL, lastDeletedSeries->srcKey);
+    if (series->srcKey != NULL) {
+        RedisModule_FreeString(NULL, series->srcKey);
     }
-    RedisModule_FreeString(NULL, lastDeletedSeries->keyName);
-    free(lastDeletedSeries);
+    RedisModule_FreeString(NULL, series->keyName);
+    free(series);
+}
+
+void freeLastDeletedSeries() {
+    if (lastDeletedSeries == NULL) {
+        return;
+    }
+    freeSeriesKeys(lastDeletedSeries);
     lastDeletedSeries = NULL;
 }
 
@@ -324,15 +337,27 @@ cleanup:
     renameFromKey = NULL;
 }
 
-// Releases Series and all its compaction rules
-void FreeSeries(void *value) {
-    Series *currentSeries = (Series *)value;
-    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(currentSeries->chunks, "^", NULL, 0);
+// the chunks and the labels
+static void freeSeriesData(Series *series) {
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(series->chunks, "^", NULL, 0);
     Chunk_t *currentChunk;
     while (RedisModule_DictNextC(iter, NULL, (void *)&currentChunk) != NULL) {
-        currentSeries->funcs->FreeChunk(currentChunk);
+        series->funcs->FreeChunk(currentChunk);
     }
     RedisModule_DictIteratorStop(iter);
+    RedisModule_FreeDict(NULL, series->chunks);
+
+    FreeLabels(series->labels, series->labelsCount);
+    free(series->labelsOrder);
+}
+
+// Releases Series and all its compaction rules
+void FreeSeries(void *value) {
+    Series *currentSeries = (Series *)value;
+    if (currentSeries->deferredLoad) {
+        RdbLoad_Detach(currentSeries);
+    }
+    QueryCache_FreeSeriesEntries(currentSeries);
 
     RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
     RedisModule_AutoMemory(ctx);
@@ -340,11 +365,9 @@ void FreeSeries(void *value) {
         RemoveIndexedMetric(
             ctx, currentSeries->keyName, currentSeries->labels, currentSeries->labelsCount);
     }
-
-    FreeLabels(currentSeries->labels, currentSeries->labelsCount);
-
     RedisModule_FreeThreadSafeContext(ctx);
-    RedisModule_FreeDict(NULL, currentSeries->chunks);
+
+    freeSeriesData(currentSeries);
 
     if (currentSeries->isTemporary) {
         RedisModule_FreeString(NULL, currentSeries->keyName);
@@ -355,6 +378,11 @@ void FreeSeries(void *value) {
     }
 }
 
+void DiscardSeries(Series *series) {
+    freeSeriesData(series);
+    freeSeriesKeys(series);
+}
+
 void FreeCompactionRule(void *value) {
     CompactionRule *rule = (CompactionRule *)value;
     RedisModule_FreeString(NULL, rule->destKey);
@@ -373,16 +401,76 @@ size_t SeriesGetChunksSize(Series *series) {
     return size;
 }
 
-char *SeriesGetCStringLabelValue(const Series *series, const char *labelKey) {
-    char *result = NULL;
-    for (int i = 0; i < series->labelsCount; i++) {
-        const char *currLabel = RedisModule_StringPtrLen(series->labels[i].key, NULL);
-        if (strcmp(currLabel, labelKey) == 0) {
-            result = strdup(RedisModule_StringPtrLen(series->labels[i].value, NULL));
+static int compareLabelKeys(const char *a, size_t aLen, const char *b, size_t bLen) {
+    const int cmp = strncasecmp(a, b, min(aLen, bLen));
+    if (cmp != 0 || aLen == bLen) {
+        return cmp;
+    }
+    return aLen < bLen ? -1 : 1;
+}
+
+void SeriesSetLabels(Series *series, Label *labels, size_t labelsCount) {
+    if (series->labels != labels) {
+        FreeLabels(series->labels, series->labelsCount);
+    }
+    series->labels = labels;
+    series->labelsCount = labelsCount;
+    free(series->labelsOrder);
+    series->labelsOrder = NULL;
+    if (labelsCount == 0) {
+        return;
+    }
+
+    // insertion sort, stable so that the first of the keys differing only by case is found first
+    series->labelsOrder = malloc(labelsCount * sizeof(u_int32_t));
+    for (size_t i = 0; i < labelsCount; i++) {
+        size_t keyLen;
+        const char *key = RedisModule_StringPtrLen(labels[i].key, &keyLen);
+        size_t j = i;
+        while (j > 0) {
+            size_t prevLen;
+            const char *prev =
+                RedisModule_StringPtrLen(labels[series->labelsOrder[j - 1]].key, &prevLen);
+            if (compareLabelKeys(prev, prevLen, key, keyLen) <= 0) {
+                break;
+            }
+            series->labelsOrder[j] = series->labelsOrder[j - 1];
+            j--;
+        }
+        series->labelsOrder[j] = i;
+    }
+}
+
+const Label *SeriesGetLabel(const Series *series,
+                            const char *key,
+                            size_t keyLen,
+                            bool exactCase) {
+    // lower bound of the key in the sorted labels
+    size_t lo = 0, hi = series->labelsCount;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        size_t midLen;
+        const char *midKey =
+            RedisModule_StringPtrLen(series->labels[series->labelsOrder[mid]].key, &midLen);
+        if (compareLabelKeys(midKey, midLen, key, keyLen) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (; lo < series->labelsCount; lo++) {
+        const Label *label = &series->labels[series->labelsOrder[lo]];
+        size_t labelLen;
+        const char *labelKey = RedisModule_StringPtrLen(label->key, &labelLen);
+        if (compareLabelKeys(labelKey, labelLen, key, keyLen) != 0) {
             break;
         }
+        if (!exactCase || memcmp(labelKey, key, keyLen) == 0) {
+            return label;
+        }
     }
-    return result;
+    return NULL;
 }
 
 size_t SeriesMemUsage(const void *value) {
@@ -416,32 +504,6 @@ size_t SeriesGetNumSamples(const Series *series) {
     return numSamples;
 }
 
-int MultiSerieReduce(Series *dest,
-                     Series *source,
-                     MultiSeriesReduceOp op,
-                     RangeArgs *args,
-                     bool reverse) {
-    Sample sample;
-    AbstractIterator *iterator = SeriesQuery(source, args, reverse);
-    DuplicatePolicy dp = DP_INVALID;
-    switch (op) {
-        case MultiSeriesReduceOp_Max:
-            dp = DP_MAX;
-            break;
-        case MultiSeriesReduceOp_Min:
-            dp = DP_MIN;
-            break;
-        case MultiSeriesReduceOp_Sum:
-            dp = DP_SUM;
-            break;
-    }
-    while (iterator->GetNext(iterator, &sample) == CR_OK) {
-        SeriesUpsertSample(dest, sample.timestamp, sample.value, dp);
-    }
-    iterator->Close(iterator);
-    return 1;
-}
-
 static void upsertCompaction(Series *series, UpsertCtx *uCtx) {
     CompactionRule *rule = series->rules;
     if (rule == NULL) {
@@ -458,6 +520,7 @@ static void upsertCompaction(Series *series, UpsertCtx *uCtx) {
             const int rv = SeriesCalcRange(series, curAggWindowStart, UINT64_MAX, rule, NULL);
             if (rv == TSDB_ERROR) {
                 RedisModule_Log(ctx, "verbose", "%s", "Failed to calculate range for downsample");
+                rule = rule->nextRule;
                 continue;
             }
         } else {
@@ -465,15 +528,19 @@ static void upsertCompaction(Series *series, UpsertCtx *uCtx) {
             // ensure last include/exclude
             double val = 0;
             const int rv = SeriesCalcRange(series, start, start + ruleTimebucket - 1, rule, &val);
-            if (rv == TSDB_ERROR) {
-                RedisModule_Log(ctx, "verbose", "%s", "Failed to calculate range for downsample");
-                continue;
-            }
 
             RedisModuleKey *key;
             Series *destSeries;
             if (!GetSeries(ctx, rule->destKey, &key, &destSeries, REDISMODULE_READ)) {
                 RedisModule_Log(ctx, "verbose", "%s", "Failed to retrieve downsample series");
+                rule = rule->nextRule;
+                continue;
+            }
+            if (rv == TSDB_ERROR) {
+                // the bucket has no value anymore, e.g. the rate of a single sample
+                SeriesDelRange(destSeries, start, start);
+                RedisModule_CloseKey(key);
+                rule = rule->nextRule;
                 continue;
             }
             if (destSeries->totalSamples == 0) {
@@ -553,6 +620,7 @@ int SeriesUpsertSample(Series *series,
 
     ChunkResult rv = funcs->UpsertSample(&uCtx, &size, dp_policy);
     if (rv == CR_OK) {
+        QueryCache_InvalidateFrom(series, timestamp);
         series->totalSamples += size;
         if (timestamp == series->lastTimestamp) {
             series->lastValue = uCtx.sample.value;
@@ -592,10 +660,122 @@ int SeriesAddSample(Series *series, api_timestamp_t timestamp, double value) {
 }
 
 int SeriesDelRange(Series *series, timestamp_t start_ts, timestamp_t end_ts) {
+    QueryCache_InvalidateFrom(series, start_ts);
     SeriesTrim(series, false, start_ts, end_ts);
     return TSDB_OK;
 }
 
+static void seriesDelChunk(Series *series, void *key, size_t keyLen, Chunk_t *chunk) {
+    RedisModule_DictDelC(series->chunks, key, keyLen, NULL);
+    series->totalSamples -= series->funcs->GetNumOfSample(chunk);
+    series->funcs->FreeChunk(chunk);
+}
+
+// Move the samples of the chunk newer than `timestamp` to new chunks
+static void seriesSplitChunkAfter(Series *series, Chunk_t *chunk, timestamp_t timestamp) {
+    ChunkFuncs *funcs = series->funcs;
+    Chunk_t *tail = NULL;
+    Sample sample;
+    ChunkIterFuncs iterFuncs;
+    ChunkIter_t *iter = funcs->NewChunkIterator(chunk, CHUNK_ITER_OP_NONE, &iterFuncs);
+    while (iterFuncs.GetNext(iter, &sample) == CR_OK) {
+        if (sample.timestamp <= timestamp) {
+            continue;
+        }
+        if (tail == NULL || funcs->AddSample(tail, &sample) == CR_END) {
+            tail = funcs->NewChunk(series->chunkSizeBytes);
+            funcs->AddSample(tail, &sample);
+            dictOperator(series->chunks, tail, sample.timestamp, DICT_OP_SET);
+        }
+    }
+    iterFuncs.Free(iter);
+    funcs->DelRange(chunk, timestamp + 1, UINT64_MAX);
+}
+
+void SeriesAdoptChunk(Series *series, Chunk_t *chunk) {
+    ChunkFuncs *funcs = series->funcs;
+    const timestamp_t first = funcs->GetFirstTimestamp(chunk);
+    const timestamp_t last = funcs->GetLastTimestamp(chunk);
+
+    // The first chunk of a series is keyed by 0 instead of its first timestamp, so it would sort
+    // before adopted chunks older than its samples
+    timestamp_t rax_key;
+    seriesEncodeTimestamp(&rax_key, 0);
+    Chunk_t *head = RedisModule_DictGetC(series->chunks, &rax_key, sizeof(rax_key), NULL);
+    if (head != NULL) {
+        if (funcs->GetNumOfSample(head) == 0) {
+            seriesDelChunk(series, &rax_key, sizeof(rax_key), head);
+        } else if (funcs->GetFirstTimestamp(head) != 0) {
+            RedisModule_DictDelC(series->chunks, &rax_key, sizeof(rax_key), NULL);
+            dictOperator(series->chunks, head, funcs->GetFirstTimestamp(head), DICT_OP_SET);
+        }
+    }
+
+    // The chunk boundaries of the series may differ from the boundaries of the adopted chunk, so
+    // the overlapping chunks are trimmed rather than replaced
+    seriesEncodeTimestamp(&rax_key, first);
+    RedisModuleDictIter *iter =
+        RedisModule_DictIteratorStartC(series->chunks, "<=", &rax_key, sizeof(rax_key));
+    if (!RedisModule_DictNextC(iter, NULL, NULL)) {
+        RedisModule_DictIteratorReseekC(iter, "^", NULL, 0);
+    } else {
+        RedisModule_DictIteratorReseekC(iter, "<=", &rax_key, sizeof(rax_key));
+    }
+    Chunk_t *current;
+    void *currentKey;
+    size_t keyLen;
+    while ((currentKey = RedisModule_DictNextC(iter, &keyLen, (void *)&current))) {
+        if (funcs->GetNumOfSample(current) == 0) {
+            seriesDelChunk(series, currentKey, keyLen, current);
+            RedisModule_DictIteratorReseekC(iter, ">", currentKey, keyLen);
+            continue;
+        }
+        const timestamp_t currentFirst = funcs->GetFirstTimestamp(current);
+        const timestamp_t currentLast = funcs->GetLastTimestamp(current);
+        if (currentFirst > last) {
+            break;
+        }
+        if (currentLast < first) {
+            continue;
+        }
+        if (currentFirst >= first && currentLast <= last) {
+            seriesDelChunk(series, currentKey, keyLen, current);
+        } else {
+            if (currentFirst < first && currentLast > last) {
+                seriesSplitChunkAfter(series, current, last);
+            }
+            series->totalSamples -= funcs->DelRange(current, first, last);
+            if (currentFirst >= first) {
+                // the head of the chunk was removed, key it by its new first timestamp
+                RedisModule_DictDelC(series->chunks, currentKey, keyLen, NULL);
+                dictOperator(
+                    series->chunks, current, funcs->GetFirstTimestamp(current), DICT_OP_SET);
+            }
+        }
+        RedisModule_DictIteratorReseekC(iter, ">", currentKey, keyLen);
+    }
+    RedisModule_DictIteratorStop(iter);
+
+    dictOperator(series->chunks, chunk, first, DICT_OP_SET);
+    series->totalSamples += funcs->GetNumOfSample(chunk);
+
+    iter = RedisModule_DictIteratorStartC(series->chunks, "$", NULL, 0);
+    RedisModule_DictNextC(iter, NULL, (void *)&series->lastChunk);
+    RedisModule_DictIteratorStop(iter);
+
+    if (last >= series->lastTimestamp) {
+        Sample sample;
+        ChunkIterFuncs iterFuncs;
+        ChunkIter_t *chunkIter = funcs->NewChunkIterator(chunk, CHUNK_ITER_OP_NONE, &iterFuncs);
+        while (iterFuncs.GetNext(chunkIter, &sample) == CR_OK) {
+            series->lastValue = sample.value;
+        }
+        iterFuncs.Free(chunkIter);
+        series->lastTimestamp = last;
+    }
+    QueryCache_InvalidateFrom(series, first);
+}
+
 CompactionRule *SeriesAddRule(Series *series,
                               RedisModuleString *destKeyStr,
                               int aggType,
@@ -743,17 +923,25 @@ int SeriesCalcRange(Series *series,
     void *context = aggObject->createContext();
 
     while (SeriesIteratorGetNext(iterator, &sample) == CR_OK) {
-        aggObject->appendValue(context, sample.value);
+        aggObject->appendValue(context, sample.value, sample.timestamp);
     }
     SeriesIteratorClose(iterator);
+    int rv = TSDB_OK;
     if (val == NULL) { // just update context for current window
         aggObject->freeContext(rule->aggContext);
         rule->aggContext = context;
     } else {
-        aggObject->finalize(context, val);
+        rv = aggObject->finalize(context, val);
         aggObject->freeContext(context);
     }
-    return TSDB_OK;
+    return rv;
+}
+
+timestamp_t SeriesClampToRetention(const Series *series, timestamp_t startTimestamp) {
+    if (series->retentionTime && series->lastTimestamp > series->retentionTime) {
+        return max(startTimestamp, series->lastTimestamp - series->retentionTime);
+    }
+    return startTimestamp;
 }
 
 timestamp_t CalcWindowStart(timestamp_t timestamp, size_t window) {
@@ -798,11 +986,55 @@ AbstractIterator *SeriesQuery(Series *series, RangeArgs *args, bool reverse) {
     }
 
     if (args->aggregationArgs.aggregationClass != NULL) {
-        chain = (AbstractIterator *)AggregationIterator_New(chain,
-                                                            args->aggregationArgs.aggregationClass,
-                                                            args->aggregationArgs.timeDelta,
-                                                            reverse);
+        chain = (AbstractIterator *)AggregationIterator_New(chain, &args->aggregationArgs, reverse);
     }
 
     return chain;
 }
+
+static void appendToChunks(ChunkFuncs *funcs, Chunk_t ***chunks, size_t *count, Sample *sample) {
+    if (*count > 0 && funcs->AddSample((*chunks)[*count - 1], sample) != CR_END) {
+        return;
+    }
+    Chunk_t *chunk = funcs->NewChunk(Chunk_SIZE_BYTES_SECS);
+    funcs->AddSample(chunk, sample);
+    *chunks = realloc(*chunks, (*count + 1) * sizeof(Chunk_t *));
+    (*chunks)[(*count)++] = chunk;
+}
+
+size_t SeriesQueryChunks(Series *series,
+                         RangeArgs *args,
+                         bool reverse,
+                         long long limit,
+                         CHUNK_TYPES_T chunkType,
+                         Chunk_t ***chunks) {
+    ChunkFuncs *funcs = GetChunkClass(chunkType);
+    size_t chunkCount = 0;
+    *chunks = NULL;
+    // a reversed limit keeps the newest samples, which are added to the chunks in ascending order
+    reverse = reverse && limit != -1;
+    Sample *newest = NULL;
+    size_t newestCapacity = 0;
+
+    Sample sample;
+    long long count = 0;
+    AbstractIterator *iter = SeriesQuery(series, args, reverse);
+    while ((limit == -1 || count < limit) && iter->GetNext(iter, &sample) == CR_OK) {
+        if (!reverse) {
+            appendToChunks(funcs, chunks, &chunkCount, &sample);
+        } else {
+            if (count == newestCapacity) {
+                newestCapacity = newestCapacity ? newestCapacity * 2 : 64;
+                newest = realloc(newest, newestCapacity * sizeof(Sample));
+            }
+            newest[count] = sample;
+        }
+        count++;
+    }
+    iter->Close(iter);
+    while (reverse && count > 0) {
+        appendToChunks(funcs, chunks, &chunkCount, &newest[--count]);
+    }
+    free(newest);
+    return chunkCount;
+}
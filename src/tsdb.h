@@ -38,15 +38,21 @@ typedef struct Series
     Label *labels;
     RedisModuleString *keyName;
     size_t labelsCount;
+    u_int32_t *labelsOrder; // positions of the labels sorted by key, case insensitively
     RedisModuleString *srcKey;
     ChunkFuncs *funcs;
     size_t totalSamples;
     DuplicatePolicy duplicatePolicy;
     bool isTemporary;
+    struct QueryCacheEntry *queryCache;
+    struct DeferredLoad *deferredLoad; // set while the series is loaded from an RDB
 } Series;
 
 Series *NewSeries(RedisModuleString *keyName, CreateCtx *cCtx);
 void FreeSeries(void *value);
+// Releases a series the server never held, e.g. one whose RDB payload is corrupted: it isn't in the
+// index, nor waiting for a deferred decoding
+void DiscardSeries(Series *series);
 void CleanLastDeletedSeries(RedisModuleString *key);
 void RenameSeriesFrom(RedisModuleCtx *ctx, RedisModuleString *key);
 void RenameSeriesTo(RedisModuleCtx *ctx, RedisModuleString *key);
@@ -68,9 +74,18 @@ int SilentGetSeries(RedisModuleCtx *ctx,
                     int mode);
 
 AbstractIterator *SeriesQuery(Series *series, RangeArgs *args, bool reserve);
+// The samples of the query, at most `limit` of them unless it's -1, appended in ascending order to
+// chunks of `chunkType` that are owned by the caller. Returns the number of chunks.
+size_t SeriesQueryChunks(Series *series,
+                         RangeArgs *args,
+                         bool reverse,
+                         long long limit,
+                         CHUNK_TYPES_T chunkType,
+                         Chunk_t ***chunks);
 
 void FreeCompactionRule(void *value);
 size_t SeriesMemUsage(const void *value);
+size_t SeriesGetChunksSize(Series *series);
 
 int SeriesAddSample(Series *series, api_timestamp_t timestamp, double value);
 int SeriesUpsertSample(Series *series,
@@ -93,15 +108,28 @@ int SeriesCreateRulesFromGlobalConfig(RedisModuleCtx *ctx,
                                       size_t labelsCount);
 size_t SeriesGetNumSamples(const Series *series);
 
-char *SeriesGetCStringLabelValue(const Series *series, const char *labelKey);
+// Replace the labels of the series, the series takes ownership of `labels`
+void SeriesSetLabels(Series *series, Label *labels, size_t labelsCount);
+// Binary search of a label by key, case insensitively unless `exactCase`. NULL when not found.
+const Label *SeriesGetLabel(const Series *series,
+                            const char *key,
+                            size_t keyLen,
+                            bool exactCase);
 int SeriesDelRange(Series *series, timestamp_t start_ts, timestamp_t end_ts);
+// Replace the samples of the series in the time range of `chunk` with the samples of the chunk,
+// the series takes ownership of the chunk
+void SeriesAdoptChunk(Series *series, Chunk_t *chunk);
 
+// TSDB_ERROR when `val` is set and the aggregation has no value for the range
 int SeriesCalcRange(Series *series,
                     timestamp_t start_ts,
                     timestamp_t end_ts,
                     CompactionRule *rule,
                     double *val);
 
+// Move a range start forward to the first timestamp inside the retention window
+timestamp_t SeriesClampToRetention(const Series *series, timestamp_t startTimestamp);
+
 // Calculate the begining of  aggregation window
 timestamp_t CalcWindowStart(timestamp_t timestamp, size_t window);
 
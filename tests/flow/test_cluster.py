@@ -0,0 +1,148 @@
+import threading
+import time
+
+import pytest
+import redis
+from utils import Env
+
+SHARDS = 3
+SERIES = 30
+
+
+def cluster_env(moduleArgs):
+    env = Env(env='oss-cluster', shardsCount=SHARDS, moduleArgs=moduleArgs)
+    # the queries only fan out over the cluster bus without RedisGears
+    modules = env.getConnection(1).execute_command('MODULE', 'LIST')
+    if any(module[1] in (b'rg', 'rg') for module in modules):
+        env.skip()
+    return env
+
+
+def create_series(env):
+    with env.getClusterConnectionIfNeeded() as r:
+        for i in range(SERIES):
+            key = 'fan{}'.format(i)
+            r.execute_command('TS.CREATE', key, 'LABELS', 'name', 'fan', 'parity', i % 2, 'id', i)
+            for ts in range(1, 11):
+                r.execute_command('TS.ADD', key, ts * 10, i * 100 + ts)
+    # the series are spread over every shard
+    for shard in range(1, SHARDS + 1):
+        assert env.getConnection(shard).execute_command('DBSIZE') > 0
+
+
+def by_key(reply):
+    return sorted(reply, key=lambda series: series[0])
+
+
+def expected_samples(i, timestamps):
+    return [[ts, str(i * 100 + ts // 10).encode()] for ts in timestamps]
+
+
+def test_fanout_merge():
+    env = cluster_env('SHARD_TIMEOUT 5000')
+    create_series(env)
+    keys = sorted('fan{}'.format(i).encode() for i in range(SERIES))
+    # every shard coordinates the query over the series of the others
+    for shard in range(1, SHARDS + 1):
+        r = env.getConnection(shard)
+        assert sorted(r.execute_command('TS.QUERYINDEX', 'name=fan')) == keys
+        assert sorted(r.execute_command('TS.QUERYINDEX', 'name=fan', 'parity=1')) == \
+               sorted('fan{}'.format(i).encode() for i in range(1, SERIES, 2))
+
+        mget = by_key(r.execute_command('TS.MGET', 'WITHLABELS', 'FILTER', 'name=fan'))
+        assert len(mget) == SERIES
+        for key, labels, last in mget:
+            i = int(key[len('fan'):])
+            assert labels == [[b'name', b'fan'], [b'parity', str(i % 2).encode()], [b'id', str(i).encode()]]
+            assert last == [100, str(i * 100 + 10).encode()]
+
+        mrange = by_key(r.execute_command('TS.MRANGE', 30, 70, 'FILTER', 'name=fan'))
+        assert len(mrange) == SERIES
+        for key, labels, samples in mrange:
+            assert labels == []
+            assert samples == expected_samples(int(key[len('fan'):]), range(30, 71, 10))
+
+        aggregated = by_key(r.execute_command('TS.MRANGE', '-', '+', 'AGGREGATION', 'max', 50,
+                                              'FILTER', 'name=fan', 'id=(3,4)'))
+        assert aggregated == [[b'fan3', [], [[0, b'304'], [50, b'309'], [100, b'310']]],
+                              [b'fan4', [], [[0, b'404'], [50, b'409'], [100, b'410']]]]
+
+        grouped = r.execute_command('TS.MRANGE', 10, 20, 'FILTER', 'name=fan', 'GROUPBY', 'parity', 'REDUCE', 'sum')
+        assert [(group[0], group[2]) for group in sorted(grouped)] == [
+            ('parity={}'.format(parity).encode(),
+             [[ts, str(sum(i * 100 + ts // 10 for i in range(parity, SERIES, 2))).encode()] for ts in (10, 20)])
+            for parity in (0, 1)]
+
+        assert r.execute_command('TS.MRANGE', '-', '+', 'FILTER', 'name=none') == []
+        assert r.execute_command('TS.MGET', 'FILTER', 'name=none') == []
+
+
+def test_fanout_mrevrange_count():
+    env = cluster_env('SHARD_TIMEOUT 5000')
+    create_series(env)
+    for shard in range(1, SHARDS + 1):
+        r = env.getConnection(shard)
+        reply = by_key(r.execute_command('TS.MREVRANGE', '-', '+', 'COUNT', 3, 'FILTER', 'name=fan'))
+        assert len(reply) == SERIES
+        for key, _, samples in reply:
+            # the newest samples of every series, newest first
+            assert samples == expected_samples(int(key[len('fan'):]), [100, 90, 80])
+
+        reply = by_key(r.execute_command('TS.MRANGE', '-', '+', 'COUNT', 2, 'FILTER', 'name=fan'))
+        for key, _, samples in reply:
+            assert samples == expected_samples(int(key[len('fan'):]), [10, 20])
+
+        reply = by_key(r.execute_command('TS.MREVRANGE', 0, 100, 'AGGREGATION', 'min', 40, 'COUNT', 2,
+                                         'FILTER', 'name=fan'))
+        for key, _, samples in reply:
+            i = int(key[len('fan'):])
+            assert samples == [[80, str(i * 100 + 8).encode()], [40, str(i * 100 + 4).encode()]]
+
+
+def sleep_shard(env, shard, seconds):
+    # the shard doesn't answer the cluster bus while it sleeps
+    thread = threading.Thread(target=lambda: env.getConnection(shard).execute_command('DEBUG', 'SLEEP', seconds))
+    thread.start()
+    time.sleep(0.2)
+    return thread
+
+
+def test_shard_timeout_fail():
+    env = cluster_env('SHARD_TIMEOUT 300')
+    create_series(env)
+    r = env.getConnection(1)
+    thread = sleep_shard(env, SHARDS, 2)
+    with pytest.raises(redis.ResponseError) as excinfo:
+        r.execute_command('TS.MRANGE', '-', '+', 'FILTER', 'name=fan')
+    assert "didn't answer within SHARD_TIMEOUT" in str(excinfo.value)
+    thread.join()
+    assert len(r.execute_command('TS.MRANGE', '-', '+', 'FILTER', 'name=fan')) == SERIES
+
+
+def test_shard_timeout_partial():
+    env = cluster_env('SHARD_TIMEOUT 300 SHARD_TIMEOUT_POLICY PARTIAL')
+    create_series(env)
+    r = env.getConnection(1)
+    # KEYS stays on the shard, unlike the queries
+    sleeping = set(env.getConnection(SHARDS).execute_command('KEYS', 'fan*'))
+    assert sleeping
+
+    for count, query in enumerate([('TS.QUERYINDEX', 'name=fan'),
+                                   ('TS.MGET', 'FILTER', 'name=fan'),
+                                   ('TS.MRANGE', '-', '+', 'FILTER', 'name=fan'),
+                                   ('TS.MREVRANGE', '-', '+', 'COUNT', 1, 'FILTER', 'name=fan')], 1):
+        thread = sleep_shard(env, SHARDS, 1)
+        reply = r.execute_command(*query)
+        thread.join()
+        # the reply keeps its shape, the missing shard is only counted in INFO
+        keys = reply if query[0] == 'TS.QUERYINDEX' else [series[0] for series in reply]
+        assert all(isinstance(key, bytes) for key in keys)
+        assert len(keys) == SERIES - len(sleeping)
+        assert not sleeping.intersection(keys)
+        info = r.info('timeseries_cluster')
+        assert info['timeseries_partial_replies'] == count
+        assert info['timeseries_missing_shard_answers'] == count
+
+    # a complete reply isn't counted
+    assert len(r.execute_command('TS.QUERYINDEX', 'name=fan')) == SERIES
+    assert r.info('timeseries_cluster')['timeseries_partial_replies'] == 4
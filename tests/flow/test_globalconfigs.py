@@ -1,3 +1,4 @@
+import time
 import pytest
 from RLTest import Env
 from test_helper_classes import TSInfo
@@ -8,7 +9,16 @@ class testModuleLoadTimeArguments(object):
         self.test_variations = [(True, 'CHUNK_SIZE_BYTES 2000'),
                                 (True, 'COMPACTION_POLICY', 'max:1m:1d\\;min:10s:1h\\;avg:2h:10d\\;avg:3d:100d'),
                                 (True, 'DUPLICATE_POLICY MAX'),
-                                (True, 'RETENTION_POLICY 30')
+                                (True, 'RETENTION_POLICY 30'),
+                                (True, 'QUERY_CACHE_SIZE 1048576'),
+                                (True, 'WORKER_THREADS 4'),
+                                (True, 'REPLICATION_MODE CHUNKS'),
+                                (False, 'REPLICATION_MODE SAMPLES'),
+                                (True, 'SHARD_TIMEOUT 1000'),
+                                (False, 'SHARD_TIMEOUT -1'),
+                                (False, 'SHARD_TIMEOUT 0'),
+                                (True, 'SHARD_TIMEOUT_POLICY PARTIAL'),
+                                (False, 'SHARD_TIMEOUT_POLICY IGNORE')
                                 ]
 
     def test(self):
@@ -54,6 +64,141 @@ def test_compressed_debug():
 
         assert TSInfo(r.execute_command('TS.INFO', 't1_MAX_1000', 'DEBUG')).chunks == [[b'startTimestamp', 0, b'endTimestamp', 3000, b'samples', 2, b'size', 4096, b'bytesPerSample', b'2048']]
 
+def test_query_cache():
+    Env().skipOnCluster()
+    env = Env(moduleArgs='QUERY_CACHE_SIZE 1048576')
+    with env.getConnection() as r:
+        r.execute_command('FLUSHALL')
+        r.execute_command('TS.CREATE', 'tester', 'DUPLICATE_POLICY', 'LAST')
+        for i in range(1000):
+            r.execute_command('TS.ADD', 'tester', i, i)
+
+        def expected(start, end, rev=False):
+            res = [[b, str(sum(range(max(b, start), min(b + 10, end + 1)))).encode('ascii')]
+                   for b in range(start - start % 10, end + 1, 10)]
+            return res[::-1] if rev else res
+
+        # first query fills the cache, the following ones are served partially from it
+        for start, end in [(0, 999), (105, 503), (200, 999), (0, 999)]:
+            assert r.execute_command('TS.RANGE', 'tester', start, end, 'AGGREGATION', 'sum', 10) == expected(start, end)
+            assert r.execute_command('TS.REVRANGE', 'tester', start, end, 'AGGREGATION', 'sum', 10) == expected(start, end, True)
+
+        # appending samples extends the live tail
+        for i in range(1000, 1100):
+            r.execute_command('TS.ADD', 'tester', i, i)
+        assert r.execute_command('TS.RANGE', 'tester', 0, 1099, 'AGGREGATION', 'sum', 10)[-11:] == \
+               [[b, str(sum(range(b, b + 10))).encode('ascii')] for b in range(990, 1100, 10)]
+
+        # out of order updates and deletions invalidate cached buckets
+        r.execute_command('TS.ADD', 'tester', 55, 1000)
+        assert r.execute_command('TS.RANGE', 'tester', 50, 59, 'AGGREGATION', 'sum', 10) == \
+               [[50, str(sum(range(50, 60)) - 55 + 1000).encode('ascii')]]
+        r.execute_command('TS.DEL', 'tester', 0, 999)
+        assert r.execute_command('TS.RANGE', 'tester', 0, 999, 'AGGREGATION', 'sum', 10) == \
+               r.execute_command('TS.RANGE', 'tester', 0, 999, 'AGGREGATION', 'sum', 10, 'FILTER_BY_VALUE', '-inf', '+inf')
+
+
+def test_worker_threads():
+    Env().skipOnCluster()
+    env = Env(moduleArgs='WORKER_THREADS 4')
+    with env.getConnection() as r:
+        r.execute_command('FLUSHALL')
+        for i in range(20):
+            r.execute_command('TS.CREATE', 'tester{}'.format(i), 'CHUNK_SIZE', 128,
+                              'LABELS', 'name', 'tester', 'group', i % 2)
+            for ts in range(200):
+                r.execute_command('TS.ADD', 'tester{}'.format(i), ts, ts * i)
+
+        def expected(i, start, end, rev=False):
+            res = [[b, str(sum(ts * i for ts in range(max(b, start), min(b + 10, end + 1)))).encode('ascii')]
+                   for b in range(start - start % 10, end + 1, 10)]
+            return res[::-1] if rev else res
+
+        res = sorted(r.execute_command('TS.MRANGE', 15, 150, 'AGGREGATION', 'sum', 10, 'FILTER', 'name=tester'))
+        assert len(res) == 20
+        for key, labels, samples in res:
+            assert samples == expected(int(key[len('tester'):]), 15, 150)
+
+        res = sorted(r.execute_command('TS.MREVRANGE', 15, 150, 'COUNT', 3, 'AGGREGATION', 'sum', 10,
+                                       'FILTER', 'name=tester'))
+        for key, labels, samples in res:
+            assert samples == expected(int(key[len('tester'):]), 15, 150, True)[:3]
+
+        res = r.execute_command('TS.MRANGE', 0, 199, 'COUNT', 5, 'FILTER', 'name=tester', 'GROUPBY', 'group',
+                                'REDUCE', 'max')
+        assert [serie[0] for serie in res] == [b'group=0', b'group=1']
+        assert res[0][2] == [[ts, str(ts * 18).encode('ascii')] for ts in range(5)]
+        assert res[1][2] == [[ts, str(ts * 19).encode('ascii')] for ts in range(5)]
+
+        # empty results are replied without blocking, filters are applied by the workers
+        assert r.execute_command('TS.MRANGE', 0, 199, 'FILTER', 'name=missing') == []
+        assert r.execute_command('TS.MRANGE', 0, 199, 'FILTER', 'name=tester') == \
+               r.execute_command('TS.MRANGE', 0, 199, 'FILTER', 'name=tester', 'FILTER_BY_VALUE', '-inf', '+inf')
+
+
+def test_worker_threads_reload():
+    Env().skipOnCluster()
+    env = Env(moduleArgs='WORKER_THREADS 4')
+    with env.getConnection() as r:
+        r.execute_command('FLUSHALL')
+        for i in range(50):
+            encoding = 'UNCOMPRESSED' if i % 3 == 0 else 'COMPRESSED'
+            r.execute_command('TS.CREATE', 'loaded{}'.format(i), 'CHUNK_SIZE', 128, encoding,
+                              'LABELS', 'name', 'loaded', 'group', i % 5)
+            for ts in range(300):
+                r.execute_command('TS.ADD', 'loaded{}'.format(i), ts, ts * i)
+        before = sorted(r.execute_command('TS.MRANGE', '-', '+', 'WITHLABELS', 'FILTER', 'name=loaded'))
+        # an expired key is saved, and its series is freed while the RDB is loaded
+        r.execute_command('DEBUG', 'SET-ACTIVE-EXPIRE', 0)
+        r.execute_command('TS.CREATE', 'expiring', 'LABELS', 'name', 'expiring')
+        r.execute_command('TS.ADD', 'expiring', 1, 1)
+        r.execute_command('PEXPIRE', 'expiring', 100)
+        time.sleep(0.2)
+
+        r.execute_command('DEBUG', 'RELOAD')
+        r.execute_command('DEBUG', 'SET-ACTIVE-EXPIRE', 1)
+
+        assert sorted(r.execute_command('TS.MRANGE', '-', '+', 'WITHLABELS', 'FILTER', 'name=loaded')) == before
+        assert len(r.execute_command('TS.QUERYINDEX', 'group=3')) == 10
+        assert r.execute_command('TS.QUERYINDEX', 'name=expiring') == []
+        assert r.execute_command('TS.ADD', 'loaded0', 300, 1) == 300
+
+
+def test_replication_mode_chunks():
+    Env().skipOnCluster()
+    env = Env(moduleArgs='REPLICATION_MODE CHUNKS', useSlaves=True)
+    with env.getConnection() as r, env.getSlaveConnection() as replica:
+        r.execute_command('FLUSHALL')
+        for encoding in ['COMPRESSED', 'UNCOMPRESSED']:
+            key = 'replicated_{}'.format(encoding)
+            r.execute_command('TS.CREATE', key, 'CHUNK_SIZE', 128, encoding, 'DUPLICATE_POLICY', 'LAST')
+            # appends sealing chunks
+            for ts in range(0, 3000, 100):
+                r.execute_command('TS.MADD', *[arg for t in range(ts, ts + 100, 2) for arg in (key, t, t)])
+            # upserts rewriting sealed chunks, and out of order samples splitting them
+            for ts in range(1, 3000, 37):
+                r.execute_command('TS.ADD', key, ts, -ts)
+            r.execute_command('TS.MADD', key, 500, 1.5, key, 2999, 2.5, key, 3001, 3.5)
+            # a series emptied by TS.DEL keeps its latest timestamp, older samples are appended again
+            key = 'deleted_{}'.format(encoding)
+            r.execute_command('TS.CREATE', key, 'CHUNK_SIZE', 128, encoding)
+            for ts in range(100, 200):
+                r.execute_command('TS.ADD', key, ts, ts)
+            r.execute_command('TS.DEL', key, 0, 200)
+            r.execute_command('TS.ADD', key, 50, 5)
+            r.execute_command('TS.MADD', key, 60, 6, key, 300, 30)
+        r.execute_command('WAIT', 1, 0)
+        for encoding in ['COMPRESSED', 'UNCOMPRESSED']:
+            for key in ['replicated_{}'.format(encoding), 'deleted_{}'.format(encoding)]:
+                assert replica.execute_command('TS.RANGE', key, '-', '+') == r.execute_command('TS.RANGE', key, '-', '+')
+                assert replica.execute_command('TS.GET', key) == r.execute_command('TS.GET', key)
+            assert replica.execute_command('TS.RANGE', 'deleted_{}'.format(encoding), '-', '+') == \
+                   [[50, b'5'], [60, b'6'], [300, b'30']]
+        # the chunks are only adopted from the replication stream
+        with pytest.raises(Exception):
+            r.execute_command('TS.ADOPTCHUNKS', 'replicated_COMPRESSED', b'\x01' + b'\x00' * 7)
+
+
 class testGlobalConfigTests():
 
     def __init__(self):
@@ -134,3 +279,9 @@ def test_negative_configuration():
 
     with pytest.raises(Exception) as excinfo:
         env = Env(moduleArgs='CHUNK_TYPE compressed; CHUNK_SIZE_BYTES')
+
+    with pytest.raises(Exception) as excinfo:
+        env = Env(moduleArgs='QUERY_CACHE_SIZE -1')
+
+    with pytest.raises(Exception) as excinfo:
+        env = Env(moduleArgs='WORKER_THREADS -1')
@@ -1,3 +1,8 @@
+import struct
+import time
+
+import pytest
+import redis
 from RLTest import Env
 from test_helper_classes import ALLOWED_ERROR, _insert_data, _get_ts_info
 
@@ -122,6 +127,155 @@ def test_dump_trimmed_series(self):
         assert r.execute_command('ts.range', 'test_key', '-', '+') == before
 
 
+def test_dump_restore_many_chunks():
+    with Env().getClusterConnectionIfNeeded() as r:
+        for key, encoding in [('blob{a}:compressed', 'COMPRESSED'), ('blob{a}:uncompressed', 'UNCOMPRESSED')]:
+            if encoding == 'COMPRESSED':
+                r.execute_command('ts.create', key, 'CHUNK_SIZE', 128, 'LABELS', 'name', 'blob')
+            else:
+                r.execute_command('ts.create', key, 'CHUNK_SIZE', 128, encoding, 'LABELS', 'name', 'blob')
+            for i in range(1000):
+                r.execute_command('ts.add', key, 1000 + i * 7, i * 1.5)
+            before = r.execute_command('ts.range', key, '-', '+')
+            info = _get_ts_info(r, key)
+            assert info.chunk_count > 10
+
+            dump = r.execute_command('dump', key)
+            r.execute_command('del', key)
+            r.execute_command('restore', key, 0, dump)
+
+            assert r.execute_command('ts.range', key, '-', '+') == before
+            restored = _get_ts_info(r, key)
+            assert restored.chunk_count == info.chunk_count
+            assert restored.total_samples == info.total_samples
+            assert restored.labels == {b'name': b'blob'}
+            # the last chunk keeps accepting samples
+            assert r.execute_command('ts.add', key, 1000 + 1000 * 7, 1)
+
+def _crc64(data):
+    # the CRC-64/Jones checksum ending a DUMP payload
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x95ac9329ac4bc9b5 if crc & 1 else 0)
+    return crc
+
+
+def _rdb_length(payload, pos):
+    # the value and the end of an RDB length encoding
+    kind = payload[pos] >> 6
+    if kind == 0:
+        return payload[pos] & 0x3f, pos + 1
+    if kind == 1:
+        return ((payload[pos] & 0x3f) << 8) | payload[pos + 1], pos + 2
+    if payload[pos] == 0x80:
+        return struct.unpack('>I', payload[pos + 1:pos + 5])[0], pos + 5
+    return struct.unpack('>Q', payload[pos + 1:pos + 9])[0], pos + 9
+
+
+def _corrupt_chunks_count(dump):
+    # the module value ends with the count of chunks, an unsigned, and their blob, a string
+    payload, footer = dump[:-10], dump[-10:-8]
+    for pos in range(len(payload) - 2, 0, -1):
+        if payload[pos] != 2:
+            continue
+        count, end = _rdb_length(payload, pos + 1)
+        if end >= len(payload) or payload[end] != 5 or count >= 63:
+            continue
+        length, start = _rdb_length(payload, end + 1)
+        if start + length == len(payload) - 1 and payload[-1] == 0 and end == pos + 2:
+            corrupted = payload[:pos + 1] + bytes([count + 1]) + payload[end:] + footer
+            return corrupted + struct.pack('<Q', _crc64(corrupted))
+    assert False, 'no chunks count in the payload'
+
+
+def test_restore_corrupted_chunks():
+    with Env().getClusterConnectionIfNeeded() as r:
+        for encoding in ['COMPRESSED', 'UNCOMPRESSED']:
+            key = 'corrupted{a}:' + encoding
+            r.execute_command('ts.create', key, 'CHUNK_SIZE', 128, encoding, 'LABELS', 'name', 'corrupted')
+            r.execute_command('ts.create', key + ':max', encoding)
+            r.execute_command('ts.createrule', key, key + ':max', 'AGGREGATION', 'max', 100)
+            for i in range(200):
+                r.execute_command('ts.add', key, 1000 + i * 7, i * 1.5)
+            dump = r.execute_command('dump', key)
+            assert _crc64(dump[:-8]) == struct.unpack('<Q', dump[-8:])[0]
+
+            # a blob missing a chunk is rejected, the series is released along the way
+            with pytest.raises(redis.ResponseError):
+                r.execute_command('restore', key + ':copy', 0, _corrupt_chunks_count(dump))
+            assert r.execute_command('exists', key + ':copy') == 0
+            assert r.execute_command('ts.queryindex', 'name=corrupted') == [key.encode()]
+
+            r.execute_command('restore', key + ':copy', 0, dump)
+            assert r.execute_command('ts.range', key + ':copy', '-', '+') == \
+                   r.execute_command('ts.range', key, '-', '+')
+            r.execute_command('del', key, key + ':copy', key + ':max')
+
+def test_maddseries():
+    with Env().getClusterConnectionIfNeeded() as r:
+        r.execute_command('ts.create', 'bulk{a}')
+        payload = b''.join(struct.pack('=Qd', 100 + i, i * 0.5) for i in range(10))
+        assert r.execute_command('ts.maddseries', 'bulk{a}', payload) == 10
+        assert r.execute_command('ts.range', 'bulk{a}', '-', '+', 'FORMAT', 'BINARY') == payload
+
+        # a batch is appended entirely or not at all
+        stale = struct.pack('=Qd', 200, 1) + struct.pack('=Qd', 109, 1)
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('ts.maddseries', 'bulk{a}', stale)
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('ts.maddseries', 'bulk{a}', payload[:20])
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('ts.maddseries', 'missing{a}', payload)
+        assert _get_ts_info(r, 'bulk{a}').total_samples == 10
+
+        # the samples have to be newer than the latest one even once it's deleted
+        r.execute_command('ts.del', 'bulk{a}', 0, 200)
+        assert _get_ts_info(r, 'bulk{a}').total_samples == 0
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('ts.maddseries', 'bulk{a}', payload)
+        assert r.execute_command('ts.maddseries', 'bulk{a}', struct.pack('=Qd', 110, 1)) == 1
+
+def test_aof_rewrite():
+    env = Env(useAof=True)
+    env.skipOnCluster()
+    r = env.getConnection()
+    r.execute_command('ts.create', 'plain', 'RETENTION', 0, 'CHUNK_SIZE', 128, 'DUPLICATE_POLICY', 'LAST',
+                      'LABELS', 'name', 'plain', 'kind', 'aof')
+    r.execute_command('ts.create', 'uncompressed', 'UNCOMPRESSED', 'LABELS', 'name', 'uncompressed')
+    r.execute_command('ts.create', 'empty')
+    r.execute_command('ts.create', 'source')
+    r.execute_command('ts.create', 'compacted')
+    r.execute_command('ts.createrule', 'source', 'compacted', 'AGGREGATION', 'avg', 10)
+    for i in range(10000):
+        r.execute_command('ts.madd', 'plain', 1000 + i, i, 'uncompressed', 1000 + i, -i, 'source', 1000 + i, i)
+
+    keys = ['plain', 'uncompressed', 'empty', 'source', 'compacted']
+    before = {key: (r.execute_command('ts.range', key, '-', '+'), _get_ts_info(r, key)) for key in keys}
+
+    r.execute_command('bgrewriteaof')
+    while r.execute_command('info', 'persistence')['aof_rewrite_in_progress']:
+        time.sleep(0.1)
+    r.execute_command('debug', 'loadaof')
+
+    for key in keys:
+        samples, info = before[key]
+        assert r.execute_command('ts.range', key, '-', '+') == samples
+        restored = _get_ts_info(r, key)
+        assert restored.total_samples == info.total_samples
+        assert restored.labels == info.labels
+        assert restored.retention_msecs == info.retention_msecs
+        assert restored.chunk_type == info.chunk_type
+        assert restored.chunk_size_bytes == info.chunk_size_bytes
+        assert restored.rules == info.rules
+        assert restored.sourceKey == info.sourceKey
+    assert r.execute_command('ts.queryindex', 'kind=aof') == [b'plain']
+
+    # the source keeps its partial bucket
+    r.execute_command('ts.add', 'source', 1000 + 10000 + 10, 0)
+    assert r.execute_command('ts.get', 'compacted')[0] == 1000 + 9990
+
 def test_empty_series():
     with Env().getClusterConnectionIfNeeded() as r:
         assert r.execute_command('TS.CREATE', 'tester')
@@ -63,3 +63,24 @@ def test_alter_key(self):
             [overrided_ts, str(overrided_ts).encode("ascii")]]
         r.execute_command('TS.ADD', key, date_ranges[0][0] + 10, 10)
         assert r.execute_command('TS.RANGE', key, overrided_ts, overrided_ts) == [[overrided_ts, b'10']]
+
+
+def test_alter_labels_reindex():
+    with Env().getClusterConnectionIfNeeded() as r:
+        assert r.execute_command('TS.CREATE', 'alter{1}-a', 'LABELS', 'dc', 'east', 'host', 'a', 'tier', '1')
+        assert r.execute_command('TS.CREATE', 'alter{1}-b', 'LABELS', 'dc', 'east', 'host', 'b')
+
+        # change one value, keep one label, drop one label and add a new one
+        assert r.execute_command('TS.ALTER', 'alter{1}-a', 'LABELS', 'dc', 'west', 'host', 'a', 'rack', '7')
+        assert r.execute_command('TS.QUERYINDEX', 'dc=east') == [b'alter{1}-b']
+        assert r.execute_command('TS.QUERYINDEX', 'dc=west') == [b'alter{1}-a']
+        assert r.execute_command('TS.QUERYINDEX', 'host=a') == [b'alter{1}-a']
+        assert r.execute_command('TS.QUERYINDEX', 'host=(a,b)', 'tier=') == [b'alter{1}-a', b'alter{1}-b']
+        assert r.execute_command('TS.QUERYINDEX', 'rack=7') == [b'alter{1}-a']
+        assert r.execute_command('TS.QUERYINDEX', 'tier=1') == []
+
+        # removing all the labels unindexes the series
+        assert r.execute_command('TS.ALTER', 'alter{1}-a', 'LABELS')
+        assert r.execute_command('TS.QUERYINDEX', 'dc=(east,west)') == [b'alter{1}-b']
+        assert r.execute_command('TS.ALTER', 'alter{1}-a', 'LABELS', 'dc', 'east')
+        assert r.execute_command('TS.QUERYINDEX', 'dc=east') == [b'alter{1}-a', b'alter{1}-b']
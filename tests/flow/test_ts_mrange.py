@@ -1,6 +1,7 @@
 import pytest
 import redis
 import time
+import struct
 from utils import Env, set_hertz
 from test_helper_classes import _insert_data
 
@@ -190,6 +191,25 @@ def test_mrange_withlabels():
         assert len(actual_result[2][1]) == 3
 
 
+def test_mrange_selected_labels_lookup():
+    with Env().getClusterConnectionIfNeeded() as r:
+        assert r.execute_command('TS.CREATE', 'sl{1}', 'LABELS', 'zone', 'z1', 'Host', 'h1', 'app', 'web',
+                                 'host', 'h2', 'dc', 'east')
+        r.execute_command('TS.ADD', 'sl{1}', 1, 1)
+
+        # selected labels are matched case insensitively, the first matching label is returned
+        actual_result = r.execute_command('TS.mrange', 0, 10, 'SELECTED_LABELS', 'dc', 'HOST', 'missing', 'app',
+                                          'FILTER', 'dc=east')
+        assert actual_result == [[b'sl{1}', [[b'dc', b'east'], [b'Host', b'h1'], [b'missing', None], [b'app', b'web']],
+                                  [[1, b'1']]]]
+
+        # the group by label is matched exactly
+        actual_result = r.execute_command('TS.mrange', 0, 10, 'FILTER', 'dc=east', 'GROUPBY', 'host', 'REDUCE', 'max')
+        assert actual_result[0][0] == b'host=h2'
+        actual_result = r.execute_command('TS.mrange', 0, 10, 'FILTER', 'dc=east', 'GROUPBY', 'Host', 'REDUCE', 'max')
+        assert actual_result[0][0] == b'Host=h1'
+
+
 def test_multilabel_filter():
     with Env().getClusterConnectionIfNeeded() as r:
         assert r.execute_command('TS.CREATE', 'tester1', 'LABELS', 'name', 'bob', 'class', 'middle', 'generation', 'x')
@@ -227,3 +247,99 @@ def test_large_key_value_pairs():
         for kv_label in kv_labels:
             res = r.execute_command('TS.MRANGE', '-', '+', 'FILTER', kv_label1)
             assert len(res) == number_series
+
+def test_mrange_format_binary():
+    start_ts = 1511885909
+    samples_count = 50
+    env = Env()
+
+    with env.getClusterConnectionIfNeeded() as r:
+        assert r.execute_command('TS.CREATE', 'tester1', 'LABELS', 'name', 'bob', 'generation', 'x')
+        assert r.execute_command('TS.CREATE', 'tester2', 'LABELS', 'name', 'rudy', 'generation', 'x')
+        _insert_data(r, 'tester1', start_ts, samples_count, 5)
+        _insert_data(r, 'tester2', start_ts, samples_count, 15)
+
+        actual_result = r.execute_command('TS.mrange', start_ts, start_ts + samples_count, 'FORMAT', 'BINARY',
+                                          'FILTER', 'generation=x')
+        actual_result = sorted([[key, labels, [list(s) for s in struct.iter_unpack('<Qd', data)]]
+                                for key, labels, data in actual_result])
+        expected_result = [[b'tester1', [], [[start_ts + i, 5.0] for i in range(samples_count)]],
+                           [b'tester2', [], [[start_ts + i, 15.0] for i in range(samples_count)]]]
+        env.assertEqual(actual_result, expected_result)
+
+def test_mrange_aggregation_matches_range():
+    env = Env()
+
+    with env.getClusterConnectionIfNeeded() as r:
+        for i in range(6):
+            key = 'pushdown{}'.format(i)
+            assert r.execute_command('TS.CREATE', key, 'UNCOMPRESSED' if i % 2 else 'COMPRESSED',
+                                     'LABELS', 'type', 'pushdown', 'group', i % 2)
+            for ts in range(0, 3000, 7):
+                r.execute_command('TS.ADD', key, ts, (ts * (i + 1)) % 101)
+
+        queries = [['AGGREGATION', 'avg', 100],
+                   ['COUNT', 5, 'AGGREGATION', 'max', 250],
+                   ['FILTER_BY_VALUE', 10, 60, 'AGGREGATION', 'count', 500],
+                   ['FILTER_BY_VALUE', 10, 60, 'COUNT', 7]]
+        for command, single in [('TS.MRANGE', 'TS.RANGE'), ('TS.MREVRANGE', 'TS.REVRANGE')]:
+            for query in queries:
+                actual = r.execute_command(command, 100, 2500, *query, 'FILTER', 'type=pushdown')
+                expected = [[key, [], r.execute_command(single, key, 100, 2500, *query)]
+                            for key in sorted(key for key, _, _ in actual)]
+                env.assertEqual(len(actual), 6)
+                env.assertEqual(sorted(actual), expected)
+
+
+def test_mrange_many_series():
+    env = Env()
+
+    with env.getClusterConnectionIfNeeded() as r:
+        for i in range(200):
+            key = 'many{}'.format(i)
+            assert r.execute_command('TS.CREATE', key, 'LABELS', 'type', 'many')
+            r.execute_command('TS.ADD', key, i, i)
+            r.execute_command('TS.ADD', key, i + 1000, i * 2)
+
+        actual = r.execute_command('TS.MRANGE', '-', '+', 'FILTER', 'type=many')
+        env.assertEqual(len(actual), 200)
+        for key, labels, samples in actual:
+            i = int(key.decode()[len('many'):])
+            env.assertEqual(samples, [[i, b'%d' % i], [i + 1000, b'%d' % (i * 2)]])
+
+        env.assertEqual(r.execute_command('TS.MRANGE', '-', '+', 'FILTER', 'type=none'), [])
+
+
+def test_mrange_uncompressed_matches_compressed():
+    env = Env()
+
+    with env.getClusterConnectionIfNeeded() as r:
+        # twin series hold the same samples over several chunks in both encodings
+        for i in range(4):
+            for encoding in ['COMPRESSED', 'UNCOMPRESSED']:
+                key = 'twin{}:{}'.format(i, encoding)
+                assert r.execute_command('TS.CREATE', key, encoding, 'CHUNK_SIZE', 128,
+                                         'LABELS', 'type', 'twin', 'twin', i, 'encoding', encoding)
+                for ts in range(0, 2000, 3):
+                    r.execute_command('TS.ADD', key, 1000 + ts, ((ts * (i + 3)) % 97) / 4.0)
+
+        queries = [[],
+                   ['COUNT', 10],
+                   ['AGGREGATION', 'avg', 100],
+                   ['AGGREGATION', 'sum', 250, 'COUNT', 3],
+                   ['FILTER_BY_VALUE', 5, 15]]
+        for command in ['TS.MRANGE', 'TS.MREVRANGE']:
+            for start, end in [('-', '+'), (1500, 2500), (4000, 5000)]:
+                for query in queries:
+                    replies = {}
+                    for encoding in ['COMPRESSED', 'UNCOMPRESSED']:
+                        reply = r.execute_command(command, start, end, *query,
+                                                  'FILTER', 'type=twin', 'encoding=' + encoding)
+                        env.assertEqual(len(reply), 4)
+                        replies[encoding] = sorted([key.split(b':')[0], samples] for key, _, samples in reply)
+                    env.assertEqual(replies['UNCOMPRESSED'], replies['COMPRESSED'])
+
+        # the samples are in order across the chunks of the uncompressed series
+        reply = r.execute_command('TS.MREVRANGE', '-', '+', 'COUNT', 5, 'FILTER', 'type=twin', 'twin=0',
+                                  'encoding=UNCOMPRESSED')
+        env.assertEqual([ts for ts, _ in reply[0][2]], [2998, 2995, 2992, 2989, 2986])
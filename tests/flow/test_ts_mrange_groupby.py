@@ -75,6 +75,26 @@ def test_groupby_reduce():
         serie2_values = serie2[2]
         env.assertEqual(serie2_values, [[1, b'100']])
 
+def test_groupby_reduce_percentile():
+    env = Env()
+    with env.getClusterConnectionIfNeeded() as r:
+        for i in range(1, 101):
+            assert r.execute_command('TS.ADD', 's{}'.format(i), 1, i, 'LABELS', 'metric_family', 'cpu')
+            assert r.execute_command('TS.ADD', 's{}'.format(i), 2, i * 10)
+
+        for reducer, expected in [('p50', 50), ('p90', 90), ('p99', 99)]:
+            actual_result = r.execute_command(
+                'TS.mrange', '-', '+', 'WITHLABELS', 'FILTER', 'metric_family=cpu', 'GROUPBY', 'metric_family',
+                'REDUCE', reducer)
+            env.assertEqual(len(actual_result), 1)
+            env.assertEqual(actual_result[0][1][1], [b'__reducer__', reducer.encode('ascii')])
+            samples = actual_result[0][2]
+            env.assertEqual([sample[0] for sample in samples], [1, 2])
+            # the sketch guarantees a relative accuracy of 1%
+            assert abs(float(samples[0][1]) - expected) <= expected * 0.01
+            assert abs(float(samples[1][1]) - expected * 10) <= expected * 10 * 0.01
+
+
 def test_groupby_reduce_empty():
     env = Env()
     with env.getClusterConnectionIfNeeded() as r:
@@ -122,6 +142,100 @@ def test_groupby_reduce_multiple_groups():
         env.assertEqual(serie2_labels[2][0], b'__source__')
         env.assertEqual(serie2_labels[2][1], b's3')
 
+def test_groupby_reduce_many_series():
+    env = Env()
+    with env.getClusterConnectionIfNeeded() as r:
+        expected = defaultdict(list)
+        for i in range(50):
+            key = 'many{1}:%d' % i
+            r.execute_command('TS.CREATE', key, 'LABELS', 'fleet', 'many', 'parity', i % 2)
+            # every series has its own subset of the timestamps
+            for ts in range(i % 7, 100, 1 + i % 5):
+                r.execute_command('TS.ADD', key, ts, i)
+                expected[ts].append(i)
+
+        actual_result = r.execute_command('TS.mrange', '-', '+', 'FILTER', 'fleet=many', 'GROUPBY', 'fleet',
+                                          'REDUCE', 'sum')
+        env.assertEqual(actual_result[0][2], [[ts, str(sum(expected[ts])).encode()] for ts in sorted(expected)])
+
+        actual_result = r.execute_command('TS.mrevrange', '-', '+', 'COUNT', 5, 'FILTER', 'fleet=many', 'GROUPBY',
+                                          'fleet', 'REDUCE', 'min')
+        env.assertEqual(actual_result[0][2],
+                        [[ts, str(min(expected[ts])).encode()] for ts in sorted(expected, reverse=True)[:5]])
+
+        actual_result = r.execute_command('TS.mrange', '-', '+', 'AGGREGATION', 'max', 10, 'FILTER', 'fleet=many',
+                                          'GROUPBY', 'parity', 'REDUCE', 'max')
+        env.assertEqual([group[0] for group in actual_result], [b'parity=0', b'parity=1'])
+        env.assertEqual(actual_result[1][2], [[bucket, b'49'] for bucket in range(0, 100, 10)])
+
+
+def test_groupby_reduce_one_pass_reducers():
+    env = Env()
+    with env.getClusterConnectionIfNeeded() as r:
+        # created out of key order, `d` only has a sample at timestamp 1
+        values = {'stat{1}:d': {1: 4}, 'stat{1}:a': {0: 1, 1: 10, 2: 7}, 'stat{1}:b': {0: 3, 1: 20},
+                  'stat{1}:c': {0: 8, 1: 60, 2: 7, 3: 5}}
+        for key, samples in values.items():
+            r.execute_command('TS.CREATE', key, 'LABELS', 'kind', 'stat')
+            for ts, value in samples.items():
+                r.execute_command('TS.ADD', key, ts, value)
+        by_ts = defaultdict(list)
+        for samples in values.values():
+            for ts, value in samples.items():
+                by_ts[ts].append(value)
+
+        def reduce(reducer):
+            result = r.execute_command('TS.mrange', '-', '+', 'WITHLABELS', 'FILTER', 'kind=stat', 'GROUPBY', 'kind',
+                                       'REDUCE', reducer)
+            env.assertEqual(len(result), 1)
+            env.assertEqual(result[0][1][1], [b'__reducer__', reducer.encode('ascii')])
+            env.assertEqual([sample[0] for sample in result[0][2]], sorted(by_ts))
+            return [float(sample[1]) for sample in result[0][2]]
+
+        def std(samples, ddof):
+            mean = sum(samples) / len(samples)
+            return (sum((x - mean) ** 2 for x in samples) / (len(samples) - ddof)) ** 0.5
+
+        env.assertEqual(reduce('count'), [len(by_ts[ts]) for ts in sorted(by_ts)])
+        env.assertEqual(reduce('avg'), [sum(by_ts[ts]) / len(by_ts[ts]) for ts in sorted(by_ts)])
+        env.assertEqual(reduce('range'), [max(by_ts[ts]) - min(by_ts[ts]) for ts in sorted(by_ts)])
+        for actual, ts in zip(reduce('std.p'), sorted(by_ts)):
+            assert abs(actual - std(by_ts[ts], 0)) < 1e-9
+        for actual, ts in zip(reduce('std.s'), sorted(by_ts)):
+            assert abs(actual - (std(by_ts[ts], 1) if len(by_ts[ts]) > 1 else 0)) < 1e-9
+        # the value of the series with the greatest key among those with a sample at the timestamp
+        env.assertEqual(reduce('last'), [8, 4, 7, 5])
+
+
+def test_groupby_reduce_across_shards():
+    env = Env()
+    with env.getClusterConnectionIfNeeded() as r:
+        keys = ['spread{}'.format(i) for i in range(12)]
+        for i, key in enumerate(keys):
+            r.execute_command('TS.CREATE', key, 'LABELS', 'kind', 'spread', 'team', 'team{}'.format(i % 3))
+            for ts in range(i, 400, 3):
+                r.execute_command('TS.ADD', key, ts, (ts * 7 + i) % 23)
+
+        reducers = {'sum': sum, 'min': min, 'max': max, 'count': len,
+                    'avg': lambda values: sum(values) / len(values),
+                    'range': lambda values: max(values) - min(values),
+                    # the value of the greatest key, whichever shard answers first
+                    'last': lambda values: values[-1]}
+        for reducer, func in reducers.items():
+            result = r.execute_command('TS.MRANGE', 0, 350, 'AGGREGATION', 'sum', 50, 'FILTER', 'kind=spread',
+                                       'GROUPBY', 'team', 'REDUCE', reducer)
+            env.assertEqual(len(result), 3)
+            for name, _, samples in result:
+                team = name.decode().split('=')[1]
+                by_ts = defaultdict(list)
+                for i, key in sorted(enumerate(keys), key=lambda item: item[1]):
+                    if 'team{}'.format(i % 3) == team:
+                        for ts, value in r.execute_command('TS.RANGE', key, 0, 350, 'AGGREGATION', 'sum', 50):
+                            by_ts[ts].append(float(value))
+                env.assertEqual([ts for ts, _ in samples], sorted(by_ts))
+                for ts, value in samples:
+                    assert abs(float(value) - func(by_ts[ts])) < 1e-9
+
 def truncate_month(date):
     return "-".join(date.split("-")[0:2])
 
@@ -54,3 +54,131 @@ def test_large_key_value_pairs():
         for kv_label in kv_labels:
             res = r.execute_command('TS.QUERYINDEX', kv_label1)
             assert len(res) == number_series
+
+def test_dense_index_with_deletes_and_renames():
+    with Env().getClusterConnectionIfNeeded() as r:
+        # enough series with the same label to store it as a bitmap
+        number_series = 5000
+        pipe = r.pipeline(transaction=False)
+        for i in range(number_series):
+            pipe.execute_command('TS.CREATE', 'dense{{1}}-{}'.format(i), 'LABELS', 'dense', '1', 'parity', i % 2)
+        pipe.execute()
+
+        assert len(r.execute_command('TS.QUERYINDEX', 'dense=1')) == number_series
+        assert len(r.execute_command('TS.QUERYINDEX', 'dense=1', 'parity=0')) == number_series // 2
+
+        for i in range(0, number_series, 3):
+            r.delete('dense{{1}}-{}'.format(i))
+        expected = [i for i in range(number_series) if i % 3 != 0]
+        assert sorted(r.execute_command('TS.QUERYINDEX', 'dense=1', 'parity!=1')) == \
+               sorted([b'dense{1}-%d' % i for i in expected if i % 2 == 0])
+
+        r.rename('dense{1}-1', 'dense{1}-renamed')
+        res = r.execute_command('TS.QUERYINDEX', 'dense=1', 'parity=1')
+        assert b'dense{1}-renamed' in res
+        assert b'dense{1}-1' not in res
+        assert len(res) == len([i for i in expected if i % 2 == 1])
+
+        # ids of deleted series are reused by new ones
+        r.execute_command('TS.CREATE', 'dense{1}-new', 'LABELS', 'dense', '2')
+        assert r.execute_command('TS.QUERYINDEX', 'dense=2') == [b'dense{1}-new']
+
+def test_regex_filters():
+    with Env().getClusterConnectionIfNeeded() as r:
+        r.execute_command('TS.CREATE', 'rx{1}-1', 'LABELS', 'host', 'web-01', 'dc', 'east')
+        r.execute_command('TS.CREATE', 'rx{1}-2', 'LABELS', 'host', 'web-02', 'dc', 'west')
+        r.execute_command('TS.CREATE', 'rx{1}-3', 'LABELS', 'host', 'db-01', 'dc', 'east')
+        r.execute_command('TS.CREATE', 'rx{1}-4', 'LABELS', 'dc', 'east')
+
+        def assert_data(query, expected_data):
+            assert sorted(expected_data) == sorted(r.execute_command('TS.QUERYINDEX', *query))
+
+        assert_data(['host=~web-.*'], [b'rx{1}-1', b'rx{1}-2'])
+        assert_data(['host=~.*'], [b'rx{1}-1', b'rx{1}-2', b'rx{1}-3'])
+        assert_data(['host=~.*-01'], [b'rx{1}-1', b'rx{1}-3'])
+        assert_data(['host=~web|db-01'], [b'rx{1}-3'])
+        assert_data(['host=~(web|db)-01'], [b'rx{1}-1', b'rx{1}-3'])
+        assert_data(['host=~web-0[2-9]'], [b'rx{1}-2'])
+        # the whole value has to match
+        assert_data(['host=~web'], [])
+        assert_data(['dc=east', 'host!~web-.*'], [b'rx{1}-3', b'rx{1}-4'])
+        assert_data(['dc=~e.*t', 'host=~db.*'], [b'rx{1}-3'])
+        # the regex may contain the filter operators
+        assert_data(['host=~web-0(1|=)'], [b'rx{1}-1'])
+        # not a regex, l!=~x doesn't equal the value ~x
+        r.execute_command('TS.CREATE', 'rx{1}-5', 'LABELS', 'dc', '~east')
+        assert_data(['dc=~.*', 'dc!=~east'], [b'rx{1}-1', b'rx{1}-2', b'rx{1}-3', b'rx{1}-4'])
+        assert_data(['dc=~.*', 'dc!=~x'], [b'rx{1}-1', b'rx{1}-2', b'rx{1}-3', b'rx{1}-4', b'rx{1}-5'])
+
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('TS.QUERYINDEX', 'host=~web-(')
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('TS.QUERYINDEX', 'host!~web-.*')
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('TS.QUERYINDEX', '=~web')
+
+
+def test_index_stats():
+    env = Env()
+    env.skipOnCluster()
+    with env.getConnection() as r:
+        r.execute_command('FLUSHALL')
+        r.execute_command('TS.CREATE', 'st-1', 'LABELS', 'host', 'a', 'dc', 'east', 'id', '1')
+        r.execute_command('TS.CREATE', 'st-2', 'LABELS', 'host', 'a', 'dc', 'west', 'id', '2')
+        r.execute_command('TS.CREATE', 'st-3', 'LABELS', 'host', 'b', 'dc', 'east', 'id', '3')
+        r.execute_command('TS.CREATE', 'st-4')
+
+        stats = r.execute_command('TS.INDEXSTATS')
+        assert stats[:8] == [b'seriesCount', 3, b'labelsCount', 3, b'labelValuesCount', 7, b'memoryUsage', stats[7]]
+        assert stats[7] > 0
+        assert stats[9] == [[b'id', 3, 3], [b'dc', 2, 3], [b'host', 2, 3]]
+        assert r.execute_command('TS.INDEXSTATS', 'TOP', 1)[9] == [[b'id', 3, 3]]
+        # TOP is bounded by the size of the index
+        assert r.execute_command('TS.INDEXSTATS', 'TOP', 999999999999)[9] == stats[9]
+        assert r.execute_command('TS.INDEXSTATS', 'LABEL', 'dc', 'TOP', 999999999999)[7] == \
+               [[b'east', 2], [b'west', 1]]
+
+        assert r.execute_command('TS.INDEXSTATS', 'LABEL', 'dc') == \
+               [b'label', b'dc', b'valuesCount', 2, b'seriesCount', 3, b'topValues', [[b'east', 2], [b'west', 1]]]
+        assert r.execute_command('TS.INDEXSTATS', 'label', 'dc', 'top', 1)[7] == [[b'east', 2]]
+        assert r.execute_command('TS.INDEXSTATS', 'LABEL', 'missing') == \
+               [b'label', b'missing', b'valuesCount', 0, b'seriesCount', 0, b'topValues', []]
+
+        # the statistics follow the label changes and deletions
+        r.execute_command('TS.ALTER', 'st-2', 'LABELS', 'host', 'a', 'dc', 'east')
+        r.execute_command('DEL', 'st-3')
+        stats = r.execute_command('TS.INDEXSTATS')
+        assert stats[:6] == [b'seriesCount', 2, b'labelsCount', 3, b'labelValuesCount', 3]
+        assert stats[9] == [[b'dc', 1, 2], [b'host', 1, 2], [b'id', 1, 1]]
+
+        r.execute_command('FLUSHALL')
+        assert r.execute_command('TS.INDEXSTATS')[:6] == [b'seriesCount', 0, b'labelsCount', 0,
+                                                        b'labelValuesCount', 0]
+
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('TS.INDEXSTATS', 'TOP', -1)
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('TS.INDEXSTATS', 'TOP')
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('TS.INDEXSTATS', 'LIMIT', 1)
+
+
+def test_index_rebuilt_on_reload():
+    env = Env()
+    env.skipOnCluster()
+    with env.getConnection() as r:
+        r.execute_command('FLUSHALL')
+        for i in range(100):
+            r.execute_command('TS.CREATE', 'reload-{}'.format(i), 'LABELS', 'mod3', i % 3, 'mod7', i % 7, 'id', i)
+        r.execute_command('TS.CREATE', 'reload-unlabeled')
+        queries = [['mod3=0'], ['mod3=1', 'mod7=(2,3)'], ['id=42'], ['mod7=1', 'id!=1'], ['mod3=(0,1)']]
+        before = [sorted(r.execute_command('TS.QUERYINDEX', *query)) for query in queries]
+        stats = r.execute_command('TS.INDEXSTATS')
+
+        r.execute_command('DEBUG', 'RELOAD')
+
+        assert [sorted(r.execute_command('TS.QUERYINDEX', *query)) for query in queries] == before
+        reloaded = r.execute_command('TS.INDEXSTATS')
+        assert reloaded[:6] == stats[:6]
+        assert reloaded[9] == stats[9]
+        assert r.execute_command('TS.INDEXSTATS', 'LABEL', 'mod3')[3] == 3
@@ -1,4 +1,5 @@
 import math
+import struct
 
 import pytest
 import redis
@@ -102,6 +103,83 @@ def test_range_with_agg_query():
                                      'count', -1)
 
 
+def _time_weighted_buckets(fromTS=10, toTS=50):
+    # same samples as _insert_agg_data
+    values = (31, 41, 59, 26, 53, 58, 97, 93, 23, 84)
+    buckets = []
+    for bucket in range(fromTS, toTS, 10):
+        samples = [(ts, ts // 10 * 100 + values[ts % 10]) for ts in range(bucket, bucket + 10)]
+        pairs = list(zip(samples, samples[1:]))
+        area = sum((v1 + v2) / 2 * (t2 - t1) for (t1, v1), (t2, v2) in pairs)
+        increase = sum(v2 - v1 if v2 >= v1 else v2 for (_, v1), (_, v2) in pairs)
+        span = samples[-1][0] - samples[0][0]
+        buckets.append({'ts': bucket, 'twa': area / span, 'increase': increase, 'rate': increase * 1000 / span})
+    return buckets
+
+
+def test_agg_twa_rate_increase():
+    with Env().getClusterConnectionIfNeeded() as r:
+        expected = _time_weighted_buckets()
+        for agg_type in ['twa', 'rate', 'increase']:
+            agg_key = _insert_agg_data(r, 'tester{a}_%s' % agg_type, agg_type)
+            actual_result = r.execute_command('TS.RANGE', agg_key, 10, 50)
+            assert [sample[0] for sample in actual_result] == [bucket['ts'] for bucket in expected]
+            for bucket, sample in zip(expected, actual_result):
+                assert abs(bucket[agg_type] - float(sample[1])) < ALLOWED_ERROR
+
+            # computed at query time, in both directions
+            actual_result = r.execute_command('TS.RANGE', 'tester{a}_%s' % agg_type, 10, 49,
+                                              'AGGREGATION', agg_type, 10)
+            reversed_result = r.execute_command('TS.REVRANGE', 'tester{a}_%s' % agg_type, 10, 49,
+                                                'AGGREGATION', agg_type, 10)
+            assert reversed_result == actual_result[::-1]
+            for bucket, sample in zip(expected, actual_result):
+                assert abs(bucket[agg_type] - float(sample[1])) < ALLOWED_ERROR
+
+        # a single sample has no rate
+        assert r.execute_command('TS.RANGE', 'tester{a}_rate', 1000, 2000, 'AGGREGATION', 'rate', 10) == []
+
+
+def test_rate_rule_upsert_single_sample_bucket():
+    with Env().getClusterConnectionIfNeeded() as r:
+        assert r.execute_command('TS.CREATE', 'counter{a}', 'DUPLICATE_POLICY', 'LAST')
+        assert r.execute_command('TS.CREATE', 'counter{a}_rate')
+        assert r.execute_command('TS.CREATERULE', 'counter{a}', 'counter{a}_rate', 'AGGREGATION', 'rate', 100)
+        for ts, value in [(10, 1), (20, 2), (150, 5), (250, 7), (350, 9)]:
+            r.execute_command('TS.ADD', 'counter{a}', ts, value)
+        assert r.execute_command('TS.RANGE', 'counter{a}_rate', '-', '+') == [[0, b'100']]
+
+        # an upsert into a bucket of a single sample doesn't give it a rate
+        r.execute_command('TS.ADD', 'counter{a}', 150, 6)
+        assert r.execute_command('TS.RANGE', 'counter{a}_rate', '-', '+') == [[0, b'100']]
+
+        r.execute_command('TS.ADD', 'counter{a}', 160, 8)
+        assert r.execute_command('TS.RANGE', 'counter{a}_rate', '-', '+') == [[0, b'100'], [100, b'200']]
+
+        # the rate of the bucket is removed once it's down to a single sample again
+        r.execute_command('TS.DEL', 'counter{a}', 160, 160)
+        r.execute_command('TS.ADD', 'counter{a}', 150, 7)
+        assert r.execute_command('TS.RANGE', 'counter{a}_rate', '-', '+') == [[0, b'100']]
+
+
+def test_agg_percentiles():
+    with Env().getClusterConnectionIfNeeded() as r:
+        values = [(i * 7919) % 1000 + 1 for i in range(1000)]
+        assert r.execute_command('TS.CREATE', 'tester')
+        for ts, value in enumerate(values):
+            r.execute_command('TS.ADD', 'tester', ts, value)
+
+        for agg_type, quantile in [('p50', 0.5), ('p90', 0.9), ('p99', 0.99)]:
+            for bucket in [100, 1000]:
+                actual_result = r.execute_command('TS.RANGE', 'tester', 0, 999, 'AGGREGATION', agg_type, bucket)
+                assert len(actual_result) == 1000 // bucket
+                for ts, value in actual_result:
+                    samples = sorted(values[ts:ts + bucket])
+                    expected = samples[int(quantile * (len(samples) - 1))]
+                    # the sketch guarantees a relative accuracy of 1%
+                    assert abs(float(value) - expected) <= expected * 0.01 + ALLOWED_ERROR
+
+
 def test_agg_std_p():
     with Env().getClusterConnectionIfNeeded() as r:
         agg_key = _insert_agg_data(r, 'tester{a}', 'std.p')
@@ -322,3 +400,86 @@ def test_filter_by():
                                 'FILTER_BY_TS', start_ts+1021, start_ts+1022, start_ts+1023, start_ts+1025, start_ts+1029,
                                 'FILTER_BY_VALUE', 1022, 1025)
         env.assertEqual(res, [[start_ts+1022, b'1022'], [start_ts+1023, b'1023'], [start_ts+1025, b'1025']])
+
+def test_range_format_binary():
+    start_ts = 1511885909
+    samples_count = 100
+    env = Env()
+    with env.getClusterConnectionIfNeeded() as r:
+        assert r.execute_command('TS.CREATE', 'tester')
+        _insert_data(r, 'tester', start_ts, samples_count, list(i for i in range(samples_count)))
+
+        res = r.execute_command('ts.range', 'tester', start_ts, -1, 'FORMAT', 'BINARY')
+        env.assertEqual(len(res), samples_count * 16)
+        samples = [list(s) for s in struct.iter_unpack('<Qd', res)]
+        env.assertEqual(samples, [[start_ts + i, float(i)] for i in range(samples_count)])
+
+        res = r.execute_command('ts.revrange', 'tester', start_ts, -1, 'COUNT', 3, 'FORMAT', 'BINARY')
+        samples = [list(s) for s in struct.iter_unpack('<Qd', res)]
+        env.assertEqual(samples, [[start_ts + samples_count - 1 - i, float(samples_count - 1 - i)] for i in range(3)])
+
+        res = r.execute_command('ts.range', 'tester', start_ts, -1, 'AGGREGATION', 'sum', 10, 'FORMAT', 'BINARY')
+        expected = [[int(s[0]), float(s[1])] for s in
+                    r.execute_command('ts.range', 'tester', start_ts, -1, 'AGGREGATION', 'sum', 10)]
+        env.assertEqual([list(s) for s in struct.iter_unpack('<Qd', res)], expected)
+
+        env.assertEqual(r.execute_command('ts.range', 'tester', 0, 10, 'FORMAT', 'BINARY'), b'')
+
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', '-', '+', 'FORMAT')
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', '-', '+', 'FORMAT', 'JSON')
+
+
+def test_range_align():
+    env = Env()
+    with env.getClusterConnectionIfNeeded() as r:
+        assert r.execute_command('TS.CREATE', 'tester')
+        for ts, val in [(1, 1), (3, 2), (12, 3), (45, 4), (47, 5)]:
+            r.execute_command('TS.ADD', 'tester', ts, val)
+
+        assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10) == \
+               [[0, b'3'], [10, b'3'], [40, b'9']]
+        expected = [[0, b'3'], [5, b'3'], [45, b'9']]
+        assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10, 'ALIGN', 5) == expected
+        assert r.execute_command('TS.RANGE', 'tester', 5, 50, 'AGGREGATION', 'sum', 10, 'ALIGN', 'start') == \
+               expected[1:]
+        assert r.execute_command('TS.RANGE', 'tester', 0, 55, 'AGGREGATION', 'sum', 10, 'ALIGN', '+') == expected
+        assert r.execute_command('TS.REVRANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10, 'ALIGN', 25) == \
+               expected[::-1]
+
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'ALIGN', 5)
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10, 'ALIGN')
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10, 'ALIGN', 'middle')
+
+
+def test_range_empty():
+    env = Env()
+    with env.getClusterConnectionIfNeeded() as r:
+        assert r.execute_command('TS.CREATE', 'tester')
+        for ts, val in [(1, 1), (3, 2), (12, 3), (45, 4), (47, 5)]:
+            r.execute_command('TS.ADD', 'tester', ts, val)
+
+        assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10, 'EMPTY') == \
+               [[0, b'3'], [10, b'3'], [20, b'0'], [30, b'0'], [40, b'9']]
+        assert r.execute_command('TS.REVRANGE', 'tester', 0, 50, 'AGGREGATION', 'max', 10, 'EMPTY') == \
+               [[40, b'5'], [30, b'nan'], [20, b'nan'], [10, b'3'], [0, b'2']]
+        assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'max', 10, 'EMPTY', 'PREV') == \
+               [[0, b'2'], [10, b'3'], [20, b'3'], [30, b'3'], [40, b'5']]
+        assert r.execute_command('TS.REVRANGE', 'tester', 0, 50, 'AGGREGATION', 'max', 10, 'EMPTY', 'NEXT') == \
+               [[40, b'5'], [30, b'5'], [20, b'5'], [10, b'3'], [0, b'2']]
+        assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10, 'ALIGN', 5,
+                                 'EMPTY', 'LINEAR') == \
+               [[0, b'3'], [5, b'3'], [15, b'4.5'], [25, b'6'], [35, b'7.5'], [45, b'9']]
+        assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'sum', 10, 'EMPTY', 'NAN',
+                                 'COUNT', 3) == [[0, b'3'], [10, b'3'], [20, b'nan']]
+
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'EMPTY')
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'max', 10, 'EMPTY', 'PREVIOUS')
+        with pytest.raises(redis.ResponseError) as excinfo:
+            assert r.execute_command('TS.RANGE', 'tester', 0, 50, 'AGGREGATION', 'max', 10, 'EMPTY', 5)